@@ -0,0 +1,138 @@
+/**
+ * @file arena.c
+ * @brief Implementation of the region (arena) memory allocator for the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * This source file contains the implementation of the region allocator used within the No Man's Sky Mod Creator (nmsmc) project.
+ * Memory is handed out from large blocks with a bump pointer and all the blocks are released at once.
+ *
+ * This file is part of the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 Juan José Ponteprino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author Juan José Ponteprino
+ * @date October 2023
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/**
+ * Alignment of the memory returned by arena_alloc.
+ */
+#define ARENA_ALIGNMENT     16
+
+/**
+ * Round a size up to the arena alignment.
+ */
+#define ARENA_ALIGN(x)      (((x) + ARENA_ALIGNMENT - 1) & ~((size_t)ARENA_ALIGNMENT - 1))
+
+/**
+ * Size of the block header, rounded so that block data stays aligned.
+ */
+#define ARENA_HEADER_SIZE   ARENA_ALIGN(sizeof(ArenaBlock))
+
+/**
+ * Allocate memory from an arena.
+ *
+ * The returned memory is suitably aligned for any of the project data structures and
+ * is not initialized. Consecutive allocations are contiguous while they fit in the current block.
+ *
+ * @param arena The arena to allocate from.
+ * @param size  The number of bytes to allocate.
+ *
+ * @return      A pointer to the allocated memory, or NULL on error.
+ */
+void *arena_alloc(Arena *arena, size_t size) {
+    size = ARENA_ALIGN(size ? size : 1);
+
+    ArenaBlock *block = arena->blocks;
+    if (!block || block->size - block->used < size) {
+        size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(ARENA_HEADER_SIZE + blockSize);
+        if (!block) return NULL;
+
+        block->size = blockSize;
+        block->used = 0;
+
+        if (arena->blocks && size > ARENA_BLOCK_SIZE) {
+            // Keep filling the current block; the dedicated one goes behind it
+            block->next = arena->blocks->next;
+            arena->blocks->next = block;
+        } else {
+            block->next = arena->blocks;
+            arena->blocks = block;
+        }
+    }
+
+    void *ptr = (char *)block + ARENA_HEADER_SIZE + block->used;
+    block->used += size;
+    return ptr;
+}
+
+/**
+ * Allocate zero-initialized memory from an arena.
+ *
+ * @param arena The arena to allocate from.
+ * @param size  The number of bytes to allocate.
+ *
+ * @return      A pointer to the allocated memory, or NULL on error.
+ */
+void *arena_calloc(Arena *arena, size_t size) {
+    void *ptr = arena_alloc(arena, size);
+    if (ptr) memset(ptr, 0, size);
+    return ptr;
+}
+
+/**
+ * Duplicate a string into an arena.
+ *
+ * @param arena The arena to allocate from.
+ * @param str   The string to duplicate.
+ *
+ * @return      A pointer to the copy of the string, or NULL on error.
+ */
+char *arena_strdup(Arena *arena, const char *str) {
+    size_t len = strlen(str) + 1;
+    char *copy = arena_alloc(arena, len);
+    if (copy) memcpy(copy, str, len);
+    return copy;
+}
+
+/**
+ * Release all the memory of an arena.
+ *
+ * Every pointer returned by the arena becomes invalid. The arena is left empty and can be reused.
+ *
+ * @param arena The arena to release.
+ */
+void arena_release(Arena *arena) {
+    ArenaBlock *block = arena->blocks;
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+}
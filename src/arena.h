@@ -0,0 +1,107 @@
+/**
+ * @file arena.h
+ * @brief Region (arena) memory allocator for the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * This header file declares a simple region allocator used within the No Man's Sky Mod Creator (nmsmc) project.
+ * Memory is handed out from large blocks with a bump pointer and is released all at once, which makes it
+ * suitable for data structures that share the same lifetime, such as the parsed mod definitions.
+ *
+ * This file is part of the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 Juan José Ponteprino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author Juan José Ponteprino
+ * @date October 2023
+ */
+
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#include <stddef.h>
+
+/**
+ * Default size of the blocks requested by an arena. Allocations larger than this
+ * get a dedicated block.
+ */
+#define ARENA_BLOCK_SIZE    65536
+
+// Structure to store a block of arena memory
+typedef struct ArenaBlock {
+    struct ArenaBlock * next;
+    size_t size;
+    size_t used;
+} ArenaBlock;
+
+// Structure to store an arena
+typedef struct Arena {
+    ArenaBlock * blocks;
+} Arena;
+
+/**
+ * Static initializer for an empty arena.
+ */
+#define ARENA_INIT          { NULL }
+
+/**
+ * Allocate memory from an arena.
+ *
+ * The returned memory is suitably aligned for any of the project data structures and
+ * is not initialized. Consecutive allocations are contiguous while they fit in the current block.
+ *
+ * @param arena The arena to allocate from.
+ * @param size  The number of bytes to allocate.
+ *
+ * @return      A pointer to the allocated memory, or NULL on error.
+ */
+void *arena_alloc(Arena *arena, size_t size);
+
+/**
+ * Allocate zero-initialized memory from an arena.
+ *
+ * @param arena The arena to allocate from.
+ * @param size  The number of bytes to allocate.
+ *
+ * @return      A pointer to the allocated memory, or NULL on error.
+ */
+void *arena_calloc(Arena *arena, size_t size);
+
+/**
+ * Duplicate a string into an arena.
+ *
+ * @param arena The arena to allocate from.
+ * @param str   The string to duplicate.
+ *
+ * @return      A pointer to the copy of the string, or NULL on error.
+ */
+char *arena_strdup(Arena *arena, const char *str);
+
+/**
+ * Release all the memory of an arena.
+ *
+ * Every pointer returned by the arena becomes invalid. The arena is left empty and can be reused.
+ *
+ * @param arena The arena to release.
+ */
+void arena_release(Arena *arena);
+
+#endif /* __ARENA_H */
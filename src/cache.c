@@ -0,0 +1,278 @@
+/**
+ * @file cache.c
+ * @brief Persistent cache of extracted and decompiled files for the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * This source file implements the on-disk cache of the MBIN files extracted from the game PAK files,
+ * of the EXML files MBINCompiler decompiles from them, and of the MBIN files it compiles back.
+ *
+ * This file is part of the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 Juan José Ponteprino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author Juan José Ponteprino
+ * @date October 2023
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include "common.h"
+#include "fs_utils.h"
+#include "hashtable.h"
+#include "misc.h"
+#include "thread.h"
+#include "cache.h"
+
+// Structure to store a file being added to the cache by cache_store()
+typedef struct CacheSource {
+    const char* path;
+    int move;
+} CacheSource;
+
+// Canonical path of the cache directory, NULL while the cache is off
+static char* cacheDir = NULL;
+
+// Identity of MBINCompiler, which names the directories of the EXML files
+static uint64_t compilerId = 0;
+
+// Directory of the MBIN files compiled by the current MBINCompiler, NULL while the cache is off
+static char* compiledDir = NULL;
+
+/**
+ * Open the cache.
+ *
+ * @param dir       The cache directory, or NULL for the default one.
+ *
+ * @return          0 on success, 1 if the cache can't be used.
+ *
+ * The cache is off when there is no default directory, or when MBINCompiler can't be found, as
+ * the EXML files couldn't be told apart from the ones of another version.
+ */
+int cache_init(const char* dir) {
+    char path[MAX_PATH];
+    if (!dir) {
+#ifdef _WIN32
+        const char* base = getenv("LOCALAPPDATA");
+        if (!base || !*base) return 1;
+        snprintf(path, sizeof(path), "%s/nmsmc", base);
+        path_to_unix(NULL, path);
+#else
+        const char* base = getenv("XDG_CACHE_HOME");
+        if (base && *base) {
+            snprintf(path, sizeof(path), "%s/nmsmc", base);
+        } else if ((base = getenv("HOME")) && *base) {
+            snprintf(path, sizeof(path), "%s/.cache/nmsmc", base);
+        } else {
+            return 1;
+        }
+#endif
+        dir = path;
+    }
+
+    if (mkpath(dir, 0755)) {
+        fprintf(stderr, "Error creating cache directory: %s\n", dir);
+        return 1;
+    }
+
+    char* compiler = find_program(MBINCompiler);
+    int result = !compiler || file_identity(compiler, &compilerId);
+    free(compiler);
+    if (result) return 1;
+
+    // The cache directory is kept as an absolute path, like the temporary directory
+    if (!(cacheDir = canonical_path(dir))) return 1;
+
+    snprintf(path, sizeof(path), "%s/compiled-%016llx", cacheDir, (unsigned long long) compilerId);
+    if (!(compiledDir = strdup(path))) {
+        cache_cleanup();
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Release the cache.
+ */
+void cache_cleanup(void) {
+    free(cacheDir);
+    free(compiledDir);
+    cacheDir = compiledDir = NULL;
+}
+
+/**
+ * Get the cache directories of an input PAK file.
+ *
+ * @param pakFile   The path of the input PAK file.
+ * @param mbinDir   Where the directory of its MBIN files is stored.
+ * @param exmlDir   Where the directory of its EXML files, for the current MBINCompiler, is stored.
+ *
+ * @return          0 on success, 1 if the cache is off, the file doesn't exist or on error.
+ */
+int cache_input_dirs(const char* pakFile, char** mbinDir, char** exmlDir) {
+    *mbinDir = *exmlDir = NULL;
+
+    uint64_t pakId;
+    if (!cacheDir || file_identity(pakFile, &pakId)) return 1;
+
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s/%016llx", cacheDir, (unsigned long long) pakId);
+    *mbinDir = strdup(path);
+    snprintf(path, sizeof(path), "%s/%016llx/exml-%016llx", cacheDir, (unsigned long long) pakId, (unsigned long long) compilerId);
+    *exmlDir = strdup(path);
+
+    if (!*mbinDir || !*exmlDir) {
+        free(*mbinDir);
+        free(*exmlDir);
+        *mbinDir = *exmlDir = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Check whether a file is in the cache.
+ *
+ * @param dir       A directory returned by cache_input_dirs().
+ * @param file      The path of the file, relative to the directory.
+ *
+ * @return          1 if it is, 0 otherwise.
+ */
+int cache_has(const char* dir, const char* file) {
+    char path[MAX_PATH];
+    struct stat st;
+    if (snprintf(path, sizeof(path), "%s/%s", dir, file) >= (int) sizeof(path)) return 0;
+    return !stat(path, &st) && (st.st_mode & S_IFMT) == S_IFREG;
+}
+
+/**
+ * Copy a file from the cache.
+ *
+ * @param dir       A directory returned by cache_input_dirs().
+ * @param file      The path of the file, relative to the directory.
+ * @param dest      The path of the copy.
+ *
+ * @return          0 on success, 1 on error.
+ */
+int cache_fetch(const char* dir, const char* file, const char* dest) {
+    char path[MAX_PATH];
+    if (snprintf(path, sizeof(path), "%s/%s", dir, file) >= (int) sizeof(path)) return 1;
+    return !copy_file(path, dest);
+}
+
+/**
+ * Add a file to the cache, written by a function.
+ *
+ * @param dir       A directory returned by cache_input_dirs().
+ * @param file      The path of the file in the cache, relative to the directory.
+ * @param write     The function that writes the file, returning 0 on success.
+ * @param data      The argument of the function.
+ *
+ * @return          0 on success, 1 on error.
+ *
+ * The temporary name is unique to the process and thread, so that two of them storing the same
+ * file don't write over each other; the last rename wins, and both copies are the same. On Windows
+ * the rename fails if the file is already there, which is just as good.
+ */
+int cache_write(const char* dir, const char* file, int (*write)(void* data, const char* path), void* data) {
+    static THREAD_LOCAL char thread;    // its address tells the threads apart
+    char path[MAX_PATH];
+    char temp[MAX_PATH];
+    if (snprintf(path, sizeof(path), "%s/%s", dir, file) >= (int) sizeof(path) ||
+        snprintf(temp, sizeof(temp), "%s.%d.%p", path, (int) getpid(), (void*) &thread) >= (int) sizeof(temp)) {
+        return 1;
+    }
+
+    if (mkpath_parent(path, 0755) || write(data, temp) || rename(temp, path)) {
+        remove(temp);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Move or copy a file to the temporary name of a cache file.
+ *
+ * @param data      The CacheSource of the file.
+ * @param path      The temporary name.
+ *
+ * @return          0 on success, 1 on error.
+ */
+static int write_cache_source(void* data, const char* path) {
+    CacheSource* source = data;
+    if (source->move && !rename(source->path, path)) return 0;
+    return !copy_file(source->path, path);
+}
+
+/**
+ * Add a file to the cache.
+ *
+ * @param source    The path of the file.
+ * @param dir       A directory returned by cache_input_dirs().
+ * @param file      The path of the file in the cache, relative to the directory.
+ * @param move      1 to move the source file when it is on the same file system, 0 to copy it.
+ *
+ * @return          0 on success, 1 on error.
+ */
+int cache_store(const char* source, const char* dir, const char* file, int move) {
+    CacheSource s = { source, move };
+    return cache_write(dir, file, write_cache_source, &s);
+}
+
+/**
+ * Get the cache directory of the compiled MBIN files.
+ *
+ * @return          The directory, or NULL if the cache is off.
+ */
+const char* cache_compiled_dir(void) {
+    return compiledDir;
+}
+
+/**
+ * Get the name of the compiled MBIN file of an EXML file in the cache.
+ *
+ * @param exmlFile  The path of the EXML file.
+ * @param name      The buffer where the name is stored.
+ * @param size      The size of the buffer.
+ *
+ * @return          0 on success, 1 if the file can't be read or the buffer is too small.
+ */
+int cache_compiled_name(const char* exmlFile, char* name, size_t size) {
+    size_t length;
+    const char* buffer = map_file(exmlFile, &length);
+    if (!buffer) return 1;
+
+    uint64_t hash = hash_bytes(buffer, length, HASH_SEED);
+    unmap_file(buffer, length);
+    return snprintf(name, size, "%016llx-%llu.MBIN", (unsigned long long) hash, (unsigned long long) length) >= (int) size;
+}
@@ -0,0 +1,149 @@
+/**
+ * @file cache.h
+ * @brief Persistent cache of extracted and decompiled files for the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * This header file declares the on-disk cache of the MBIN files extracted from the game PAK files
+ * and of the EXML files MBINCompiler decompiles from them. The files of each input PAK file are kept
+ * under a directory named after its identity (canonical path, size and modification time), and the
+ * EXML files under a subdirectory named after the identity of MBINCompiler, so that a game update or
+ * a new MBINCompiler makes the runs start over without removing anything. The MBIN files compiled
+ * from patched EXML files are kept by the contents of the EXML file, for the same MBINCompiler.
+ *
+ * This file is part of the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 Juan José Ponteprino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author Juan José Ponteprino
+ * @date October 2023
+ */
+
+#ifndef __CACHE_H
+#define __CACHE_H
+
+#include <stddef.h>
+
+/**
+ * Open the cache.
+ *
+ * The default directory is "nmsmc" under XDG_CACHE_HOME, or under ~/.cache (LOCALAPPDATA on
+ * Windows). The directory is created if needed. Until this function succeeds, the cache is off.
+ *
+ * @param dir       The cache directory, or NULL for the default one.
+ *
+ * @return          0 on success, 1 if the cache can't be used.
+ */
+int cache_init(const char *dir);
+
+/**
+ * Release the cache.
+ */
+void cache_cleanup(void);
+
+/**
+ * Get the cache directories of an input PAK file.
+ *
+ * @param pakFile   The path of the input PAK file.
+ * @param mbinDir   Where the directory of its MBIN files is stored. Release it with free().
+ * @param exmlDir   Where the directory of its EXML files, for the current MBINCompiler, is stored.
+ *                  Release it with free().
+ *
+ * @return          0 on success, 1 if the cache is off, the file doesn't exist or on error.
+ */
+int cache_input_dirs(const char *pakFile, char **mbinDir, char **exmlDir);
+
+/**
+ * Check whether a file is in the cache.
+ *
+ * @param dir       A directory returned by cache_input_dirs().
+ * @param file      The path of the file, relative to the directory.
+ *
+ * @return          1 if it is, 0 otherwise.
+ */
+int cache_has(const char *dir, const char *file);
+
+/**
+ * Copy a file from the cache.
+ *
+ * @param dir       A directory returned by cache_input_dirs().
+ * @param file      The path of the file, relative to the directory.
+ * @param dest      The path of the copy.
+ *
+ * @return          0 on success, 1 on error.
+ */
+int cache_fetch(const char *dir, const char *file, const char *dest);
+
+/**
+ * Add a file to the cache, written by a function.
+ *
+ * The file is written under a temporary name and renamed, so that other threads and processes
+ * never see it partially written. It can be called from any thread.
+ *
+ * @param dir       A directory returned by cache_input_dirs().
+ * @param file      The path of the file in the cache, relative to the directory.
+ * @param write     The function that writes the file to the path it is given, returning 0 on
+ *                  success.
+ * @param data      The argument of the function.
+ *
+ * @return          0 on success, 1 on error.
+ */
+int cache_write(const char *dir, const char *file, int (*write)(void *data, const char *path), void *data);
+
+/**
+ * Add a file to the cache.
+ *
+ * The file is copied or moved as cache_write() writes files.
+ *
+ * @param source    The path of the file.
+ * @param dir       A directory returned by cache_input_dirs().
+ * @param file      The path of the file in the cache, relative to the directory.
+ * @param move      1 to move the source file when it is on the same file system, which leaves
+ *                  it missing; 0 to copy it.
+ *
+ * @return          0 on success, 1 on error.
+ */
+int cache_store(const char *source, const char *dir, const char *file, int move);
+
+/**
+ * Get the cache directory of the compiled MBIN files.
+ *
+ * The directory is named after the identity of MBINCompiler, as the EXML files are.
+ *
+ * @return          The directory, or NULL if the cache is off.
+ */
+const char *cache_compiled_dir(void);
+
+/**
+ * Get the name of the compiled MBIN file of an EXML file in the cache.
+ *
+ * The name is made of a hash and the size of the contents of the EXML file, so that two EXML files
+ * patched the same way share their MBIN file, whatever their MBIN file is called in the PAK files.
+ *
+ * @param exmlFile  The path of the EXML file.
+ * @param name      The buffer where the name is stored.
+ * @param size      The size of the buffer.
+ *
+ * @return          0 on success, 1 if the file can't be read or the buffer is too small.
+ */
+int cache_compiled_name(const char *exmlFile, char *name, size_t size);
+
+#endif /* __CACHE_H */
@@ -39,5 +39,9 @@
 extern char* MBINCompiler;
 extern char* PSAR;
 extern char* tmpdir;
+extern int streamMode;
+extern int maxResident;
+extern int jobs;
+extern int forceBuild;
 
 #endif /* __COMMON_H */
@@ -38,29 +38,209 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <sys/stat.h>
 
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 #include <libxml/xpath.h>
+#include <libxml/xmlreader.h>
 
 #ifdef _WIN32
 #include <process.h>
 #else
 #include <unistd.h>
+#include <sys/wait.h>
 #endif
 
 #include "common.h"
+#include "arena.h"
+#include "hashtable.h"
+#include "exml.h"
+#include "cache.h"
+#include "manifest.h"
 #include "fs_utils.h"
 #include "misc.h"
+#include "thread.h"
 #include "definition.h"
-
-#ifndef _WIN32
 #include "spawn.h"
-#endif
 
-xmlDocPtr doc = NULL;
+/*
+ * The state used while patching documents is thread-local: every input PAK file is patched by
+ * its own thread, which starts from the current path left by the ones before it.
+ */
+THREAD_LOCAL xmlDocPtr doc = NULL;
+
+// Current path, resolved from the "cd" commands ("/A/B" for absolute paths)
+THREAD_LOCAL char resolvedPath[32768] = "";
+
+// XPath expression of the current path
+THREAD_LOCAL const char* xpath = "";
+
+// Structure to store the messages of a patch thread until they are printed
+typedef struct PatchLog {
+    char * text;            // the messages, each one after a byte telling its stream (1 stdout, 2 stderr)
+    size_t length;
+    size_t capacity;
+} PatchLog;
+
+// Messages of the input PAK file patched by the current thread, NULL to print them at once
+static THREAD_LOCAL PatchLog* patchLog = NULL;
+
+/**
+ * Print a message while patching documents.
+ *
+ * @param stream - stdout or stderr.
+ * @param format - The printf format of the message.
+ *
+ * Messages of patch threads are kept in their log, so that the messages of every input PAK file
+ * are printed together and in order, by the main thread.
+ */
+static void patch_printf(FILE* stream, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (!patchLog) {
+        vfprintf(stream, format, args);
+        va_end(args);
+        return;
+    }
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (length < 0) return;
+
+    if (patchLog->length + length + 2 > patchLog->capacity) {
+        size_t capacity = patchLog->capacity ? patchLog->capacity * 2 : 256;
+        while (patchLog->length + length + 2 > capacity) capacity *= 2;
+        char* text = realloc(patchLog->text, capacity);
+        if (!text) return;
+        patchLog->text = text;
+        patchLog->capacity = capacity;
+    }
+
+    patchLog->text[patchLog->length++] = stream == stderr ? 2 : 1;
+    va_start(args, format);
+    vsnprintf(&patchLog->text[patchLog->length], length + 1, format, args);
+    va_end(args);
+    patchLog->length += length + 1;
+}
+
+/**
+ * Print the messages of a patch thread and empty its log.
+ *
+ * @param log - The log of the thread.
+ */
+static void print_patch_log(PatchLog* log) {
+    for (size_t i = 0; i < log->length; ) {
+        fputs(&log->text[i + 1], log->text[i] == 2 ? stderr : stdout);
+        i += strlen(&log->text[i + 1]) + 2;
+    }
+    free(log->text);
+    memset(log, 0, sizeof(PatchLog));
+}
+
+// Types of the steps of a compiled path
+typedef enum {
+    STEP_ANY,       // "*": any child element
+    STEP_PARENT,    // "..": the parent node
+    STEP_PROPERTY   // "name", "=value", "name=value", "name[=value]": matching Property children
+} PathStepType;
+
+// Structure to store a step of a compiled path
+typedef struct PathStep {
+    PathStepType type;
+    const char* name;
+    const char* value;
+} PathStep;
+
+// Value depth of the paths that don't compare values
+#define NO_VALUE_DEPTH  LONG_MIN
+
+// Structure to store the compiled form of a resolved "cd" path
+typedef struct CompiledPath {
+    const char* xpath;
+    PathStep * steps;
+    size_t stepCount;
+    int native;
+    int literal;        // names and values can be compared literally (no quotes)
+    long depth;         // depth of the selected nodes, relative to the start of the path
+    long valueDepth;    // deepest level where values are compared, NO_VALUE_DEPTH if none
+    int cursorSafe;     // the selected nodes can be reused by the next relative "cd"
+    xmlXPathCompExprPtr comp;
+} CompiledPath;
+
+// Structure to store a set of selected nodes
+typedef struct NodeSet {
+    xmlNodePtr * nodes;
+    size_t count;
+    size_t capacity;
+} NodeSet;
+
+// Node sets used while walking paths, reused across evaluations
+static THREAD_LOCAL NodeSet walkSets[2] = { { NULL, 0, 0 }, { NULL, 0, 0 } };
+
+// Nodes selected by the previous block of the current document, if they can be reused
+static THREAD_LOCAL NodeSet cursorSet = { NULL, 0, 0 };
+static THREAD_LOCAL int cursorValid = 0;
+static THREAD_LOCAL long cursorDepth = 0;
+static THREAD_LOCAL long cursorValueDepth = 0;
+
+// Set when a modification changes the document being patched
+static THREAD_LOCAL int documentChanged = 0;
 
-char xpath[32768] = "";
+// Structure to store a set of selected nodes of an EXML document
+typedef struct ExmlNodeSet {
+    uint32_t * nodes;
+    size_t count;
+    size_t capacity;
+} ExmlNodeSet;
+
+// EXML document being modified
+static THREAD_LOCAL ExmlDocument* exmlDoc = NULL;
+
+// Node sets used while walking paths in EXML documents, reused across evaluations
+static THREAD_LOCAL ExmlNodeSet exmlWalkSets[2] = { { NULL, 0, 0 }, { NULL, 0, 0 } };
+
+// Nodes selected by the previous block of the current EXML document, if they can be reused
+static THREAD_LOCAL ExmlNodeSet exmlCursorSet = { NULL, 0, 0 };
+static THREAD_LOCAL int exmlCursorValid = 0;
+static THREAD_LOCAL long exmlCursorDepth = 0;
+static THREAD_LOCAL long exmlCursorValueDepth = 0;
+
+static void release_child_indexes(void);
+static void release_document(MBINData* mbinData);
+static void release_resident(void);
+static void release_patch_state(void);
+static void patch_input(void* arg);
+static int check_path(const char* path);
+void set_xpath(const char* path);
+
+// Parser context for the documents loaded with libxml2, so that they all share its dictionary
+static THREAD_LOCAL xmlParserCtxtPtr parserContext = NULL;
+
+// Cache directory of the XML files being patched, where the snapshots of their documents are kept,
+// NULL without the cache
+static THREAD_LOCAL const char* snapshotDir = NULL;
+
+// Documents loaded at once by all the patch threads, kept under --max-resident by
+// load_document(). The limit is set by pipeline_init() and is 0 (no limit) outside of the pipeline
+static Mutex residentMutex;
+static Condition residentCondition;    // signaled when a document is released
+static int residentLimit = 0;
+static int residentCount = 0;
+
+/**
+ * Options for loading EXML files with libxml2. Blank text nodes are kept (no XML_PARSE_NOBLANKS),
+ * since the files are saved back as they were read.
+ */
+#define XML_LOAD_OPTIONS    (XML_PARSE_COMPACT | XML_PARSE_HUGE)
+
+// Compiled form of the current XPath
+static THREAD_LOCAL CompiledPath* compiledPath = NULL;
+
+// Compiled paths indexed by XPath expression, and the arena holding them
+static THREAD_LOCAL Arena compiledPathArena = ARENA_INIT;
+static THREAD_LOCAL HashTable compiledPaths = { NULL, 0, 0, NULL };
 
 static ModificationData* currentModification = NULL;
 static MBINData *currentMbinData = NULL;
@@ -68,58 +248,125 @@ static InputPakFileData* currentInputPakFileList = NULL;
 static OutputPakFileData* currentOutputPakFile = NULL;
 static OutputPakFileData * lastOutputPakFile = NULL;
 
+// Types of the directives found in a definition file
+typedef enum {
+    OP_INCLUDE,
+    OP_OUTPUT_PAK,
+    OP_ADD_FILE,
+    OP_INPUT_PAK,
+    OP_MBIN,
+    OP_CD,
+    OP_ASSIGN
+} DefinitionOpType;
+
+// Structure to store a lexed directive ("name=value" for OP_ASSIGN, the argument otherwise)
+typedef struct DefinitionOp {
+    DefinitionOpType type;
+    char* arg;
+    char* value;
+    struct DefinitionOp * next;
+} DefinitionOp;
+
+// Structure to store the directives of an already read definition file
+typedef struct IncludeCacheEntry {
+    char* path;
+    size_t size;
+    uint64_t hash;
+    DefinitionOp * ops;
+} IncludeCacheEntry;
+
+// Number of errors found while parsing definitions
+static int parseErrors = 0;
+
+/**
+ * Report a definition parse error.
+ *
+ * This macro prints an error message to stderr and counts it, so that definitions with
+ * errors are never stored in the definition cache.
+ */
+#define PARSE_ERROR(...)    (parseErrors++, fprintf(stderr, __VA_ARGS__))
+
+// Arena for the definition tree, the lexed directives and their strings
+static Arena definitionArena = ARENA_INIT;
+
+// Arena for ModificationData and NameValue, kept apart so that each "cd" block and its
+// name/value pairs are laid out contiguously in the order process_definitions() walks them
+static Arena modificationArena = ARENA_INIT;
+
+// Index of the lexed definition files by canonical path
+static HashTable includeCache = { NULL, 0, 0, &definitionArena };
+
+// Memory mapping of the loaded definition cache, which the definition tree points into
+static const char* definitionCacheBuffer = NULL;
+static size_t definitionCacheSize = 0;
+
+/**
+ * Release the patch state of the current thread.
+ *
+ * The compiled "cd" paths, the node sets and the parser context are kept from one document to the
+ * next; a patch thread releases them when it is done, and the main thread in definition_cleanup.
+ */
+static void release_patch_state(void) {
+    if (parserContext) xmlFreeParserCtxt(parserContext);
+    parserContext = NULL;
+
+    for (size_t i = 0; i < compiledPaths.capacity; i++) {
+        CompiledPath* path = compiledPaths.entries[i].value;
+        if (compiledPaths.entries[i].key && path->comp) xmlXPathFreeCompExpr(path->comp);
+    }
+    hash_free(&compiledPaths);
+    arena_release(&compiledPathArena);
+    compiledPath = NULL;
+
+    free(walkSets[0].nodes);
+    free(walkSets[1].nodes);
+    memset(walkSets, 0, sizeof(walkSets));
+    free(cursorSet.nodes);
+    memset(&cursorSet, 0, sizeof(cursorSet));
+    cursorValid = 0;
+
+    free(exmlWalkSets[0].nodes);
+    free(exmlWalkSets[1].nodes);
+    memset(exmlWalkSets, 0, sizeof(exmlWalkSets));
+    free(exmlCursorSet.nodes);
+    memset(&exmlCursorSet, 0, sizeof(exmlCursorSet));
+    exmlCursorValid = 0;
+
+    release_child_indexes();
+}
+
 /**
  * Cleans up memory associated with OutputPakFileData and related data structures.
  *
  * @param outputPakFileList - The list of OutputPakFileData to be cleaned up.
  *
- * This function deallocates memory associated with OutputPakFileData and its related data structures,
- * including InputPakFileData, MBINData, ModificationData, and NameValue structures.
+ * All the definition data structures (OutputPakFileData, InputPakFileData, MBINData, ModificationData,
+ * NameValue and ExtraFile) and the cache of lexed definition files live in the definition arenas,
+ * so this function releases them at once, along with the mapping of a loaded definition cache and
+ * the compiled "cd" paths. Documents still loaded when processing stopped early are released first.
  */
 void definition_cleanup(OutputPakFileData* outputPakFileList) {
-    void *ptr;
-    OutputPakFileData * outputPakFile = outputPakFileList;
-    while( outputPakFile ) {
-        free(outputPakFile->outputPakFile);
-        InputPakFileData * inputPakFile = outputPakFile->inputPakFileList;
-        while( inputPakFile ) {
-            MBINData * mbinData = inputPakFile->mbinData;
-            while( mbinData ) {
-                ModificationData * modification = mbinData->modifications;
-                while( modification ) {
-                    NameValue * namevalue = modification->values;
-                    while( namevalue ) {
-                        free(namevalue->name);
-                        free(namevalue->value);
-                        ptr = namevalue->next;
-                        free(namevalue);
-                        namevalue = ptr;
-                    }
-                    ptr = modification->next;
-                    free(modification);
-                    modification = ptr;
-                }
-                ptr = mbinData->next;
-                free(mbinData);
-                mbinData = ptr;
-            }
-            ptr = inputPakFile->next;
-            free(inputPakFile->inputPakFile);
-            inputPakFile = ptr;
-        }
-        if ( outputPakFile->extraFileList ) {
-            ExtraFile * extraFile = outputPakFile->extraFileList;
-            while( extraFile ) {
-                free(extraFile->filename);
-                ptr = extraFile->next;
-                free(extraFile);
-                extraFile = ptr;
-            }
+    for (OutputPakFileData* o = outputPakFileList; o; o = o->next) {
+        for (InputPakFileData* i = o->inputPakFileList; i; i = i->next) {
+            for (MBINData* m = i->mbinData; m; m = m->next) release_document(m);
         }
-        ptr = outputPakFile->next;
-        free(outputPakFile);
-        outputPakFile = ptr;
     }
+    release_patch_state();
+
+    arena_release(&modificationArena);
+    arena_release(&definitionArena);
+
+    unmap_file(definitionCacheBuffer, definitionCacheSize);
+    definitionCacheBuffer = NULL;
+    definitionCacheSize = 0;
+
+    hash_init(&includeCache, &definitionArena);
+    parseErrors = 0;
+    currentModification = NULL;
+    currentMbinData = NULL;
+    currentInputPakFileList = NULL;
+    currentOutputPakFile = NULL;
+    lastOutputPakFile = NULL;
 }
 
 /**
@@ -128,16 +375,17 @@ void definition_cleanup(OutputPakFileData* outputPakFileList) {
  * @param file - The name of the output pak file.
  * @return A pointer to the newly created OutputPakFileData structure.
  *
- * This function allocates memory for a new OutputPakFileData structure and initializes its values.
+ * This function allocates a new OutputPakFileData structure from the definition arena and initializes its values.
  */
 static OutputPakFileData* createOutputPakFileData(const char* file) {
-    OutputPakFileData* data = (OutputPakFileData*)malloc(sizeof(OutputPakFileData));
+    OutputPakFileData* data = (OutputPakFileData*)arena_alloc(&definitionArena, sizeof(OutputPakFileData));
     if (!data) return NULL;
 
     // Initialize the values of OutputPakFileData
-    data->outputPakFile = file ? strdup(file) : NULL;
+    data->outputPakFile = file ? arena_strdup(&definitionArena, file) : NULL;
     data->inputPakFileList = NULL;
     data->lastInputPakFileList = NULL;
+    hash_init(&data->inputPakIndex, &definitionArena);
     data->totalMbinCount = 0;
     data->extraFileList = NULL;
     data->extraFileCount = 0;
@@ -152,18 +400,10 @@ static OutputPakFileData* createOutputPakFileData(const char* file) {
  * @param inputPakFile - The name of the pak file to search for.
  * @return A pointer to the found InputPakFileData structure, or NULL if not found.
  *
- * This function searches for an InputPakFileData structure within the currentOutputPakFile
- * based on the provided file name.
+ * This function looks up the provided file name in the input pak index of the currentOutputPakFile.
  */
 InputPakFileData * search_input_pak(const char *inputPakFile) {
-    InputPakFileData * inputPak = currentOutputPakFile->inputPakFileList;
-    while( inputPak ) {
-        if (!strcmp(inputPakFile, inputPak->inputPakFile)) {
-            return inputPak;
-        }
-        inputPak = inputPak->next;
-    }
-    return NULL;
+    return hash_get(&currentOutputPakFile->inputPakIndex, inputPakFile);
 }
 
 /**
@@ -172,81 +412,256 @@ InputPakFileData * search_input_pak(const char *inputPakFile) {
  * @param mbinFile - The name of the MBIN file to search for.
  * @return A pointer to the found MBINData structure, or NULL if not found.
  *
- * This function searches for an MBINData structure within the currentInputPakFileList
- * based on the provided MBIN file name.
+ * This function looks up the provided MBIN file name in the MBIN index of the currentInputPakFileList.
  */
 MBINData * search_mbin(const char *mbinFile) {
-    MBINData * mbinData = currentInputPakFileList->mbinData;
-    while( mbinData ) {
-        if (!strcmp(mbinFile, mbinData->mbinFile)) {
-            return mbinData;
-        }
-        mbinData = mbinData->next;
-    }
-    return NULL;
+    return hash_get(&currentInputPakFileList->mbinIndex, mbinFile);
 }
 
+// Structure to store a slice of the mapped definition file
+typedef struct Slice {
+    const char* ptr;
+    size_t len;
+} Slice;
+
 /**
  * Checks if the current line starts with a specified token.
  *
  * @param x - The token to check for at the beginning of the line.
  * @return 1 if the line starts with the token, 0 otherwise.
  *
- * This macro is used to check if the current line starts with a specified token.
+ * This macro is used to check if the current line (a Slice) starts with a specified token.
  */
-#define CHECK_TOKEN(x)  (!strncmp(line, x, sizeof(x) - 1))
+#define CHECK_TOKEN(x)  (line.len >= sizeof(x) - 1 && !memcmp(line.ptr, x, sizeof(x) - 1))
 
 /**
- * Function to parse a text file and populate InputPakFileData.
+ * Remove leading and trailing white spaces from a slice.
  *
- * @param filename - The name of the input text file to parse.
- * @param ouputPakFileDataList - The list of OutputPakFileData to which data will be added.
- * @return A pointer to the updated OutputPakFileData list.
+ * @param s - The slice to trim.
+ * @return The trimmed slice, pointing into the same buffer.
+ */
+static Slice trim_slice(Slice s) {
+    while (s.len && isspace((unsigned char)s.ptr[0])) {
+        s.ptr++;
+        s.len--;
+    }
+    while (s.len && isspace((unsigned char)s.ptr[s.len - 1])) {
+        s.len--;
+    }
+    return s;
+}
+
+/**
+ * Get the argument that follows a directive token on a line.
+ *
+ * @param line - The trimmed line containing the directive.
+ * @return The trimmed argument (empty if the directive has no argument).
  *
- * This function reads and processes a text file line by line. It parses commands and data from the file,
- * including commands like "!include," "!outputPakFile," "!addFile," "!inputPakFile," "!mbinFile," "cd," and
- * assignments of the form "name=value" within a "cd" block. It populates the relevant data structures with the
- * parsed information.
+ * The directive token ends at the first white space; everything after it is the argument.
  */
-OutputPakFileData* parse_definition(const char* filename, OutputPakFileData* ouputPakFileDataList) {
-    FILE* file = fopen(filename, "r");
-    if (!file) {
-        fprintf(stderr, "Error: Could not open the file [%s]\n", filename);
-        return NULL;
+static Slice get_token_argument(Slice line) {
+    Slice arg = { line.ptr + line.len, 0 };
+    for (size_t i = 0; i < line.len; i++) {
+        char c = line.ptr[i];
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            arg.ptr = line.ptr + i + 1;
+            arg.len = line.len - i - 1;
+            break;
+        }
+    }
+    return trim_slice(arg);
+}
+
+/**
+ * Copy a non-empty slice into the definition arena as a null-terminated string.
+ *
+ * @param s - The slice to copy.
+ * @return The copied string, or NULL if the slice is empty.
+ */
+static char* slice_strdup(Slice s) {
+    if (!s.len) return NULL;
+    char* str = arena_alloc(&definitionArena, s.len + 1);
+    if (str) {
+        memcpy(str, s.ptr, s.len);
+        str[s.len] = '\0';
     }
+    return str;
+}
+
+/**
+ * Lex a definition file into a list of directives.
+ *
+ * @param buffer - The contents of the definition file (usually memory-mapped).
+ * @param size - The size of the contents in bytes.
+ * @return The list of DefinitionOp read from the file (NULL for an empty file).
+ *
+ * This function walks the buffer line by line, strips comments and white spaces, and records
+ * every directive and assignment as a DefinitionOp. Lines are handled as slices of the buffer,
+ * so there is no line length limit and nothing is copied except the strings kept by the
+ * directives. No definition data is created here; the resulting list is immutable and can be
+ * replayed any number of times.
+ */
+static DefinitionOp* lex_definition(const char* buffer, size_t size) {
+    DefinitionOp* ops = NULL;
+    DefinitionOp* lastOp = NULL;
+
+    const char* end = buffer + size;
+    const char* p = buffer;
+    while (p < end) {
+        const char* eol = memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+
+        Slice line = { p, eol - p };
+        p = eol + 1;
 
-    char line[256];
-    while (fgets(line, sizeof(line), file)) {
         // Remove comments from the line
-        char* comment = strchr(line, '#');
+        const char* comment = memchr(line.ptr, '#', line.len);
         if (comment)
-            *comment = '\0';
+            line.len = comment - line.ptr;
 
         // Remove leading and trailing whitespace from the line
-        trim(line);
-        if (!*line)
+        line = trim_slice(line);
+        if (!line.len)
             continue;
 
-        // Search for the "!include" token
+        DefinitionOp* op = (DefinitionOp*)arena_alloc(&definitionArena, sizeof(DefinitionOp));
+        if (!op) {
+            PARSE_ERROR("Error: Memory allocation for DefinitionOp failed\n");
+            break;
+        }
+
+        op->arg = NULL;
+        op->value = NULL;
+        op->next = NULL;
+
         if (CHECK_TOKEN("!include")) {
-            char* token = strtok(line, " \t\r\n");
-            token = strtok(NULL, "\r\n");  // Get the value after the token
-            trim(token);
+            op->type = OP_INCLUDE;
+        } else if (CHECK_TOKEN("!outputPakFile")) {
+            op->type = OP_OUTPUT_PAK;
+        } else if (CHECK_TOKEN("!addFile")) {
+            op->type = OP_ADD_FILE;
+        } else if (CHECK_TOKEN("!inputPakFile")) {
+            op->type = OP_INPUT_PAK;
+        } else if (CHECK_TOKEN("!mbinFile")) {
+            op->type = OP_MBIN;
+        } else if (CHECK_TOKEN("cd")) {
+            op->type = OP_CD;
+        } else {
+            op->type = OP_ASSIGN;
+        }
+
+        if (op->type != OP_ASSIGN) {
+            op->arg = slice_strdup(get_token_argument(line));
+        } else {
+            // Split lines with "=" into "name=value"
+            Slice name = line;
+            const char* equal = memchr(line.ptr, '=', line.len);
+            if (equal) {
+                Slice value = { equal + 1, line.ptr + line.len - equal - 1 };
+                op->value = slice_strdup(trim_slice(value));
+                name.len = equal - line.ptr;
+            }
+            op->arg = slice_strdup(trim_slice(name));
+        }
+
+        if (!ops)
+            ops = op;
+        else
+            lastOp->next = op;
+        lastOp = op;
+    }
+
+    return ops;
+}
+
+/**
+ * Get the directives of a definition file, lexing it only the first time it is requested.
+ *
+ * @param filename - The name of the definition file.
+ * @return The IncludeCacheEntry of the file, or NULL if it could not be opened.
+ *
+ * Files are identified by their canonical path, so the same file reached through different
+ * relative paths is read from disk only once per run. The file is memory-mapped while it is lexed.
+ */
+static IncludeCacheEntry* load_definition(const char* filename) {
+    char* path = canonical_path(filename);
+    if (!path) {
+        PARSE_ERROR("Error: Could not open the file [%s]\n", filename);
+        return NULL;
+    }
+
+    IncludeCacheEntry* entry = hash_get(&includeCache, path);
+    if (entry) {
+        free(path);
+        return entry;
+    }
+
+    size_t size;
+    const char* buffer = map_file(filename, &size);
+    if (!buffer) {
+        PARSE_ERROR("Error: Could not open the file [%s]\n", filename);
+        free(path);
+        return NULL;
+    }
+
+    entry = (IncludeCacheEntry*)arena_alloc(&definitionArena, sizeof(IncludeCacheEntry));
+    if (!entry || !(entry->path = arena_strdup(&definitionArena, path))) {
+        PARSE_ERROR("Error: Memory allocation for IncludeCacheEntry failed\n");
+        unmap_file(buffer, size);
+        free(path);
+        return NULL;
+    }
+    free(path);
+
+    entry->size = size;
+    entry->hash = hash_bytes(buffer, size, HASH_SEED);
+    entry->ops = lex_definition(buffer, size);
+    unmap_file(buffer, size);
+
+    if (hash_put(&includeCache, entry->path, entry)) {
+        PARSE_ERROR("Error: Memory allocation for IncludeCacheEntry failed\n");
+        return NULL;
+    }
+
+    return entry;
+}
+
+/**
+ * Function to parse a text file and populate InputPakFileData.
+ *
+ * @param filename - The name of the input text file to parse.
+ * @param ouputPakFileDataList - The list of OutputPakFileData to which data will be added.
+ * @return A pointer to the updated OutputPakFileData list.
+ *
+ * This function replays the directives of a definition file. It handles commands like "!include,"
+ * "!outputPakFile," "!addFile," "!inputPakFile," "!mbinFile," "cd," and assignments of the form
+ * "name=value" within a "cd" block, and populates the relevant data structures with the parsed
+ * information. Each file is lexed once (see load_definition); further "!include" of the same file
+ * replay the cached directives without touching the filesystem. All the strings of the definition
+ * tree point into the cached directives, and every structure is allocated from the definition arenas.
+ */
+OutputPakFileData* parse_definition(const char* filename, OutputPakFileData* ouputPakFileDataList) {
+    IncludeCacheEntry* entry = load_definition(filename);
+    if (!entry) return NULL;
+
+    DefinitionOp* op = entry->ops;
+    for (; op; op = op->next) {
+        char* token = op->arg;
+
+        // Process the "!include" token
+        if (op->type == OP_INCLUDE) {
             if (token) {
                 // Call parse_definition recursively and add the data to the current list
                 ouputPakFileDataList = parse_definition(token, ouputPakFileDataList);
             }
         }
         // Process the "!outputPakFile" token
-        else if (CHECK_TOKEN("!outputPakFile")) {
-            char* token = strtok(line, " \t\r\n");
-            token = strtok(NULL, "\r\n");  // Get the value after the token
-            trim(token);
+        else if (op->type == OP_OUTPUT_PAK) {
             if (token) {
                 // Create a new OutputPakFileData structure and associate it with the current inputPakFileList
                 currentOutputPakFile = createOutputPakFileData(token);
                 if (!currentOutputPakFile ) {
-                    fprintf(stderr, "Error: Memory allocation for OutputPakFileData failed\n");
+                    PARSE_ERROR("Error: Memory allocation for OutputPakFileData failed\n");
                     return NULL;
                 }
                 if (!ouputPakFileDataList)
@@ -260,55 +675,56 @@ OutputPakFileData* parse_definition(const char* filename, OutputPakFileData* oup
                 currentInputPakFileList = NULL;
             }
         }
-        // Search for the "!addFile" token
-        else if (CHECK_TOKEN("!addFile")) {
+        // Process the "!addFile" token
+        else if (op->type == OP_ADD_FILE) {
             if (!currentOutputPakFile) {
-                fprintf(stderr, "Error: Expected !outputPakFile, but got !addFile.\n");
+                PARSE_ERROR("Error: Expected !outputPakFile, but got !addFile.\n");
                 return NULL;
             }
-            char* token = strtok(line, " \t\r\n");
-            token = strtok(NULL, "\r\n");  // Get the value after the token
-            trim(token);
             if (token) {
                 // Create a new InputPakFileData element and add it to the list
-                ExtraFile * e = (ExtraFile*)malloc(sizeof(ExtraFile));
+                ExtraFile * e = (ExtraFile*)arena_alloc(&definitionArena, sizeof(ExtraFile));
                 if (!e) {
-                    fprintf(stderr, "Error: Memory allocation for !addFile failed\n");
+                    PARSE_ERROR("Error: Memory allocation for !addFile failed\n");
                     return NULL;
                 }
 
-                e->filename = strdup(token);
+                e->filename = token;
                 e->next = currentOutputPakFile->extraFileList;
                 currentOutputPakFile->extraFileList = e;
 
                 currentOutputPakFile->extraFileCount++;
             }
         }
-        // Search for the "!inputPakFile" token
-        else if (CHECK_TOKEN("!inputPakFile")) {
+        // Process the "!inputPakFile" token
+        else if (op->type == OP_INPUT_PAK) {
             if (!currentOutputPakFile) {
-                fprintf(stderr, "Error: Expected !outputPakFile, but got !inputPakFile.\n");
+                PARSE_ERROR("Error: Expected !outputPakFile, but got !inputPakFile.\n");
                 return NULL;
             }
-            char* token = strtok(line, " \t\r\n");
-            token = strtok(NULL, "\r\n");  // Get the value after the token
-            trim(token);
             if (token) {
                 if (!(currentInputPakFileList = search_input_pak(token))) {
                     // Create a new InputPakFileData element and add it to the list
-                    currentInputPakFileList = (InputPakFileData*)malloc(sizeof(InputPakFileData));
+                    currentInputPakFileList = (InputPakFileData*)arena_alloc(&definitionArena, sizeof(InputPakFileData));
                     if (!currentInputPakFileList) {
-                        fprintf(stderr, "Error: Memory allocation for InputPakFileData failed\n");
+                        PARSE_ERROR("Error: Memory allocation for InputPakFileData failed\n");
                         return NULL;
                     }
 
                     // Initialize the values of InputPakFileData
-                    currentInputPakFileList->inputPakFile = strdup(token);
+                    currentInputPakFileList->inputPakFile = token;
                     currentInputPakFileList->mbinData = NULL;
                     currentInputPakFileList->mbinCount = 0;
                     currentInputPakFileList->lastMbinData = NULL;
+                    hash_init(&currentInputPakFileList->mbinIndex, &definitionArena);
+                    currentInputPakFileList->workDir = NULL;
                     currentInputPakFileList->next = NULL;
 
+                    if (hash_put(&currentOutputPakFile->inputPakIndex, token, currentInputPakFileList)) {
+                        PARSE_ERROR("Error: Memory allocation for InputPakFileData failed\n");
+                        return NULL;
+                    }
+
                     if (!currentOutputPakFile->inputPakFileList)
                         currentOutputPakFile->inputPakFileList = currentInputPakFileList;
                     else
@@ -319,33 +735,36 @@ OutputPakFileData* parse_definition(const char* filename, OutputPakFileData* oup
                 currentMbinData = NULL;
             }
         }
-        // Search for the "!mbinFile" token
-        else if (CHECK_TOKEN("!mbinFile")) {
+        // Process the "!mbinFile" token
+        else if (op->type == OP_MBIN) {
             if (!currentInputPakFileList) {
-                fprintf(stderr, "Error: Expected !inputPakFile, but got !mbinFile.\n");
+                PARSE_ERROR("Error: Expected !inputPakFile, but got !mbinFile.\n");
                 return NULL;
             }
-            char* token = strtok(line, " \t\r\n");
-            token = strtok(NULL, "\r\n");  // Get the value after the token
-            trim(token);
             if (token) {
                 if ((currentMbinData = search_mbin(token))) {
                     currentModification = currentMbinData->lastModifications;
                 } else {
                     // Add the ModificationData element to currentInputPakFileList
-                    currentMbinData = (MBINData*)malloc(sizeof(MBINData));
+                    currentMbinData = (MBINData*)arena_alloc(&definitionArena, sizeof(MBINData));
                     if (!currentMbinData) {
-                        fprintf(stderr, "Error: Memory allocation for mbinData failed\n");
-                        fclose(file);
+                        PARSE_ERROR("Error: Memory allocation for mbinData failed\n");
                         return NULL;
                     }
 
-                    currentMbinData->mbinFile = strdup(token);
+                    currentMbinData->mbinFile = token;
                     currentMbinData->modifications = NULL;
                     currentMbinData->lastModifications = NULL;
                     currentMbinData->xmlData = NULL;
+                    currentMbinData->exmlData = NULL;
+                    currentMbinData->dirty = 0;
                     currentMbinData->next = NULL;
 
+                    if (hash_put(&currentInputPakFileList->mbinIndex, token, currentMbinData)) {
+                        PARSE_ERROR("Error: Memory allocation for mbinData failed\n");
+                        return NULL;
+                    }
+
                     if (!currentInputPakFileList->mbinData)
                         currentInputPakFileList->mbinData = currentMbinData;
                     else
@@ -357,25 +776,22 @@ OutputPakFileData* parse_definition(const char* filename, OutputPakFileData* oup
                 }
             }
         }
-        // Search for the "cd" token and add it to currentModification
-        else if (CHECK_TOKEN("cd")) {
+        // Process the "cd" token and add it to currentModification
+        else if (op->type == OP_CD) {
             if (!currentMbinData) {
-                fprintf(stderr, "Error: Expected !mbinFile, but got \"cd\".\n");
+                PARSE_ERROR("Error: Expected !mbinFile, but got \"cd\".\n");
                 return NULL;
             }
-            char* token = strtok(line, " \t\r\n");
-            token = strtok(NULL, "\r\n");  // Get the value after the token
-            trim(token);
             if (token) {
                 // Create a new ModificationData element
-                currentModification = (ModificationData*)malloc(sizeof(ModificationData));
+                currentModification = (ModificationData*)arena_alloc(&modificationArena, sizeof(ModificationData));
                 if (!currentModification) {
-                    fprintf(stderr, "Error: Memory allocation for ModificationData failed\n");
+                    PARSE_ERROR("Error: Memory allocation for ModificationData failed\n");
                     return NULL;
                 }
 
                 // Initialize the values of ModificationData
-                currentModification->xpath = strdup(token);
+                currentModification->xpath = token;
                 currentModification->values = NULL;
                 currentModification->next = NULL;
 
@@ -386,35 +802,26 @@ OutputPakFileData* parse_definition(const char* filename, OutputPakFileData* oup
                 currentMbinData->lastModifications = currentModification;
             }
         }
-        // Process lines with "=" and split them into "name=value"
+        // Process "name=value" assignments
         else {
             if (!currentModification) {
-                fprintf(stderr, "Error: Expected \"cd\", but found an assignment expression.\n");
+                PARSE_ERROR("Error: Expected \"cd\", but found an assignment expression.\n");
                 return NULL;
             }
 
-            // Process lines defining items
-            char* name = line;
-            char* value = strchr(line, '=');
-            if (value) {
-                *value = '\0';
-                value++;
-                trim(value);
-                if (!*value) value = NULL;
-            }
-            trim(name);
-            if (!*name) name = NULL;
+            char* name = op->arg;
+            char* value = op->value;
 
             if (name || value) {
                 // Add the "name=value" pair to currentModification
-                NameValue * nv = (NameValue*)malloc(sizeof(NameValue));
+                NameValue * nv = (NameValue*)arena_alloc(&modificationArena, sizeof(NameValue));
                 if (!nv) {
-                    fprintf(stderr, "Error: Memory allocation for NameValue failed\n");
+                    PARSE_ERROR("Error: Memory allocation for NameValue failed\n");
                     return NULL;
                 }
 
-                nv->name = name ? strdup(name) : NULL;
-                nv->value = value ? strdup(value) : NULL;
+                nv->name = name;
+                nv->value = value;
                 nv->next = NULL;
 
                 if (!currentModification->values)
@@ -426,445 +833,3495 @@ OutputPakFileData* parse_definition(const char* filename, OutputPakFileData* oup
         }
     }
 
-    fclose(file);
     return ouputPakFileDataList;
 }
 
 /**
- * Get the list of MBIN file names from the InputPakFileData.
+ * Magic number and version of the precompiled definition cache files (.defc).
+ */
+#define DEFC_MAGIC      "NMSDEFC"
+#define DEFC_VERSION    1
+
+/**
+ * Value used in the cache files for NULL strings.
+ */
+#define DEFC_NULL       0xffffffffU
+
+// Types of the records of a definition cache file
+typedef enum {
+    DEFC_OUTPUT_PAK,
+    DEFC_ADD_FILE,
+    DEFC_INPUT_PAK,
+    DEFC_MBIN,
+    DEFC_CD,
+    DEFC_VALUE
+} DefcRecordType;
+
+// Header of a definition cache file
+typedef struct DefcHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t cwd;
+    uint32_t fileCount;
+    uint32_t recordCount;
+    uint32_t stringsOffset;
+    uint32_t stringsSize;
+} DefcHeader;
+
+// Definition file (the main one or an included one) the cache was built from
+typedef struct DefcFile {
+    uint32_t path;
+    uint32_t reserved;
+    uint64_t size;
+    uint64_t hash;
+} DefcFile;
+
+// Record of the resolved definition tree; strings are offsets in the string table
+typedef struct DefcRecord {
+    uint32_t type;
+    uint32_t a;
+    uint32_t b;
+} DefcRecord;
+
+/**
+ * Get the name of the cache file of a definition file.
  *
- * This function retrieves the names of MBIN files from the provided InputPakFileData
- * and appends them to an existing list of strings. It also updates the count of
- * items in the list. Memory reallocation is handled internally.
+ * @param filename - The name of the definition file.
+ * @param cachename - A buffer of MAX_PATH characters for the cache file name.
+ * @return 0 on success, 1 if the name is too long.
  *
- * @param list      The current list of MBIN file names (can be NULL for the initial call).
- * @param count     A pointer to the count of items in the list.
- * @param data      The InputPakFileData containing MBIN file information.
+ * The cache of "mod.def" is "mod.defc"; other names get a ".defc" suffix.
+ */
+static int get_definition_cache_name(const char* filename, char* cachename) {
+    size_t len = strlen(filename);
+    const char* suffix = (len > 4 && !strcmp(filename + len - 4, ".def")) ? "c" : ".defc";
+    return snprintf(cachename, MAX_PATH, "%s%s", filename, suffix) >= MAX_PATH;
+}
+
+// Structure to build the string table of a cache file
+typedef struct DefcStrings {
+    char* data;
+    size_t size;
+    size_t capacity;
+    HashTable offsets;
+} DefcStrings;
+
+/**
+ * Add a string to the string table of a cache file.
  *
- * @return          A pointer to the updated list of MBIN file names. NULL on error.
+ * @param strings - The string table.
+ * @param str - The string to add, or NULL.
+ * @return The offset of the string in the table, DEFC_NULL for NULL strings or on error.
+ *
+ * Repeated strings are stored once.
  */
-char **get_mbin_list(char **list, size_t *count, InputPakFileData *data) {
+static uint32_t defc_string(DefcStrings* strings, const char* str) {
+    if (!str) return DEFC_NULL;
 
-    if ( !data->mbinCount ) return list;
+    // Offsets are stored plus one so that the first string is not mistaken for a missing key
+    uintptr_t offset = (uintptr_t)hash_get(&strings->offsets, str);
+    if (offset) return (uint32_t)(offset - 1);
 
-    // Resize the list to accommodate more entries
-    char ** l = realloc(list, sizeof(char *) * ( data->mbinCount + *count + 1 ));
-    if (!l) {
-        if (list) free(*list);
-        return NULL;
+    size_t len = strlen(str) + 1;
+    if (strings->size + len > strings->capacity) {
+        size_t capacity = strings->capacity ? strings->capacity * 2 : 65536;
+        while (capacity < strings->size + len) capacity *= 2;
+        char* data = realloc(strings->data, capacity);
+        if (!data) return DEFC_NULL;
+        strings->data = data;
+        strings->capacity = capacity;
     }
-    list = l;
 
-    MBINData * mbinData = data->mbinData;
-    while( mbinData ) {
-        // Add the MBIN file name to the list        
-        list[(*count)++] = mbinData->mbinFile;
-        mbinData = mbinData->next;
-    }
-    list[(*count)] = NULL;
+    offset = strings->size;
+    memcpy(strings->data + offset, str, len);
+    strings->size += len;
 
-    return list;
+    hash_put(&strings->offsets, str, (void*)(offset + 1));
+    return (uint32_t)offset;
 }
 
 /**
- * Get the complete list of MBIN file names from OutputPakFileData.
+ * Append a record to the record list of a cache file.
  *
- * This function retrieves the names of MBIN files from the provided OutputPakFileData
- * along with its associated InputPakFileData and appends them to an existing list of strings.
- * It also updates the count of items in the list. Memory reallocation is handled internally.
+ * @param records - A pointer to the record array.
+ * @param count - A pointer to the number of records.
+ * @param capacity - A pointer to the capacity of the record array.
+ * @param type - The type of the record.
+ * @param a - The first string offset of the record.
+ * @param b - The second string offset of the record.
+ * @return 0 on success, 1 on memory allocation errors.
+ */
+static int defc_record(DefcRecord** records, size_t* count, size_t* capacity, DefcRecordType type, uint32_t a, uint32_t b) {
+    if (*count == *capacity) {
+        size_t c = *capacity ? *capacity * 2 : 1024;
+        DefcRecord* r = realloc(*records, c * sizeof(DefcRecord));
+        if (!r) return 1;
+        *records = r;
+        *capacity = c;
+    }
+    (*records)[*count].type = type;
+    (*records)[*count].a = a;
+    (*records)[*count].b = b;
+    (*count)++;
+    return 0;
+}
+
+/**
+ * Store a parsed definition in its precompiled cache file.
  *
- * @param list      The current list of MBIN file names (can be NULL for the initial call).
- * @param count     A pointer to the count of items in the list.
- * @param data      The OutputPakFileData containing InputPakFileData and MBIN file information.
- * @param exml      A flag indicating whether to convert MBIN file extensions to EXML.
+ * @param filename - The name of the definition file.
+ * @param outputPakFileList - The list of OutputPakFileData returned by parse_definition.
+ * @return 0 on success, 1 on failure.
  *
- * @return          A pointer to the updated list of MBIN file names. NULL on error.
+ * The cache holds the fully resolved definition tree, the current directory (which the
+ * definition paths are relative to) and the size and hash of every file read through
+ * "!include". Definitions with parse errors are not stored.
  */
-char **get_complete_mbin_list(char **list, size_t *count,OutputPakFileData *data, int exml) {
-    if ( !data->totalMbinCount ) return list;
+int save_definition_cache(const char* filename, OutputPakFileData* outputPakFileList) {
+    if (parseErrors || !outputPakFileList) return 1;
 
-    // Resize the list to accommodate more entries
-    char ** l = realloc(list, sizeof(char *) * ( data->totalMbinCount + *count + 1 ));
-    if (!l) {
-        if (list) free(*list);
-        return NULL;
+    char cachename[MAX_PATH];
+    if (get_definition_cache_name(filename, cachename)) return 1;
+
+    DefcStrings strings = { NULL, 0, 0, { NULL, 0, 0, NULL } };
+    DefcRecord* records = NULL;
+    size_t recordCount = 0, recordCapacity = 0;
+    DefcFile* files = calloc(includeCache.count ? includeCache.count : 1, sizeof(DefcFile));
+    int error = !files;
+
+    char* cwd = get_current_dir();
+    uint32_t cwdOffset = defc_string(&strings, cwd);
+
+    // Files of the include graph
+    size_t fileCount = 0;
+    for (size_t i = 0; !error && i < includeCache.capacity; i++) {
+        IncludeCacheEntry* entry = includeCache.entries[i].value;
+        if (!includeCache.entries[i].key) continue;
+        files[fileCount].path = defc_string(&strings, entry->path);
+        files[fileCount].size = entry->size;
+        files[fileCount].hash = entry->hash;
+        fileCount++;
     }
-    list = l;
 
-    InputPakFileData *i = data->inputPakFileList;
-    while( i ) {
-        MBINData * mbinData = i->mbinData;
-        while( mbinData ) {
-            char *l;
-            if ( exml ) {
-                // Convert MBIN file extension to EXML
-                l = strdup(mbinData->mbinFile);
-                char* e = strstr(l, ".MBIN");
-                while (e) {
-                    memcpy(e, ".EXML", 5);
-                    e = strstr(e + 5, ".MBIN");
+    // Resolved definition tree, in list order
+    for (OutputPakFileData* o = outputPakFileList; !error && o; o = o->next) {
+        error |= defc_record(&records, &recordCount, &recordCapacity, DEFC_OUTPUT_PAK, defc_string(&strings, o->outputPakFile), DEFC_NULL);
+        for (ExtraFile* e = o->extraFileList; !error && e; e = e->next) {
+            error |= defc_record(&records, &recordCount, &recordCapacity, DEFC_ADD_FILE, defc_string(&strings, e->filename), DEFC_NULL);
+        }
+        for (InputPakFileData* i = o->inputPakFileList; !error && i; i = i->next) {
+            error |= defc_record(&records, &recordCount, &recordCapacity, DEFC_INPUT_PAK, defc_string(&strings, i->inputPakFile), DEFC_NULL);
+            for (MBINData* m = i->mbinData; !error && m; m = m->next) {
+                error |= defc_record(&records, &recordCount, &recordCapacity, DEFC_MBIN, defc_string(&strings, m->mbinFile), DEFC_NULL);
+                for (ModificationData* d = m->modifications; !error && d; d = d->next) {
+                    error |= defc_record(&records, &recordCount, &recordCapacity, DEFC_CD, defc_string(&strings, d->xpath), DEFC_NULL);
+                    for (NameValue* nv = d->values; !error && nv; nv = nv->next) {
+                        error |= defc_record(&records, &recordCount, &recordCapacity, DEFC_VALUE, defc_string(&strings, nv->name), defc_string(&strings, nv->value));
+                    }
                 }
-            } else {
-                l = mbinData->mbinFile;
             }
-
-            // Add the modified MBIN file name to the list
-            list[(*count)++] = l;
-            mbinData = mbinData->next;
         }
-        i = i->next;
     }
 
-    list[(*count)] = NULL;
+    FILE* file = NULL;
+    if (!error && strings.size < DEFC_NULL && (file = fopen(cachename, "wb"))) {
+        DefcHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, DEFC_MAGIC, sizeof(DEFC_MAGIC));
+        header.version = DEFC_VERSION;
+        header.cwd = cwdOffset;
+        header.fileCount = (uint32_t)fileCount;
+        header.recordCount = (uint32_t)recordCount;
+        header.stringsOffset = (uint32_t)(sizeof(DefcHeader) + fileCount * sizeof(DefcFile) + recordCount * sizeof(DefcRecord));
+        header.stringsSize = (uint32_t)strings.size;
 
-    return list;
-}
+        error = fwrite(&header, sizeof(header), 1, file) != 1
+             || fwrite(files, sizeof(DefcFile), fileCount, file) != fileCount
+             || fwrite(records, sizeof(DefcRecord), recordCount, file) != recordCount
+             || fwrite(strings.data, 1, strings.size, file) != strings.size;
+        error |= fclose(file) != 0;
+        if (error) remove(cachename);
+    } else {
+        error = 1;
+    }
+
+    free(cwd);
+    free(files);
+    free(records);
+    free(strings.data);
+    hash_free(&strings.offsets);
+
+    return error;
+}
+
+/**
+ * Check that a definition file still has the size and hash stored in the cache.
+ *
+ * @param path - The canonical path of the file.
+ * @param file - The DefcFile record of the file.
+ * @return 1 if the file is unchanged, 0 otherwise.
+ */
+static int defc_file_unchanged(const char* path, const DefcFile* file) {
+    size_t size;
+    const char* buffer = map_file(path, &size);
+    if (!buffer) return 0;
+
+    int unchanged = size == file->size && hash_bytes(buffer, size, HASH_SEED) == file->hash;
+    unmap_file(buffer, size);
+
+    return unchanged;
+}
+
+/**
+ * Load a definition from its precompiled cache file.
+ *
+ * @param filename - The name of the definition file.
+ * @return The list of OutputPakFileData stored in the cache, or NULL if there is no valid cache.
+ *
+ * The cache file is memory-mapped once and stays mapped until definition_cleanup(); the
+ * strings of the definition tree point into the mapping. The cache is only used when it was
+ * built from the current directory and every file of the include graph is unchanged.
+ */
+OutputPakFileData* load_definition_cache(const char* filename) {
+    char cachename[MAX_PATH];
+    if (get_definition_cache_name(filename, cachename)) return NULL;
+
+    size_t size;
+    const char* buffer = map_file(cachename, &size);
+    if (!buffer) return NULL;
+
+    const DefcHeader* header = (const DefcHeader*)buffer;
+    const DefcFile* files = (const DefcFile*)(header + 1);
+    const DefcRecord* records = (const DefcRecord*)(files + (size >= sizeof(DefcHeader) ? header->fileCount : 0));
+    const char* strings = buffer + (size >= sizeof(DefcHeader) ? header->stringsOffset : 0);
+
+    // Validate the layout of the file
+    if (size < sizeof(DefcHeader)
+        || memcmp(header->magic, DEFC_MAGIC, sizeof(DEFC_MAGIC))
+        || header->version != DEFC_VERSION
+        || header->stringsOffset != sizeof(DefcHeader) + (uint64_t)header->fileCount * sizeof(DefcFile) + (uint64_t)header->recordCount * sizeof(DefcRecord)
+        || (uint64_t)header->stringsOffset + header->stringsSize != size
+        || !header->stringsSize || strings[header->stringsSize - 1]) {
+        unmap_file(buffer, size);
+        return NULL;
+    }
+
+#define DEFC_STRING(x)  ((x) == DEFC_NULL || (x) >= header->stringsSize ? NULL : (char*)strings + (x))
+
+    // Validate the include graph
+    char* cwd = get_current_dir();
+    const char* defcCwd = DEFC_STRING(header->cwd);
+    int valid = cwd && defcCwd && !strcmp(cwd, defcCwd);
+    free(cwd);
+
+    for (uint32_t i = 0; valid && i < header->fileCount; i++) {
+        const char* path = DEFC_STRING(files[i].path);
+        valid = path && defc_file_unchanged(path, &files[i]);
+    }
+
+    if (!valid) {
+        unmap_file(buffer, size);
+        return NULL;
+    }
+
+    // Rebuild the definition tree
+    OutputPakFileData* list = NULL;
+    for (uint32_t i = 0; valid && i < header->recordCount; i++) {
+        char* a = DEFC_STRING(records[i].a);
+        char* b = DEFC_STRING(records[i].b);
+
+        switch (records[i].type) {
+            case DEFC_OUTPUT_PAK:
+                if (!(currentOutputPakFile = createOutputPakFileData(a))) {
+                    valid = 0;
+                    break;
+                }
+                if (!list)
+                    list = currentOutputPakFile;
+                else
+                    lastOutputPakFile->next = currentOutputPakFile;
+                lastOutputPakFile = currentOutputPakFile;
+                currentInputPakFileList = NULL;
+                currentMbinData = NULL;
+                currentModification = NULL;
+                break;
+
+            case DEFC_ADD_FILE: {
+                ExtraFile* e;
+                if (!currentOutputPakFile || !a || !(e = arena_alloc(&definitionArena, sizeof(ExtraFile)))) {
+                    valid = 0;
+                    break;
+                }
+                // Extra files were stored in list order; keep it
+                e->filename = a;
+                e->next = NULL;
+                if (!currentOutputPakFile->extraFileList) {
+                    currentOutputPakFile->extraFileList = e;
+                } else {
+                    ExtraFile* last = currentOutputPakFile->extraFileList;
+                    while (last->next) last = last->next;
+                    last->next = e;
+                }
+                currentOutputPakFile->extraFileCount++;
+                break;
+            }
+
+            case DEFC_INPUT_PAK:
+                if (!currentOutputPakFile || !a || !(currentInputPakFileList = arena_alloc(&definitionArena, sizeof(InputPakFileData)))) {
+                    valid = 0;
+                    break;
+                }
+                currentInputPakFileList->inputPakFile = a;
+                currentInputPakFileList->mbinData = NULL;
+                currentInputPakFileList->mbinCount = 0;
+                currentInputPakFileList->lastMbinData = NULL;
+                hash_init(&currentInputPakFileList->mbinIndex, &definitionArena);
+                currentInputPakFileList->workDir = NULL;
+                currentInputPakFileList->next = NULL;
+                if (!currentOutputPakFile->inputPakFileList)
+                    currentOutputPakFile->inputPakFileList = currentInputPakFileList;
+                else
+                    currentOutputPakFile->lastInputPakFileList->next = currentInputPakFileList;
+                currentOutputPakFile->lastInputPakFileList = currentInputPakFileList;
+                valid = !hash_put(&currentOutputPakFile->inputPakIndex, a, currentInputPakFileList);
+                currentMbinData = NULL;
+                currentModification = NULL;
+                break;
+
+            case DEFC_MBIN:
+                if (!currentInputPakFileList || !a || !(currentMbinData = arena_alloc(&definitionArena, sizeof(MBINData)))) {
+                    valid = 0;
+                    break;
+                }
+                currentMbinData->mbinFile = a;
+                currentMbinData->modifications = NULL;
+                currentMbinData->lastModifications = NULL;
+                currentMbinData->xmlData = NULL;
+                currentMbinData->exmlData = NULL;
+                currentMbinData->dirty = 0;
+                currentMbinData->next = NULL;
+                if (!currentInputPakFileList->mbinData)
+                    currentInputPakFileList->mbinData = currentMbinData;
+                else
+                    currentInputPakFileList->lastMbinData->next = currentMbinData;
+                currentInputPakFileList->lastMbinData = currentMbinData;
+                currentInputPakFileList->mbinCount++;
+                currentOutputPakFile->totalMbinCount++;
+                valid = !hash_put(&currentInputPakFileList->mbinIndex, a, currentMbinData);
+                currentModification = NULL;
+                break;
+
+            case DEFC_CD:
+                if (!currentMbinData || !a || !(currentModification = arena_alloc(&modificationArena, sizeof(ModificationData)))) {
+                    valid = 0;
+                    break;
+                }
+                currentModification->xpath = a;
+                currentModification->values = NULL;
+                currentModification->next = NULL;
+                if (!currentMbinData->modifications)
+                    currentMbinData->modifications = currentModification;
+                else
+                    currentMbinData->lastModifications->next = currentModification;
+                currentMbinData->lastModifications = currentModification;
+                break;
+
+            case DEFC_VALUE: {
+                NameValue* nv;
+                if (!currentModification || !(nv = arena_alloc(&modificationArena, sizeof(NameValue)))) {
+                    valid = 0;
+                    break;
+                }
+                nv->name = a;
+                nv->value = b;
+                nv->next = NULL;
+                if (!currentModification->values)
+                    currentModification->values = nv;
+                else
+                    currentModification->lastValues->next = nv;
+                currentModification->lastValues = nv;
+                break;
+            }
+
+            default:
+                valid = 0;
+                break;
+        }
+    }
+
+#undef DEFC_STRING
+
+    if (!valid || !list) {
+        definition_cleanup(list);
+        unmap_file(buffer, size);
+        return NULL;
+    }
+
+    definitionCacheBuffer = buffer;
+    definitionCacheSize = size;
+
+    return list;
+}
+
+/**
+ * Get the list of MBIN file names from the InputPakFileData.
+ *
+ * This function retrieves the names of MBIN files from the provided InputPakFileData
+ * and appends them to an existing list of strings. It also updates the count of
+ * items in the list. Memory reallocation is handled internally.
+ *
+ * @param list      The current list of MBIN file names (can be NULL for the initial call).
+ * @param count     A pointer to the count of items in the list.
+ * @param data      The InputPakFileData containing MBIN file information.
+ *
+ * @return          A pointer to the updated list of MBIN file names. NULL on error.
+ */
+char **get_mbin_list(char **list, size_t *count, InputPakFileData *data) {
+
+    if ( !data->mbinCount ) return list;
+
+    // Resize the list to accommodate more entries
+    char ** l = realloc(list, sizeof(char *) * ( data->mbinCount + *count + 1 ));
+    if (!l) {
+        if (list) free(*list);
+        return NULL;
+    }
+    list = l;
+
+    MBINData * mbinData = data->mbinData;
+    while( mbinData ) {
+        // Add the MBIN file name to the list        
+        list[(*count)++] = mbinData->mbinFile;
+        mbinData = mbinData->next;
+    }
+    list[(*count)] = NULL;
+
+    return list;
+}
+
+/**
+ * Get the complete list of MBIN file names from OutputPakFileData.
+ *
+ * This function retrieves the names of MBIN files from the provided OutputPakFileData
+ * along with its associated InputPakFileData and appends them to an existing list of strings.
+ * It also updates the count of items in the list. Memory reallocation is handled internally.
+ *
+ * @param list      The current list of MBIN file names (can be NULL for the initial call).
+ * @param count     A pointer to the count of items in the list.
+ * @param data      The OutputPakFileData containing InputPakFileData and MBIN file information.
+ * @param exml      A flag indicating whether to convert MBIN file extensions to EXML.
+ *
+ * @return          A pointer to the updated list of MBIN file names. NULL on error.
+ */
+char **get_complete_mbin_list(char **list, size_t *count,OutputPakFileData *data, int exml) {
+    if ( !data->totalMbinCount ) return list;
+
+    // Resize the list to accommodate more entries
+    char ** l = realloc(list, sizeof(char *) * ( data->totalMbinCount + *count + 1 ));
+    if (!l) {
+        if (list) free(*list);
+        return NULL;
+    }
+    list = l;
+
+    InputPakFileData *i = data->inputPakFileList;
+    while( i ) {
+        MBINData * mbinData = i->mbinData;
+        while( mbinData ) {
+            char *l;
+            if ( exml ) {
+                // Convert MBIN file extension to EXML
+                l = strdup(mbinData->mbinFile);
+                char* e = strstr(l, ".MBIN");
+                while (e) {
+                    memcpy(e, ".EXML", 5);
+                    e = strstr(e + 5, ".MBIN");
+                }
+            } else {
+                l = mbinData->mbinFile;
+            }
+
+            // Add the modified MBIN file name to the list
+            list[(*count)++] = l;
+            mbinData = mbinData->next;
+        }
+        i = i->next;
+    }
+
+    list[(*count)] = NULL;
+
+    return list;
+}
+
+/**
+ * Length of the file names passed to a single MBINCompiler process. Batches with longer lists are
+ * split in several processes, so that the command line stays under the limit of Windows (32767
+ * characters) and ARG_MAX elsewhere.
+ */
+#ifdef _WIN32
+#define MAX_COMPILER_ARGS_LENGTH    30000
+#else
+#define MAX_COMPILER_ARGS_LENGTH    120000
+#endif
+
+// Structure to store the files compiled by one MBINCompiler process
+typedef struct CompilerShard {
+    char ** files;          // points into the files of the batch
+    size_t count;
+} CompilerShard;
+
+// Structure to store a list of files compiled by several MBINCompiler processes
+typedef struct CompilerBatch {
+    char ** files;          // the files of the batch, grouped by shard
+    CompilerShard * shards;
+    size_t shardCount;
+} CompilerBatch;
+
+/**
+ * Release the lists of a batch split by split_batch().
+ */
+static void free_batch(CompilerBatch* batch) {
+    free(batch->files);
+    free(batch->shards);
+    batch->files = NULL;
+    batch->shards = NULL;
+    batch->shardCount = 0;
+}
+
+/**
+ * Get the size of a file.
+ *
+ * @param dir - The directory the path of the file is relative to.
+ * @param file - The path of the file.
+ * @return The size of the file in bytes, or 0 if it can't be read.
+ */
+static long long file_size(const char* dir, const char* file) {
+    char path[MAX_PATH];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    return stat(path, &st) ? 0 : (long long) st.st_size;
+}
+
+// Structure to store the size of a file of a batch while it is split
+typedef struct CompilerFile {
+    long long size;
+    size_t index;           // index of the file in the list
+} CompilerFile;
+
+/**
+ * Compare two files of a batch by size, largest first.
+ */
+static int compare_compiler_files(const void* a, const void* b) {
+    const CompilerFile* fa = a;
+    const CompilerFile* fb = b;
+    if (fa->size != fb->size) return fa->size < fb->size ? 1 : -1;
+    return fa->index < fb->index ? -1 : fa->index > fb->index;
+}
+
+/**
+ * Split a list of files in shards compiled by separate MBINCompiler processes.
+ *
+ * @param batch - The batch to fill; release it with free_batch().
+ * @param dir - The directory the file paths are relative to.
+ * @param files - The files to compile.
+ * @param count - The number of files.
+ * @param shardCount - The number of shards to split the files in.
+ * @return 0 on success, 1 on memory allocation errors.
+ *
+ * The files are spread by size, each one going to the shard with the fewest bytes so far, starting
+ * with the largest one. A shard whose file names don't fit in a command line is split again, so
+ * the batch can have more shards than requested. The files keep their relative order in the shards.
+ */
+static int split_batch(CompilerBatch* batch, const char* dir, char** files, size_t count, size_t shardCount) {
+    batch->files = NULL;
+    batch->shards = NULL;
+    batch->shardCount = 0;
+    if (!count) return 0;
+    if (shardCount > count) shardCount = count;
+    if (!shardCount) shardCount = 1;
+
+    CompilerFile* sorted = malloc(count * sizeof(CompilerFile));
+    size_t* shardOf = malloc(count * sizeof(size_t));
+    long long* shardBytes = calloc(shardCount, sizeof(long long));
+    batch->files = malloc(count * sizeof(char*));
+    batch->shards = malloc(count * sizeof(CompilerShard));
+    if (!sorted || !shardOf || !shardBytes || !batch->files || !batch->shards) {
+        fprintf(stderr, "Error: Memory allocation for MBINCompiler batch failed\n");
+        free(sorted);
+        free(shardOf);
+        free(shardBytes);
+        free_batch(batch);
+        return 1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        sorted[i].size = file_size(dir, files[i]);
+        sorted[i].index = i;
+    }
+    qsort(sorted, count, sizeof(CompilerFile), compare_compiler_files);
+
+    // Give each file to the shard with the fewest bytes, largest files first; every file also
+    // counts one byte, so that empty files are spread too
+    for (size_t i = 0; i < count; i++) {
+        size_t best = 0;
+        for (size_t s = 1; s < shardCount; s++) {
+            if (shardBytes[s] < shardBytes[best]) best = s;
+        }
+        shardBytes[best] += sorted[i].size + 1;
+        shardOf[sorted[i].index] = best;
+    }
+    free(sorted);
+    free(shardBytes);
+
+    // Put the files of each shard together, splitting the ones whose command line would be too long
+    size_t n = 0;
+    for (size_t s = 0; s < shardCount; s++) {
+        size_t first = n, length = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (shardOf[i] != s) continue;
+            size_t l = strlen(files[i]) + 3;
+            if (n == first || length + l > MAX_COMPILER_ARGS_LENGTH) {
+                batch->shards[batch->shardCount].files = &batch->files[n];
+                batch->shards[batch->shardCount++].count = 0;
+                length = 0;
+            }
+            batch->files[n++] = files[i];
+            batch->shards[batch->shardCount - 1].count++;
+            length += l;
+        }
+    }
+    free(shardOf);
+
+    return 0;
+}
+
+/**
+ * Start MBINCompiler on a shard of a batch.
+ *
+ * @param dir - The directory MBINCompiler runs in, which the file paths are relative to.
+ * @param shard - The files to compile.
+ * @param decompile - 1 to compile MBIN files to XML, 0 to compile XML files to MBIN.
+ * @return The process running MBINCompiler, or -1 on error.
+ */
+static intptr_t start_compiler(const char *dir, const CompilerShard *shard, int decompile) {
+    char ** argv = malloc( ( shard->count + 5 ) * sizeof( char * ) );
+    if (!argv) return -1;
+    size_t argc = 0;
+
+    argv[argc++] = MBINCompiler;
+    argv[argc++] = "-y";
+    argv[argc++] = "-q";
+    if ( decompile ) argv[argc++] = "--no-version";
+    for (size_t i = 0; i < shard->count; i++) argv[argc++] = shard->files[i];
+    argv[argc] = NULL;
+
+    intptr_t pid = spawnvp_quiet(dir, MBINCompiler, argv);
+
+    free(argv);
+    return pid;
+}
+
+/**
+ * Size of the patched XML files of an output PAK file worth compiling while the rest of them are
+ * still being patched, rather than together with them at the end.
+ */
+#define EARLY_COMPILE_BYTES     (16 * 1024 * 1024)
+
+// Stages of an input PAK file in the pipeline
+typedef enum {
+    INPUT_PENDING,
+    INPUT_EXTRACTING,       // psar is running
+    INPUT_DECOMPILING,      // MBINCompiler is running on the shards of its MBIN files
+    INPUT_READY,            // its XML files can be patched
+    INPUT_PATCHING,         // its patch thread is running
+    INPUT_PATCHED           // all its XML files are patched and queued for compilation
+} InputStage;
+
+// What the cache has of an MBIN file
+typedef enum {
+    CACHED_NONE,
+    CACHED_MBIN,            // the MBIN file, but not its XML file for the current MBINCompiler
+    CACHED_EXML             // its XML file
+} CacheState;
+
+// Structure to store the compiled MBIN file of a patched XML file in the cache
+typedef struct CompiledFile {
+    char name[48];          // its name in the cache, empty if the XML file couldn't be read
+    int cached;             // 1 if it was taken from the cache, so the XML file isn't compiled
+} CompiledFile;
+
+struct Pipeline;
+
+// Structure to store the state of an input PAK file in the pipeline
+typedef struct InputJob {
+    InputPakFileData * data;
+    size_t output;          // index of its output PAK file
+    InputStage stage;
+    CompilerBatch batch;    // the MBIN files, once extracted
+    size_t nextShard;       // next shard of the batch to decompile
+    size_t runningShards;   // shards being decompiled
+    int failed;             // set if it couldn't be decompiled or patched
+    struct Pipeline * pipeline;
+    const char ** startPaths;   // current path before each of its MBIN files
+    Thread thread;          // patch thread
+    size_t patched;         // MBIN files patched by the thread so far
+    int finished;           // set by the patch thread when it is done
+    size_t queued;          // patched MBIN files queued for compilation
+    MBINData * nextQueued;  // next MBIN file to queue
+    PatchLog log;           // messages of the patch thread
+    char * cacheDir;        // cache directory of its MBIN files, NULL if the cache is off
+    char * cacheExmlDir;    // cache directory of its XML files
+    CacheState * cached;    // what the cache has of each of its MBIN files
+    CompiledFile * compiled;    // the compiled MBIN file of each of its XML files, NULL if the cache is off
+} InputJob;
+
+// Stages of an output PAK file in the pipeline
+typedef enum {
+    OUTPUT_PATCHING,        // its input PAK files are being patched or compiled
+    OUTPUT_PACKING,         // psar is running
+    OUTPUT_DONE
+} OutputStage;
+
+// Structure to store the state of an output PAK file in the pipeline
+typedef struct OutputJob {
+    OutputPakFileData * data;
+    char * workDir;         // directory the PAK file is packed from
+    size_t firstInput;      // index of its first input PAK file
+    size_t inputCount;
+    OutputStage stage;
+    char ** queue;          // patched XML files waiting to be compiled, relative to the temporary directory
+    size_t queueCount;
+    long long queueBytes;   // size of the queued files
+    size_t runningCompilers;
+    int failed;             // set if its files couldn't be patched or compiled
+    Manifest manifest;      // what it is built from, written next to it once it is packed
+} OutputJob;
+
+// Kinds of the processes started by the pipeline
+typedef enum {
+    PROCESS_EXTRACT,
+    PROCESS_DECOMPILE,
+    PROCESS_COMPILE,
+    PROCESS_PACK
+} ProcessType;
+
+// Structure to store the state of the pipeline of process_definitions()
+typedef struct Pipeline {
+    InputJob * inputs;
+    size_t inputCount;
+    size_t nextInput;       // next input PAK file to extract
+    OutputJob * outputs;
+    size_t outputCount;
+    intptr_t * pids;        // the running processes, up to --jobs
+    ProcessType * types;
+    size_t * owners;        // index of the input PAK file of each process, or of the output one for compilations and packing
+    size_t runningCount;
+    size_t patchThreads;    // patch threads that can run at once
+    size_t patchingCount;   // patch threads running
+    size_t nextLog;         // next input PAK file whose messages are printed
+    Mutex mutex;            // guards the progress of the patch threads
+    Condition condition;    // signaled by the patch threads when they make progress
+    int signaled;
+    int error;
+} Pipeline;
+
+/**
+ * Get the list of the MBIN files of an input PAK file that the cache doesn't have.
+ *
+ * @param list - The current list of MBIN file names (can be NULL for the initial call).
+ * @param count - A pointer to the count of items in the list.
+ * @param job - The input PAK file.
+ * @param state - The MBIN files cached below this state are added.
+ * @return A pointer to the updated list of MBIN file names. NULL on error.
+ */
+static char **get_uncached_mbin_list(char **list, size_t *count, InputJob *job, CacheState state) {
+    if (!job->cached) return get_mbin_list(list, count, job->data);
+
+    char ** l = realloc(list, sizeof(char *) * ( job->data->mbinCount + *count + 1 ));
+    if (!l) {
+        free(list);
+        return NULL;
+    }
+    list = l;
+
+    size_t n = 0;
+    for (MBINData* mbinData = job->data->mbinData; mbinData; mbinData = mbinData->next, n++) {
+        if (job->cached[n] < state) list[(*count)++] = mbinData->mbinFile;
+    }
+    list[(*count)] = NULL;
+
+    return list;
+}
+
+/**
+ * Start extracting the MBIN files of an input PAK file that the cache doesn't have to its working
+ * directory.
+ *
+ * @param job - The input PAK file.
+ * @return The process running PSAR, or -1 on error.
+ */
+static intptr_t start_extraction(InputJob *job) {
+    InputPakFileData *data = job->data;
+    char ** argv = malloc( 6 * sizeof( char * ) );
+    if (!argv) return -1;
+    size_t argc = 0;
+
+    argv[argc++] = PSAR;
+    argv[argc++] = "-yxf";
+    argv[argc++] = data->inputPakFile;
+    argv[argc++] = "-t";
+    argv[argc++] = data->workDir;
+    argv[argc] = NULL;
+
+    argv = get_uncached_mbin_list(argv, &argc, job, CACHED_MBIN);
+    if (!argv) return -1;
+
+    intptr_t pid = spawnvp_quiet(NULL, PSAR, argv);
+
+    free(argv);
+    return pid;
+}
+
+/**
+ * Wait for one of several processes started with spawnvp_quiet() to finish.
+ *
+ * @param pids - The processes.
+ * @param count - The number of processes.
+ * @param block - 0 to return at once if none of them has finished yet.
+ * @param status - Where the exit status of the finished process is stored, -1 if it didn't exit normally.
+ * @return The index of the finished process, -2 if none has finished and block is 0, or -1 on error.
+ */
+static int wait_any_process(const intptr_t *pids, size_t count, int block, int *status) {
+#ifdef _WIN32
+    HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+    DWORD n = count < MAXIMUM_WAIT_OBJECTS ? (DWORD) count : MAXIMUM_WAIT_OBJECTS;
+    for (DWORD i = 0; i < n; i++) handles[i] = (HANDLE) pids[i];
+
+    DWORD r = WaitForMultipleObjects(n, handles, FALSE, block ? INFINITE : 0);
+    if (r == WAIT_TIMEOUT) return -2;
+    if (r >= WAIT_OBJECT_0 + n) return -1;
+    int index = (int) (r - WAIT_OBJECT_0);
+
+    DWORD code;
+    *status = GetExitCodeProcess(handles[index], &code) ? (int) code : -1;
+    CloseHandle(handles[index]);
+    return index;
+#else
+    for (;;) {
+        int s;
+        pid_t pid = waitpid(-1, &s, block ? 0 : WNOHANG);
+        if (pid == 0) return -2;
+        if (pid == -1) return -1;
+        for (size_t i = 0; i < count; i++) {
+            if (pids[i] == pid) {
+                *status = WIFEXITED(s) ? WEXITSTATUS(s) : -1;
+                return (int) i;
+            }
+        }
+    }
+#endif
+}
+
+/**
+ * Get the name of the XML file of an MBIN file.
+ *
+ * @param mbinFile - The path of the MBIN file.
+ * @param exml - The buffer where the path of the XML file is stored.
+ * @param size - The size of the buffer.
+ * @return 0 on success, 1 if the name was truncated to fit the buffer.
+ */
+static int get_exml_name(const char *mbinFile, char *exml, size_t size) {
+    int length = snprintf(exml, size, "%s", mbinFile);
+    char *e = strstr(exml, ".MBIN");
+    if ( e ) memcpy( e, ".EXML", 5 );
+    return length < 0 || (size_t) length >= size;
+}
+
+/**
+ * Hash a string of a definition, telling NULL strings apart.
+ *
+ * @param str - The string, or NULL.
+ * @param hash - The hash so far.
+ * @return The updated hash.
+ */
+static uint64_t hash_definition_string(const char *str, uint64_t hash) {
+    unsigned char present = str != NULL;
+    hash = hash_bytes(&present, 1, hash);
+    return str ? hash_bytes(str, strlen(str) + 1, hash) : hash;
+}
+
+/**
+ * Build the manifest of an output PAK file.
+ *
+ * @param pipeline - The pipeline.
+ * @param output - The output PAK file, whose input PAK files have their start paths.
+ * @return 0 on success, 1 on memory allocation errors.
+ *
+ * The resolved definition of the PAK file is hashed, rather than the definition files, so that
+ * changing one output PAK file of a definition doesn't build the others again; the start paths of
+ * its MBIN files are part of it, as a relative "cd" depends on the ones before it. The input PAK
+ * files are recorded by their identity, and the extra files by their contents.
+ */
+static int output_manifest(Pipeline *pipeline, OutputJob *output) {
+    OutputPakFileData* o = output->data;
+    uint64_t hash = hash_definition_string(o->outputPakFile, HASH_SEED);
+    for (ExtraFile* e = o->extraFileList; e; e = e->next) hash = hash_definition_string(e->filename, hash);
+    for (size_t n = 0; n < output->inputCount; n++) {
+        InputJob* job = &pipeline->inputs[output->firstInput + n];
+        hash = hash_definition_string(job->data->inputPakFile, hash);
+        size_t k = 0;
+        for (MBINData* m = job->data->mbinData; m; m = m->next, k++) {
+            hash = hash_definition_string(m->mbinFile, hash);
+            hash = hash_definition_string(job->startPaths[k], hash);
+            for (ModificationData* d = m->modifications; d; d = d->next) {
+                hash = hash_definition_string(d->xpath, hash);
+                for (NameValue* nv = d->values; nv; nv = nv->next) {
+                    hash = hash_definition_string(nv->value, hash_definition_string(nv->name, hash));
+                }
+            }
+        }
+    }
+
+    int error = manifest_create(&output->manifest) || manifest_add(&output->manifest, "definition", hash, NULL);
+    for (size_t n = 0; n < output->inputCount && !error; n++) {
+        error = manifest_add_identity(&output->manifest, "input", pipeline->inputs[output->firstInput + n].data->inputPakFile);
+    }
+    for (ExtraFile* e = o->extraFileList; e && !error; e = e->next) error = manifest_add_file(&output->manifest, "add", e->filename);
+    return error;
+}
+
+/**
+ * Prepare the pipeline of process_definitions().
+ *
+ * @param pipeline - The pipeline to initialize; release it with pipeline_free().
+ * @param outputPakFileList - The list of OutputPakFileData structures to process.
+ * @return 0 on success, 1 otherwise.
+ *
+ * Every input PAK file gets its own working directory, where it is extracted, decompiled, patched
+ * and compiled, and every output PAK file its own directory it is packed from, so that all of them
+ * can be worked on at the same time. The "cd" commands are replayed in order beforehand, so that
+ * every MBIN file can be patched on its own, starting from the current path it would have. Output
+ * PAK files whose manifest is unchanged are done from the start, unless --force is given. The
+ * cache is looked up for every MBIN file of the others, so that only the missing ones are
+ * extracted and decompiled.
+ */
+static int pipeline_init(Pipeline *pipeline, OutputPakFileData *outputPakFileList) {
+    memset(pipeline, 0, sizeof(Pipeline));
+    mutex_init(&pipeline->mutex);
+    condition_init(&pipeline->condition);
+    pipeline->patchThreads = (size_t) jobs;
+
+    // The patch threads share the --max-resident budget of loaded documents
+    if (maxResident) {
+        mutex_init(&residentMutex);
+        condition_init(&residentCondition);
+        residentCount = 0;
+        residentLimit = maxResident;
+    }
+
+    for (OutputPakFileData* o = outputPakFileList; o; o = o->next) {
+        pipeline->outputCount++;
+        for (InputPakFileData* i = o->inputPakFileList; i; i = i->next) pipeline->inputCount++;
+    }
+
+    pipeline->inputs = calloc(pipeline->inputCount + 1, sizeof(InputJob));
+    pipeline->outputs = calloc(pipeline->outputCount + 1, sizeof(OutputJob));
+    pipeline->pids = malloc(jobs * sizeof(intptr_t));
+    pipeline->types = malloc(jobs * sizeof(ProcessType));
+    pipeline->owners = malloc(jobs * sizeof(size_t));
+    if (!pipeline->inputs || !pipeline->outputs || !pipeline->pids || !pipeline->types || !pipeline->owners) {
+        fprintf(stderr, "Error: Memory allocation for input PAK files failed\n");
+        return 1;
+    }
+
+    size_t n = 0, m = 0;
+    char workDir[MAX_PATH];
+    for (OutputPakFileData* o = outputPakFileList; o; o = o->next, m++) {
+        OutputJob* output = &pipeline->outputs[m];
+        output->data = o;
+        output->firstInput = n;
+
+        for (InputPakFileData* i = o->inputPakFileList; i; i = i->next, n++) {
+            InputJob* job = &pipeline->inputs[n];
+            job->data = i;
+            job->output = m;
+            job->pipeline = pipeline;
+            output->inputCount++;
+
+            if (i->mbinCount && !(job->startPaths = arena_alloc(&definitionArena, i->mbinCount * sizeof(char*)))) {
+                fprintf(stderr, "Error: Memory allocation for input PAK files failed\n");
+                return 1;
+            }
+            size_t k = 0;
+            for (MBINData* mbinData = i->mbinData; mbinData; mbinData = mbinData->next) {
+                if (!(job->startPaths[k++] = arena_strdup(&definitionArena, resolvedPath))) {
+                    fprintf(stderr, "Error: Memory allocation for input PAK files failed\n");
+                    return 1;
+                }
+                for (ModificationData* mod = mbinData->modifications; mod; mod = mod->next) {
+                    set_xpath(mod->xpath);
+                    if (check_path(resolvedPath)) return 1;
+                }
+            }
+        }
+
+        if (output_manifest(pipeline, output)) {
+            fprintf(stderr, "Error: Memory allocation for output PAK files failed\n");
+            return 1;
+        }
+        if (!forceBuild && manifest_unchanged(&output->manifest, o->outputPakFile)) {
+            printf("skip %s (up to date)\n\n", o->outputPakFile);
+            output->stage = OUTPUT_DONE;
+            for (size_t k = 0; k < output->inputCount; k++) pipeline->inputs[output->firstInput + k].stage = INPUT_PATCHED;
+            continue;
+        }
+
+        snprintf(workDir, sizeof(workDir), "%s/output%zu", tmpdir, m);
+        if (!(output->workDir = arena_strdup(&definitionArena, workDir)) || mkpath(workDir, 0755)) {
+            fprintf(stderr, "Error creating directory: %s\n", workDir);
+            return 1;
+        }
+
+        for (size_t j = output->firstInput; j < n; j++) {
+            InputJob* job = &pipeline->inputs[j];
+            InputPakFileData* i = job->data;
+            snprintf(workDir, sizeof(workDir), "%s/input%zu", tmpdir, j);
+            if (!(i->workDir = arena_strdup(&definitionArena, workDir)) || mkpath(workDir, 0755)) {
+                fprintf(stderr, "Error creating directory: %s\n", workDir);
+                return 1;
+            }
+
+            // Without the cache, or if the file is missing, everything is extracted as usual
+            if (!cache_input_dirs(i->inputPakFile, &job->cacheDir, &job->cacheExmlDir)) {
+                if (!(job->cached = calloc(i->mbinCount + 1, sizeof(CacheState)))) {
+                    fprintf(stderr, "Error: Memory allocation for input PAK files failed\n");
+                    return 1;
+                }
+                size_t k = 0;
+                for (MBINData* mbinData = i->mbinData; mbinData; mbinData = mbinData->next, k++) {
+                    char exml[MAX_PATH];
+                    get_exml_name(mbinData->mbinFile, exml, sizeof(exml));
+                    if (cache_has(job->cacheExmlDir, exml)) job->cached[k] = CACHED_EXML;
+                    else if (cache_has(job->cacheDir, mbinData->mbinFile)) job->cached[k] = CACHED_MBIN;
+                }
+            }
+            if (cache_compiled_dir() && !(job->compiled = calloc(i->mbinCount + 1, sizeof(CompiledFile)))) {
+                fprintf(stderr, "Error: Memory allocation for input PAK files failed\n");
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Release the pipeline of process_definitions().
+ *
+ * @param pipeline - The pipeline.
+ */
+static void pipeline_free(Pipeline *pipeline) {
+    for (size_t i = 0; pipeline->inputs && i < pipeline->inputCount; i++) {
+        free_batch(&pipeline->inputs[i].batch);
+        free(pipeline->inputs[i].log.text);
+        free(pipeline->inputs[i].cacheDir);
+        free(pipeline->inputs[i].cacheExmlDir);
+        free(pipeline->inputs[i].cached);
+        free(pipeline->inputs[i].compiled);
+    }
+    for (size_t o = 0; pipeline->outputs && o < pipeline->outputCount; o++) {
+        OutputJob* output = &pipeline->outputs[o];
+        for (size_t f = 0; f < output->queueCount; f++) free(output->queue[f]);
+        free(output->queue);
+        manifest_free(&output->manifest);
+    }
+    free(pipeline->inputs);
+    free(pipeline->outputs);
+    free(pipeline->pids);
+    free(pipeline->types);
+    free(pipeline->owners);
+    condition_destroy(&pipeline->condition);
+    mutex_destroy(&pipeline->mutex);
+    if (residentLimit) {
+        condition_destroy(&residentCondition);
+        mutex_destroy(&residentMutex);
+        residentLimit = 0;
+    }
+    memset(pipeline, 0, sizeof(Pipeline));
+}
+
+/**
+ * Add a started process to the pipeline.
+ *
+ * @param pipeline - The pipeline.
+ * @param type - The kind of the process.
+ * @param owner - The index of the input or output PAK file of the process.
+ * @param pid - The process.
+ */
+static void pipeline_add_process(Pipeline *pipeline, ProcessType type, size_t owner, intptr_t pid) {
+    pipeline->pids[pipeline->runningCount] = pid;
+    pipeline->types[pipeline->runningCount] = type;
+    pipeline->owners[pipeline->runningCount++] = owner;
+}
+
+/**
+ * Queue the XML file of a patched MBIN for compilation.
+ *
+ * @param pipeline - The pipeline.
+ * @param job - The input PAK file of the MBIN.
+ * @param mbinData - The MBIN.
+ */
+static void pipeline_queue(Pipeline *pipeline, InputJob *job, MBINData *mbinData) {
+    OutputJob* output = &pipeline->outputs[job->output];
+    char exml[MAX_PATH];
+    char path[MAX_PATH];
+    get_exml_name(mbinData->mbinFile, exml, sizeof(exml));
+    if (snprintf(path, sizeof(path), "%s/%s", job->data->workDir + strlen(tmpdir) + 1, exml) >= (int) sizeof(path)) {
+        fprintf(stderr, "Error: path too long: %s/%s\n", job->data->workDir, exml);
+        pipeline->error = 1;
+        return;
+    }
+
+    char **queue = realloc(output->queue, (output->queueCount + 1) * sizeof(char *));
+    char *name = strdup(path);
+    if (!queue || !name) {
+        fprintf(stderr, "Error: Memory allocation for XML file %s failed\n", exml);
+        if (queue) output->queue = queue;
+        free(name);
+        pipeline->error = 1;
+        return;
+    }
+    output->queue = queue;
+    output->queue[output->queueCount++] = name;
+    output->queueBytes += file_size(tmpdir, name);
+}
+
+/**
+ * Start compiling the queued XML files of an output PAK file to MBIN.
+ *
+ * @param pipeline - The pipeline.
+ * @param o - The index of the output PAK file.
+ * @param shardCount - The number of processes to split the files in, up to the free jobs.
+ *
+ * MBINCompiler runs in the temporary directory, so the files of all the input PAK files of the
+ * output PAK file go to the same processes. The queued files are split by size; the files whose
+ * shard doesn't fit in the free jobs stay in the queue.
+ */
+static void start_compilation(Pipeline *pipeline, size_t o, size_t shardCount) {
+    OutputJob* output = &pipeline->outputs[o];
+    CompilerBatch batch;
+    if (split_batch(&batch, tmpdir, output->queue, output->queueCount, shardCount)) {
+        pipeline->error = 1;
+        return;
+    }
+
+    size_t started = 0;
+    for (size_t s = 0; s < batch.shardCount && pipeline->runningCount < (size_t) jobs; s++) {
+        intptr_t pid = start_compiler(tmpdir, &batch.shards[s], 0);
+        if (pid == -1) {
+            fprintf(stderr, "Error compiling XML files to MBIN\n");
+            pipeline->error = 1;
+            break;
+        }
+        pipeline_add_process(pipeline, PROCESS_COMPILE, o, pid);
+        output->runningCompilers++;
+        started += batch.shards[s].count;
+    }
+
+    // The shards are stored one after another, so the files not started are the last ones
+    for (size_t f = 0; f < started; f++) free(batch.files[f]);
+    memcpy(output->queue, &batch.files[started], (output->queueCount - started) * sizeof(char *));
+    output->queueCount -= started;
+    output->queueBytes = 0;
+    for (size_t f = 0; f < output->queueCount; f++) output->queueBytes += file_size(tmpdir, output->queue[f]);
+    free_batch(&batch);
+}
+
+/**
+ * Check whether all the input PAK files of an output PAK file are patched.
+ *
+ * @param pipeline - The pipeline.
+ * @param output - The output PAK file.
+ * @return 1 if they are, 0 otherwise.
+ */
+static int output_patched(Pipeline *pipeline, OutputJob *output) {
+    for (size_t n = 0; n < output->inputCount; n++) {
+        if (pipeline->inputs[output->firstInput + n].stage != INPUT_PATCHED) return 0;
+    }
+    return 1;
+}
+
+/**
+ * Move the MBIN files of an output PAK archive from the working directories of its input PAK files.
+ *
+ * @param pipeline - The pipeline.
+ * @param output - The output PAK file.
+ * @return 0 on success, 1 otherwise.
+ *
+ * The files are moved in the order of the input PAK files, so that when two of them have the same
+ * MBIN file, the last one is used. The files MBINCompiler compiled are added to the cache first.
+ */
+static int collect_output_files(Pipeline *pipeline, OutputJob *output) {
+    char source[MAX_PATH];
+    char dest[MAX_PATH];
+
+    for (size_t n = 0; n < output->inputCount; n++) {
+        InputJob* job = &pipeline->inputs[output->firstInput + n];
+        InputPakFileData* i = job->data;
+        size_t k = 0;
+        for (MBINData* m = i->mbinData; m; m = m->next, k++) {
+            snprintf(source, sizeof(source), "%s/%s", i->workDir, m->mbinFile);
+            snprintf(dest, sizeof(dest), "%s/%s", output->workDir, m->mbinFile);
+
+            if (job->compiled && job->compiled[k].name[0] && !job->compiled[k].cached) {
+                cache_store(source, cache_compiled_dir(), job->compiled[k].name, 0);
+            }
+
+            if (mkpath_parent(dest, 0755) || replace_file(source, dest)) {
+                fprintf(stderr, "Error moving file: %s\n", source);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Start adding the files of an output PAK archive to it.
+ *
+ * @param output - The output PAK file, whose MBIN files are in its working directory.
+ * @return The process running PSAR, or -1 on error.
+ *
+ * The extra files of the PAK archive are copied to the working directory and added too.
+ */
+static intptr_t start_packing(OutputJob *output) {
+    OutputPakFileData* pakData = output->data;
+    char ** argv = malloc( 6 * sizeof( char * ) );
+    if (!argv) return -1;
+    size_t argc = 0;
+
+    argv[argc++] = PSAR;
+    argv[argc++] = "-yrczf";
+    argv[argc++] = pakData->outputPakFile;
+    argv[argc++] = "-s";
+    argv[argc++] = output->workDir;
+    argv[argc] = NULL;
+
+    argv = get_complete_mbin_list(argv, &argc, pakData, 0);
+    if (!argv) return -1;
+
+    if ( pakData->extraFileCount ) {
+        char ** l = realloc( argv, sizeof(char *) * ( argc + pakData->extraFileCount + 1 ) );
+        if (!l) {
+            free(argv);
+            return -1;
+        }
+        argv = l;
+
+        char tmpFilePath[MAX_PATH];
+        ExtraFile * extraFile = pakData->extraFileList;
+        while( extraFile ) {
+            printf("add %s\n", extraFile->filename);
+            snprintf(tmpFilePath, sizeof(tmpFilePath), "%s/%s", output->workDir, extraFile->filename);
+            if (!copy_file(extraFile->filename, tmpFilePath)) {
+                fprintf(stderr, "Error copying file: %s\n", extraFile->filename);
+                free(argv);
+                return -1;
+            }
+
+            argv[argc++] = extraFile->filename;
+            extraFile = extraFile->next;
+        }
+        argv[argc] = NULL;
+    }
+
+    printf("save %s\n\n", pakData->outputPakFile);
+
+    intptr_t pid = spawnvp_quiet(NULL, PSAR, argv);
+
+    free(argv);
+    return pid;
+}
+
+/**
+ * Move an input PAK file to the patching stage once all its MBIN files are decompiled.
+ *
+ * @param job - The input PAK file.
+ */
+static void input_decompiled(InputJob *job) {
+    if (job->stage == INPUT_DECOMPILING && !job->runningShards && job->nextShard == job->batch.shardCount) {
+        free_batch(&job->batch);
+        job->stage = INPUT_READY;
+    }
+}
+
+/**
+ * Move an input PAK file whose MBIN files are extracted to the decompilation stage.
+ *
+ * @param pipeline - The pipeline.
+ * @param job - The input PAK file.
+ *
+ * The MBIN files the cache has without their XML file are copied from it. The MBIN files without
+ * a cached XML file are split by size between up to --jobs MBINCompiler processes.
+ */
+static void input_extracted(Pipeline *pipeline, InputJob *job) {
+    char path[MAX_PATH];
+    size_t n = 0;
+    for (MBINData* m = job->data->mbinData; m && job->cached && !pipeline->error; m = m->next, n++) {
+        if (job->cached[n] != CACHED_MBIN) continue;
+        snprintf(path, sizeof(path), "%s/%s", job->data->workDir, m->mbinFile);
+        if (cache_fetch(job->cacheDir, m->mbinFile, path)) {
+            fprintf(stderr, "Error copying file from the cache: %s\n", m->mbinFile);
+            pipeline->error = 1;
+        }
+    }
+
+    if (!pipeline->error) {
+        size_t mbinCount = 0;
+        char **mbinList = get_uncached_mbin_list(NULL, &mbinCount, job, CACHED_EXML);
+        if ((job->data->mbinCount && !mbinList) ||
+            split_batch(&job->batch, job->data->workDir, mbinList, mbinCount, jobs)) {
+            pipeline->error = 1;
+        }
+        free(mbinList);
+    }
+    job->stage = INPUT_DECOMPILING;
+    input_decompiled(job);
+}
+
+/**
+ * Start the processes of the pipeline that can run, while there are free jobs.
+ *
+ * @param pipeline - The pipeline.
+ *
+ * Output PAK files whose MBIN files are all compiled are packed first, then the input PAK files
+ * already extracted are decompiled and the next ones extracted, which keeps the patching fed; the
+ * ones whose MBIN files are all cached skip psar, and go straight to patching when their XML files
+ * are cached too. The patched XML files take the jobs left: as starting MBINCompiler is expensive,
+ * the files of an output PAK file are compiled by a single process while it is patched, and only
+ * once there are EARLY_COMPILE_BYTES of them, and split between all the free jobs after that. The
+ * input PAK files ready to be patched get a patch thread, up to --jobs of them. Nothing is started
+ * after an error.
+ */
+static void pipeline_start(Pipeline *pipeline) {
+    int skipped = 0;
+    for (size_t o = 0; o < pipeline->outputCount && !pipeline->error && pipeline->runningCount < (size_t) jobs; o++) {
+        OutputJob* output = &pipeline->outputs[o];
+        if (output->stage != OUTPUT_PATCHING) continue;
+
+        if (output->queueCount || output->runningCompilers || !output_patched(pipeline, output)) continue;
+
+        intptr_t pid = -1;
+        if (!collect_output_files(pipeline, output) && (pid = start_packing(output)) == -1) {
+            fprintf(stderr, "Error creating PAK archive: %s\n", output->data->outputPakFile);
+        }
+        if (pid == -1) {
+            pipeline->error = 1;
+            break;
+        }
+        output->stage = OUTPUT_PACKING;
+        pipeline_add_process(pipeline, PROCESS_PACK, o, pid);
+    }
+
+    for (size_t i = 0; i < pipeline->nextInput && !pipeline->error && pipeline->runningCount < (size_t) jobs; i++) {
+        InputJob* job = &pipeline->inputs[i];
+        while (job->stage == INPUT_DECOMPILING && job->nextShard < job->batch.shardCount &&
+               pipeline->runningCount < (size_t) jobs) {
+            intptr_t pid = start_compiler(job->data->workDir, &job->batch.shards[job->nextShard++], 1);
+            if (pid == -1) {
+                fprintf(stderr, "Error converting MBINs from EXML: %s\n", job->data->inputPakFile);
+                pipeline->error = 1;
+                break;
+            }
+            pipeline_add_process(pipeline, PROCESS_DECOMPILE, i, pid);
+            job->runningShards++;
+        }
+    }
+
+    while (!pipeline->error && pipeline->runningCount < (size_t) jobs && pipeline->nextInput < pipeline->inputCount) {
+        InputJob* job = &pipeline->inputs[pipeline->nextInput];
+
+        // The input PAK files of the output PAK files that are up to date are left alone
+        if (job->stage != INPUT_PENDING) {
+            pipeline->nextInput++;
+            continue;
+        }
+
+        // Input PAK files whose MBIN files are all cached are not opened with psar
+        int extract = !job->cached;
+        for (size_t n = 0; !extract && n < job->data->mbinCount; n++) extract = job->cached[n] == CACHED_NONE;
+        if (!extract) {
+            pipeline->nextInput++;
+            input_extracted(pipeline, job);
+            skipped = 1;
+            continue;
+        }
+
+        intptr_t pid = start_extraction(job);
+        if (pid == -1) {
+            fprintf(stderr, "Error extracting MBINs from file: %s\n", job->data->inputPakFile);
+            pipeline->error = 1;
+            break;
+        }
+        pipeline_add_process(pipeline, PROCESS_EXTRACT, pipeline->nextInput++, pid);
+        job->stage = INPUT_EXTRACTING;
+    }
+
+    for (size_t o = 0; o < pipeline->outputCount && !pipeline->error && pipeline->runningCount < (size_t) jobs; o++) {
+        OutputJob* output = &pipeline->outputs[o];
+        if (!output->queueCount) continue;
+
+        // Until the last files are queued, one process at a time compiles what is worth starting it for
+        if (output_patched(pipeline, output)) {
+            start_compilation(pipeline, o, jobs - pipeline->runningCount);
+        } else if (!output->runningCompilers && output->queueBytes >= EARLY_COMPILE_BYTES) {
+            start_compilation(pipeline, o, 1);
+        }
+    }
+
+    for (size_t i = 0; i < pipeline->nextInput && !pipeline->error && pipeline->patchingCount < pipeline->patchThreads; i++) {
+        InputJob* job = &pipeline->inputs[i];
+        if (job->stage != INPUT_READY) continue;
+
+        job->nextQueued = job->data->mbinData;
+        if (thread_start(&job->thread, patch_input, job)) {
+            fprintf(stderr, "Error starting the patch thread of %s\n", job->data->inputPakFile);
+            pipeline->error = 1;
+            break;
+        }
+        job->stage = INPUT_PATCHING;
+        pipeline->patchingCount++;
+    }
+
+    // The input PAK files that skipped psar may have MBIN files to decompile with the jobs left
+    if (skipped) pipeline_start(pipeline);
+}
+
+/**
+ * Wait for a process of the pipeline to finish and move its PAK file to the next stage.
+ *
+ * @param pipeline - The pipeline.
+ * @param block - 0 to return at once if no process has finished yet.
+ * @return 1 if a process finished, 0 otherwise.
+ */
+static int pipeline_wait(Pipeline *pipeline, int block) {
+    if (!pipeline->runningCount) return 0;
+
+    int status;
+    int index = wait_any_process(pipeline->pids, pipeline->runningCount, block, &status);
+    if (index == -2) return 0;
+    if (index < 0) {
+        fprintf(stderr, "Error waiting for the MBINCompiler and PSAR processes\n");
+        pipeline->error = 1;
+        pipeline->runningCount = 0;
+        return 0;
+    }
+
+    ProcessType type = pipeline->types[index];
+    size_t owner = pipeline->owners[index];
+    pipeline->runningCount--;
+    pipeline->pids[index] = pipeline->pids[pipeline->runningCount];
+    pipeline->types[index] = pipeline->types[pipeline->runningCount];
+    pipeline->owners[index] = pipeline->owners[pipeline->runningCount];
+
+    if (type == PROCESS_PACK) {
+        OutputJob* output = &pipeline->outputs[owner];
+        if (status) {
+            fprintf(stderr, "Error creating PAK archive: %s\n", output->data->outputPakFile);
+            pipeline->error = 1;
+        } else if (!output->failed && manifest_save(&output->manifest, output->data->outputPakFile)) {
+            fprintf(stderr, "Error writing the manifest of %s\n", output->data->outputPakFile);
+        }
+        output->stage = OUTPUT_DONE;
+        return 1;
+    }
+
+    if (type == PROCESS_COMPILE) {
+        OutputJob* output = &pipeline->outputs[owner];
+        output->runningCompilers--;
+        if (status && !output->failed) {
+            fprintf(stderr, "Error compiling XML files to MBIN\n");
+            output->failed = 1;
+            pipeline->error = 1;
+        }
+        return 1;
+    }
+
+    InputJob* job = &pipeline->inputs[owner];
+    if (type == PROCESS_EXTRACT) {
+        if (status) {
+            fprintf(stderr, "Error extracting MBINs from file: %s\n", job->data->inputPakFile);
+            pipeline->error = 1;
+            job->stage = INPUT_DECOMPILING;
+        } else {
+            input_extracted(pipeline, job);
+        }
+    } else {
+        job->runningShards--;
+        if (status && !job->failed) {
+            fprintf(stderr, "Error converting MBINs from EXML: %s\n", job->data->inputPakFile);
+            job->failed = 1;
+            pipeline->error = 1;
+        }
+    }
+    input_decompiled(job);
+    return 1;
+}
+
+/**
+ * Interval in milliseconds at which the processes of the pipeline are checked while patch threads
+ * are running.
+ */
+#define PIPELINE_POLL_INTERVAL  10
+
+/**
+ * Take the progress of the patch threads into the pipeline.
+ *
+ * @param pipeline - The pipeline.
+ * @return 1 if a patch thread made progress, 0 otherwise.
+ *
+ * The MBIN files patched since the last call are queued for compilation, and the threads that are
+ * done are joined; an input PAK file that couldn't be patched stops the pipeline. The messages of the input PAK files are printed in order, once every input PAK
+ * file before them is patched.
+ */
+static int pipeline_collect(Pipeline *pipeline) {
+    int progress = 0;
+    for (size_t i = 0; i < pipeline->nextInput && pipeline->patchingCount; i++) {
+        InputJob* job = &pipeline->inputs[i];
+        if (job->stage != INPUT_PATCHING) continue;
+
+        mutex_lock(&pipeline->mutex);
+        size_t patched = job->patched;
+        int finished = job->finished;
+        mutex_unlock(&pipeline->mutex);
+
+        for (; job->queued < patched; job->queued++, progress = 1) {
+            // Only the changed files are compiled, unless their MBIN file was taken from the cache
+            MBINData* mbinData = job->nextQueued;
+            if (mbinData->dirty && (!job->compiled || !job->compiled[job->queued].cached)) pipeline_queue(pipeline, job, mbinData);
+            job->nextQueued = job->nextQueued->next;
+        }
+        if (finished) {
+            thread_join(job->thread);
+            job->stage = INPUT_PATCHED;
+            pipeline->patchingCount--;
+            if (job->failed) pipeline->outputs[job->output].failed = pipeline->error = 1;
+            progress = 1;
+        }
+    }
+
+    while (pipeline->nextLog < pipeline->inputCount && pipeline->inputs[pipeline->nextLog].stage == INPUT_PATCHED) {
+        print_patch_log(&pipeline->inputs[pipeline->nextLog++].log);
+    }
+    return progress;
+}
+
+/**
+ * Run the pipeline until every PAK file is done, or until the running processes and threads are
+ * done after an error.
+ *
+ * @param pipeline - The pipeline.
+ *
+ * While patch threads are running, the processes are checked for every PIPELINE_POLL_INTERVAL
+ * milliseconds, or as soon as a thread makes progress; otherwise the pipeline waits for them.
+ */
+static void pipeline_run(Pipeline *pipeline) {
+    for (;;) {
+        pipeline_start(pipeline);
+        if (!pipeline->runningCount && !pipeline->patchingCount) return;
+
+        int progress = pipeline_collect(pipeline);
+        if (!pipeline->patchingCount) {
+            if (!progress) pipeline_wait(pipeline, 1);
+            continue;
+        }
+
+        while (pipeline_wait(pipeline, 0)) progress = 1;
+        if (!progress) {
+            mutex_lock(&pipeline->mutex);
+            if (!pipeline->signaled) condition_wait(&pipeline->condition, &pipeline->mutex, PIPELINE_POLL_INTERVAL);
+            pipeline->signaled = 0;
+            mutex_unlock(&pipeline->mutex);
+        }
+    }
+}
+
+/**
+ * Set the current path for XML operations.
+ *
+ * @param path - The path of a "cd" command.
+ *
+ * This function updates the resolved current path. Absolute paths (starting with "/")
+ * replace it; relative paths are appended to it. Empty components are ignored. The
+ * input string is not modified.
+ */
+void set_xpath(const char* path) {
+    if (!path) {
+        resolvedPath[0] = '\0';
+        return;
+    }
+
+    if (path[0] == '/') strcpy(resolvedPath, "/");
+
+    size_t len = strlen(resolvedPath);
+    while (*path) {
+        size_t tokenLen = strcspn(path, "/");
+        if (tokenLen) {
+            int separator = len && resolvedPath[len - 1] != '/';
+            if (len + separator + tokenLen >= sizeof(resolvedPath)) {
+                printf("error, path too long\n");
+                exit(EXIT_FAILURE);
+            }
+            if (separator) resolvedPath[len++] = '/';
+            memcpy(&resolvedPath[len], path, tokenLen);
+            len += tokenLen;
+            resolvedPath[len] = '\0';
+        }
+        path += tokenLen;
+        if (*path) path++;
+    }
+}
+
+/**
+ * Check the "[=value]" steps of a resolved path.
+ *
+ * @param path - The resolved path, as built by set_xpath.
+ * @return 0 if the path is valid, 1 otherwise.
+ *
+ * Paths are compiled by the patch threads, so their syntax is checked before, on the main thread,
+ * while the start paths of the MBIN files are resolved.
+ */
+static int check_path(const char* path) {
+    const char* start = path;
+    while (*path) {
+        size_t length = strcspn(path, "/");
+        const char* p = memchr(path, '=', length);
+        if (p && p > path && p[-1] == '[' && path[0] != '*') {
+            const char* p1 = memchr(p, ']', length - (p - path));
+            if (!p1) {
+                printf("error, missing ] in path: %s\n", start);
+                return 1;
+            }
+            if (p1 != path + length - 1) {
+                printf("error, extra data after ] in path: %s\n", start);
+                return 1;
+            }
+        }
+        path += length;
+        if (*path) path++;
+    }
+    return 0;
+}
+
+/**
+ * Compile a step of a resolved path.
+ *
+ * @param token - The path component. It is modified in-place.
+ * @param step - The step to fill in.
+ * @param xpathBuffer - The XPath expression being built; the XPath of the step is appended to it.
+ *
+ * @return 0 on success, 1 if the step is not valid; check_path reports those before.
+ *
+ * The "name" and "value" strings of the step point into the token.
+ */
+static int compile_step(char* token, PathStep* step, char* xpathBuffer) {
+    char* p;
+
+    step->name = NULL;
+    step->value = NULL;
+
+    if (token[0] == '*') {
+        step->type = STEP_ANY;
+        strcat(xpathBuffer, "*");
+    } else if (strcmp(token, "..") == 0) {
+        step->type = STEP_PARENT;
+        strcat(xpathBuffer, "..");
+    } else if ((p = strstr(token, "="))) {
+        char d = '\0';
+        if (p > token && p[-1] == '[') {
+            d = '[';
+            p[-1] = '\0';
+        }
+        p[0] = '\0';
+        p++;
+        step->type = STEP_PROPERTY;
+        strcat(xpathBuffer, "Property[");
+        if (token[0] && token[0] != '*') {
+            step->name = token;
+            strcat(xpathBuffer, "@name='");
+            strcat(xpathBuffer, token);
+            strcat(xpathBuffer, "' and ");
+        }
+        char* p1 = NULL;
+        if (d == '[') {
+            p1 = strchr(p, ']');
+            if (!p1) return 1;
+            p1[0] = '\0';
+        }
+        step->value = p;
+        strcat(xpathBuffer, "@value='");
+        strcat(xpathBuffer, p);
+        strcat(xpathBuffer, "']");
+        if (p1 && p1[1] != '\0') return 1;
+    } else {
+        step->type = STEP_PROPERTY;
+        step->name = token;
+        strcat(xpathBuffer, "Property[@name='");
+        strcat(xpathBuffer, token);
+        strcat(xpathBuffer, "']");
+    }
+    return 0;
+}
+
+/**
+ * Get the compiled form of a resolved path.
+ *
+ * @param path - The resolved path, as built by set_xpath.
+ * @return The CompiledPath of the path, or NULL on memory allocation errors.
+ *
+ * Each distinct path is compiled only once per run; the same "cd" path applied to many
+ * MBINs reuses the compiled steps. Absolute paths whose names and values can be compared
+ * literally are evaluated by the native walker (see select_nodes); any other path is
+ * compiled to an XPath expression, which is kept as a fallback. Expressions that fail to
+ * compile are remembered too, with a NULL comp.
+ */
+static CompiledPath* compile_path(const char* path) {
+    CompiledPath* compiled = hash_get(&compiledPaths, path);
+    if (compiled) return compiled;
+
+    size_t len = strlen(path);
+    compiled = arena_alloc(&compiledPathArena, sizeof(CompiledPath));
+    char* key = arena_strdup(&compiledPathArena, path);
+    char* tokens = arena_strdup(&compiledPathArena, path);
+
+    // Each step expands to at most its own length plus the Property predicate
+    size_t maxSteps = len / 2 + 1;
+    char* xpathBuffer = malloc(len * 3 + maxSteps * 48 + 8);
+    PathStep* steps = arena_alloc(&compiledPathArena, maxSteps * sizeof(PathStep));
+
+    if (!compiled || !key || !tokens || !xpathBuffer || !steps) {
+        patch_printf(stderr, "Error: Memory allocation for CompiledPath failed\n");
+        free(xpathBuffer);
+        return NULL;
+    }
+
+    compiled->native = path[0] == '/';
+    compiled->literal = 1;
+    compiled->cursorSafe = 0;
+    compiled->steps = steps;
+    compiled->stepCount = 0;
+    compiled->comp = NULL;
+
+    xpathBuffer[0] = '\0';
+    if (path[0] == '/') strcpy(xpathBuffer, "/Data");
+
+    long depth = 0, valueDepth = NO_VALUE_DEPTH;
+    char* save = NULL;
+    char* token = strtok_r(tokens, "/", &save);
+    while (token) {
+        if (xpathBuffer[0]) strcat(xpathBuffer, "/");
+
+        PathStep* step = &steps[compiled->stepCount++];
+        if (compile_step(token, step, xpathBuffer)) {
+            free(xpathBuffer);
+            return NULL;
+        }
+
+        depth += step->type == STEP_PARENT ? -1 : 1;
+        if (step->value && depth > valueDepth) valueDepth = depth;
+
+        // Quotes would end the XPath literal; leave those paths to libxml2
+        if ((step->name && strchr(step->name, '\'')) || (step->value && strchr(step->value, '\'')))
+            compiled->literal = 0;
+
+        token = strtok_r(NULL, "/", &save);
+    }
+
+    // A block only changes the values of the children of the selected nodes and appends
+    // children to them, so the selection stays valid after the block unless the path compares
+    // values below the selected nodes
+    compiled->native = compiled->native && compiled->literal;
+    compiled->depth = depth;
+    compiled->valueDepth = valueDepth;
+    compiled->cursorSafe = compiled->native && valueDepth <= depth;
+
+    compiled->xpath = arena_strdup(&compiledPathArena, xpathBuffer);
+    free(xpathBuffer);
+    if (!compiled->xpath) {
+        patch_printf(stderr, "Error: Memory allocation for CompiledPath failed\n");
+        return NULL;
+    }
+
+    if (!compiled->native) compiled->comp = xmlXPathCompile(BAD_CAST compiled->xpath);
+
+    if (hash_put(&compiledPaths, key, compiled)) {
+        patch_printf(stderr, "Error: Memory allocation for CompiledPath failed\n");
+        if (compiled->comp) xmlXPathFreeCompExpr(compiled->comp);
+        return NULL;
+    }
+
+    return compiled;
+}
+
+/**
+ * Add a node to a node set.
+ *
+ * @param set - The node set.
+ * @param node - The node to add.
+ * @return 0 on success, 1 on memory allocation errors.
+ */
+static int nodeset_add(NodeSet* set, xmlNodePtr node) {
+    if (set->count == set->capacity) {
+        size_t capacity = set->capacity ? set->capacity * 2 : 64;
+        xmlNodePtr* nodes = realloc(set->nodes, capacity * sizeof(xmlNodePtr));
+        if (!nodes) return 1;
+        set->nodes = nodes;
+        set->capacity = capacity;
+    }
+    set->nodes[set->count++] = node;
+    return 0;
+}
+
+// Names of the EXML format, interned in the dictionary of the current document
+static THREAD_LOCAL const xmlChar* nameAttr = BAD_CAST "name";
+static THREAD_LOCAL const xmlChar* valueAttr = BAD_CAST "value";
+static THREAD_LOCAL const xmlChar* propertyElement = BAD_CAST "Property";
+static THREAD_LOCAL const xmlChar* dataElement = BAD_CAST "Data";
+
+// 1 if the names of the current document come from its dictionary
+static THREAD_LOCAL int namesInterned = 0;
+
+/**
+ * Compare a name of the current document with one of the EXML names.
+ *
+ * When the document names are interned, equal names are the same pointer.
+ */
+#define SAME_NAME(a, b) (namesInterned ? (a) == (b) : xmlStrEqual((a), (b)))
+
+/**
+ * Set the current document.
+ *
+ * @param document - The document to modify.
+ *
+ * The EXML names are looked up in the dictionary of the document, so element and attribute
+ * names can be matched by comparing pointers. Documents parsed without a dictionary fall back
+ * to string compares.
+ */
+static void set_document(xmlDocPtr document) {
+    doc = document;
+    cursorValid = 0;
+
+    xmlNodePtr root = doc ? xmlDocGetRootElement(doc) : NULL;
+    namesInterned = root && doc->dict && xmlDictOwns(doc->dict, root->name) == 1;
+    if (namesInterned) {
+        nameAttr = xmlDictLookup(doc->dict, BAD_CAST "name", -1);
+        valueAttr = xmlDictLookup(doc->dict, BAD_CAST "value", -1);
+        propertyElement = xmlDictLookup(doc->dict, BAD_CAST "Property", -1);
+        dataElement = xmlDictLookup(doc->dict, BAD_CAST "Data", -1);
+        namesInterned = nameAttr && valueAttr && propertyElement && dataElement;
+    }
+    if (!namesInterned) {
+        nameAttr = BAD_CAST "name";
+        valueAttr = BAD_CAST "value";
+        propertyElement = BAD_CAST "Property";
+        dataElement = BAD_CAST "Data";
+    }
+}
+
+/**
+ * Find an attribute of a node.
+ *
+ * @param node - The node.
+ * @param name - The name of the attribute, one of the EXML names.
+ * @return The attribute, or NULL if the node doesn't have it.
+ */
+static xmlAttrPtr find_attr(xmlNodePtr node, const xmlChar* name) {
+    if (node->type != XML_ELEMENT_NODE) return NULL;
+    for (xmlAttrPtr attr = node->properties; attr; attr = attr->next) {
+        if (SAME_NAME(attr->name, name)) return attr;
+    }
+    return NULL;
+}
+
+/**
+ * Get the text of an attribute of a node, in place.
+ *
+ * @param node - The node.
+ * @param name - The name of the attribute, one of the EXML names.
+ * @param text - Where to store the text of the attribute ("" for empty attributes).
+ * @return 1 if the node has the attribute, 0 if it doesn't, -1 if the attribute has entity
+ *         references and has no single text to point to.
+ *
+ * The text belongs to the attribute and is valid until its value changes.
+ */
+static int get_attr_text(xmlNodePtr node, const xmlChar* name, const char** text) {
+    xmlAttrPtr attr = find_attr(node, name);
+    if (!attr) return 0;
+
+    xmlNodePtr child = attr->children;
+    if (!child) {
+        *text = "";
+        return 1;
+    }
+    if (child->next || child->type != XML_TEXT_NODE) return -1;
+    *text = (const char*)child->content;
+    return 1;
+}
+
+/**
+ * Compare an attribute of a node with a string, without copying the attribute.
+ *
+ * @param node - The node.
+ * @param name - The name of the attribute, one of the EXML names.
+ * @param value - The string to compare with.
+ * @return 1 if the node has the attribute and its value is equal to the string, 0 otherwise.
+ */
+static int attr_equals(xmlNodePtr node, const xmlChar* name, const char* value) {
+    const char* text;
+    int found = get_attr_text(node, name, &text);
+    if (found >= 0) return found && !strcmp(text, value);
+
+    // Attribute values with entity references are compared through a copy
+    xmlChar* content = xmlNodeListGetString(node->doc, find_attr(node, name)->children, 1);
+    int equal = xmlStrEqual(content ? content : BAD_CAST "", BAD_CAST value);
+    xmlFree(content);
+    return equal;
+}
+
+/**
+ * Check whether a node is selected by a step going down from its parent.
+ *
+ * @param step - The step, of type STEP_ANY or STEP_PROPERTY.
+ * @param node - The child node.
+ * @return 1 if the step selects the node, 0 otherwise.
+ */
+static int step_matches(PathStep* step, xmlNodePtr node) {
+    if (node->type != XML_ELEMENT_NODE) return 0;
+    if (step->type == STEP_PROPERTY) {
+        if (!SAME_NAME(node->name, propertyElement)) return 0;
+        if (step->name && !attr_equals(node, nameAttr, step->name)) return 0;
+        if (step->value && !attr_equals(node, valueAttr, step->value)) return 0;
+    }
+    return 1;
+}
+
+/**
+ * Walk the steps of a path from a set of nodes.
+ *
+ * @param start - The nodes to start from, all at the same depth and in document order.
+ * @param steps - The steps to walk.
+ * @param stepCount - The number of steps.
+ * @return The selected nodes, in document order, or NULL on memory allocation errors.
+ *
+ * The returned set is either the start set (when there are no steps or it is empty) or one
+ * of the walker node sets, valid until the next walk.
+ */
+static NodeSet* walk_steps(NodeSet* start, PathStep* steps, size_t stepCount) {
+    NodeSet* current = start;
+
+    for (size_t s = 0; s < stepCount && current->count; s++) {
+        PathStep* step = &steps[s];
+        NodeSet* next = current == &walkSets[0] ? &walkSets[1] : &walkSets[0];
+        next->count = 0;
+
+        for (size_t i = 0; i < current->count; i++) {
+            xmlNodePtr node = current->nodes[i];
+
+            if (step->type == STEP_PARENT) {
+                // Nodes of a set are at the same depth, so repeated parents are adjacent
+                xmlNodePtr parent = node->parent;
+                if (parent && (!next->count || next->nodes[next->count - 1] != parent)) {
+                    if (nodeset_add(next, parent)) return NULL;
+                }
+                continue;
+            }
+
+            for (xmlNodePtr child = node->children; child; child = child->next) {
+                if (step_matches(step, child) && nodeset_add(next, child)) return NULL;
+            }
+        }
+
+        current = next;
+    }
+
+    return current;
+}
+
+/**
+ * Select the nodes of the current document matching a compiled path.
+ *
+ * @param path - The compiled path.
+ * @return The selected nodes, in document order, or NULL if the path can't be evaluated.
+ *
+ * Native paths are evaluated by walking the children of the nodes directly, one step at a
+ * time; other paths are evaluated with the libxml2 XPath engine. The returned set is owned
+ * by this function and is valid until the next call.
+ */
+static NodeSet* select_nodes(CompiledPath* path) {
+    NodeSet* current = &walkSets[0];
+    current->count = 0;
+
+    if (!path->native) {
+        if (!path->comp) return NULL;
+
+        xmlXPathContextPtr context = xmlXPathNewContext(doc);
+        if (context == NULL) {
+            patch_printf(stderr, "Error creating XPath context.\n");
+            return NULL;
+        }
+
+        xmlXPathObjectPtr result = xmlXPathCompiledEval(path->comp, context);
+        xmlXPathFreeContext(context);
+        if (!result) return NULL;
+
+        int error = 0;
+        if (result->nodesetval) {
+            for (int i = 0; !error && i < result->nodesetval->nodeNr; i++) {
+                error = nodeset_add(current, result->nodesetval->nodeTab[i]);
+            }
+        }
+        xmlXPathFreeObject(result);
+
+        return error ? NULL : current;
+    }
+
+    // "/Data" is the root element
+    xmlNodePtr root = xmlDocGetRootElement(doc);
+    if (root && SAME_NAME(root->name, dataElement)) {
+        if (nodeset_add(current, root)) return NULL;
+    }
+
+    return walk_steps(current, path->steps, path->stepCount);
+}
+
+/**
+ * Number of lookups on the children of a node before they get indexed.
+ */
+#define CHILD_INDEX_QUERIES         4
+
+/**
+ * Minimum number of element children of a node for them to be indexed.
+ */
+#define CHILD_INDEX_MIN_CHILDREN    32
+
+// Structure to store a table of a child index
+typedef struct ChildTable {
+    HashTable table;        // attribute text -> first child with that text
+    unsigned misses;        // lookups done by scanning since the table was last valid
+    int built;              // the table is up to date
+} ChildTable;
+
+// Structure to store the lookup state and index of the children of a node
+typedef struct ChildIndex {
+    xmlNodePtr node;
+    int wide;               // 1 if the node has enough children to be indexed, 0 if not, -1 if unknown
+    ChildTable byName;      // keyed by the "name" attribute
+    ChildTable byValue;     // keyed by the "value" attribute
+    struct ChildIndex* next;
+} ChildIndex;
+
+// Child indexes of the current document, attached to the nodes through node->_private
+static THREAD_LOCAL Arena childIndexArena = ARENA_INIT;
+static THREAD_LOCAL ChildIndex* childIndexList = NULL;
+
+/**
+ * Release the child indexes of the current document.
+ *
+ * The indexes point into the document, so they are released before moving to the next one.
+ */
+static void release_child_indexes(void) {
+    for (ChildIndex* index = childIndexList; index; index = index->next) {
+        index->node->_private = NULL;
+        hash_free(&index->byName.table);
+        hash_free(&index->byValue.table);
+    }
+    childIndexList = NULL;
+    arena_release(&childIndexArena);
+}
+
+/**
+ * Drop a table of a child index.
+ *
+ * @param table - The table. It is rebuilt after CHILD_INDEX_QUERIES more lookups.
+ */
+static void drop_child_table(ChildTable* table) {
+    hash_free(&table->table);
+    table->built = 0;
+    table->misses = 0;
+}
+
+/**
+ * Fill a table of a child index.
+ *
+ * @param node - The node whose children are indexed.
+ * @param table - The table to fill.
+ * @param attr - The attribute used as key (nameAttr or valueAttr).
+ * @return 0 on success, 1 if the children can't be indexed.
+ *
+ * Only the first child with each key is stored, which is the one a linear scan would find.
+ * Keys point to the text of the attributes.
+ */
+static int build_child_table(xmlNodePtr node, ChildTable* table, const xmlChar* attr) {
+    hash_free(&table->table);
+    for (xmlNodePtr child = node->children; child; child = child->next) {
+        const char* key;
+        int found = get_attr_text(child, attr, &key);
+        if (found < 0) return 1;
+        if (found && !hash_get(&table->table, key) && hash_put(&table->table, key, child)) return 1;
+    }
+    table->built = 1;
+    return 0;
+}
+
+/**
+ * Get a table of the child index of a node for a lookup.
+ *
+ * @param node - The node whose children are searched.
+ * @param byValue - 1 to get the table keyed by "value", 0 for the one keyed by "name".
+ * @return The table, or NULL if the caller should scan the children.
+ *
+ * A table is built after CHILD_INDEX_QUERIES lookups have scanned the children, and only if
+ * the node has at least CHILD_INDEX_MIN_CHILDREN element children, so narrow nodes and nodes
+ * looked up only a few times keep using a plain scan. A table dropped because of a change is
+ * rebuilt the same way, so alternating changes and lookups don't rebuild it every time.
+ */
+static HashTable* get_child_table(xmlNodePtr node, int byValue) {
+    ChildIndex* index = node->_private;
+    if (!index) {
+        index = arena_calloc(&childIndexArena, sizeof(ChildIndex));
+        if (!index) return NULL;
+        index->node = node;
+        index->wide = -1;
+        hash_init(&index->byName.table, NULL);
+        hash_init(&index->byValue.table, NULL);
+        index->next = childIndexList;
+        childIndexList = index;
+        node->_private = index;
+    }
+
+    ChildTable* table = byValue ? &index->byValue : &index->byName;
+    if (table->built) return &table->table;
+
+    if (!index->wide || table->misses < CHILD_INDEX_QUERIES) {
+        table->misses++;
+        return NULL;
+    }
+
+    if (index->wide < 0) {
+        index->wide = xmlChildElementCount(node) >= CHILD_INDEX_MIN_CHILDREN;
+        if (!index->wide) return NULL;
+    }
+
+    if (build_child_table(node, table, byValue ? valueAttr : nameAttr)) {
+        drop_child_table(table);
+        index->wide = 0;
+        return NULL;
+    }
+    return &table->table;
+}
+
+/**
+ * Update the child index of a node after appending a child.
+ *
+ * @param node - The parent node.
+ * @param child - The appended child.
+ */
+static void index_appended_child(xmlNodePtr node, xmlNodePtr child) {
+    ChildIndex* index = node->_private;
+    if (!index) return;
+
+    const char* key;
+    if (index->byName.built && get_attr_text(child, nameAttr, &key) == 1 && !hash_get(&index->byName.table, key)) {
+        if (hash_put(&index->byName.table, key, child)) drop_child_table(&index->byName);
+    }
+    if (index->byValue.built && get_attr_text(child, valueAttr, &key) == 1 && !hash_get(&index->byValue.table, key)) {
+        if (hash_put(&index->byValue.table, key, child)) drop_child_table(&index->byValue);
+    }
+}
+
+/**
+ * Find the first child of a node with a given attribute value.
+ *
+ * @param node - The node whose children are searched.
+ * @param attr - The attribute to compare (nameAttr or valueAttr).
+ * @param value - The value to search for.
+ * @return The first matching child, or NULL if there is none.
+ */
+static xmlNodePtr find_child(xmlNodePtr node, const xmlChar* attr, const char* value) {
+    HashTable* table = get_child_table(node, attr == valueAttr);
+    if (table) return hash_get(table, value);
+
+    for (xmlNodePtr child = node->children; child; child = child->next) {
+        if (attr_equals(child, attr, value)) return child;
+    }
+    return NULL;
+}
+
+/**
+ * Set the "value" attribute of a Property node.
+ *
+ * @param child - The node to update.
+ * @param value - The value to set (NULL sets an empty value).
+ */
+static void set_property_value(xmlNodePtr child, const char* value) {
+    // Nothing to do if the value doesn't change
+    const char* text;
+    if (value && get_attr_text(child, valueAttr, &text) == 1 && !strcmp(text, value))
+        return;
+    documentChanged = 1;
+
+    // The value index of the parent points to the old value
+    ChildIndex* index = child->parent ? child->parent->_private : NULL;
+    if (index && index->byValue.built)
+        drop_child_table(&index->byValue);
+
+    xmlAttrPtr attrValue = find_attr(child, valueAttr);
+    if (attrValue) {
+        // Update the content of the "value" attribute
+        xmlNodeSetContent(attrValue->children, BAD_CAST value);
+    } else {
+        // The "value" attribute does not exist, create a new attribute and set its value
+        xmlNewProp(child, valueAttr, BAD_CAST value);
+    }
+}
+
+/**
+ * Append a new Property node to a node.
+ *
+ * @param node - The parent node.
+ * @param name - The "name" attribute of the new node, or NULL.
+ * @param value - The "value" attribute of the new node, or NULL.
+ * @return The new node.
+ */
+static xmlNodePtr append_property(xmlNodePtr node, const char* name, const char* value) {
+    documentChanged = 1;
+
+    // Created in the document, so the names come from its dictionary
+    xmlNodePtr newNode = xmlNewDocNode(doc, NULL, propertyElement, NULL);
+    if (name)
+        xmlNewProp(newNode, nameAttr, BAD_CAST name);
+    if (value)
+        xmlNewProp(newNode, valueAttr, BAD_CAST value);
+    xmlAddChild(node, newNode);
+    index_appended_child(node, newNode);
+    return newNode;
+}
+
+/**
+ * Set the value of an item of a node.
+ *
+ * @param node - The node selected by the current path.
+ * @param name - The name of the item.
+ * @param value - The value to set for the item.
+ *
+ * This function searches the first child of the node whose "name" attribute (or "value"
+ * attribute, for items without a name) matches the item, and sets its value. If the
+ * item does not exist, it creates a new node and sets its value. Children of wide nodes
+ * that are looked up repeatedly are found through a child index (see get_child_table).
+ */
+void set_item(xmlNodePtr node, const char* name, const char* value) {
+    if (!name && !value)
+        return;
+
+    xmlNodePtr child = name ? find_child(node, nameAttr, name) : find_child(node, valueAttr, value);
+    if (child) {
+        set_property_value(child, value);
+        return;
+    }
+
+    // Create a new node at the specified path
+    append_property(node, name, value);
+}
+
+/**
+ * Select the nodes of the current path for a modification block.
+ *
+ * @param modification - The modification block, whose path is the current path.
+ * @return The selected nodes, or NULL if the path can't be evaluated or isn't needed.
+ *
+ * When the "cd" of the block is relative and the nodes selected by the previous block are
+ * still valid, only the steps of the "cd" are walked, starting from those nodes, instead of
+ * the whole path from the root; the whole path is only compiled when it has to be evaluated.
+ * The selection is kept as the cursor for the next block when the block can't change which
+ * nodes its path selects, that is, when the path doesn't compare values below them.
+ */
+static NodeSet* select_block_nodes(ModificationData* modification) {
+    const char* cd = modification->xpath;
+    int useCursor = cursorValid && cd && cd[0] != '/';
+    cursorValid = 0;
+
+    NodeSet* nodes = NULL;
+    long depth = 0, valueDepth = NO_VALUE_DEPTH;
+
+    CompiledPath* relative = useCursor ? compile_path(cd) : NULL;
+    if (relative && relative->literal) {
+        depth = cursorDepth + relative->depth;
+        valueDepth = cursorValueDepth;
+        if (relative->valueDepth != NO_VALUE_DEPTH && cursorDepth + relative->valueDepth > valueDepth)
+            valueDepth = cursorDepth + relative->valueDepth;
+        if (!modification->values && valueDepth > depth) return NULL;
+
+        nodes = walk_steps(&cursorSet, relative->steps, relative->stepCount);
+    }
+
+    if (!nodes) {
+        // Evaluate the whole path
+        compiledPath = compile_path(resolvedPath);
+        xpath = compiledPath ? compiledPath->xpath : "";
+        if (!compiledPath || (!modification->values && !compiledPath->cursorSafe))
+            return NULL;
+
+        nodes = select_nodes(compiledPath);
+        depth = compiledPath->depth;
+        valueDepth = compiledPath->cursorSafe ? compiledPath->valueDepth : depth + 1;
+    }
+
+    if (nodes && valueDepth <= depth) {
+        if (nodes != &cursorSet) {
+            NodeSet t = cursorSet;
+            cursorSet = *nodes;
+            *nodes = t;
+            nodes = &cursorSet;
+        }
+        cursorValid = 1;
+        cursorDepth = depth;
+        cursorValueDepth = valueDepth;
+    }
+    return nodes;
+}
+
+/**
+ * Apply a modification block to the XML document.
+ *
+ * @param modification - The modification block, whose path is the current path.
+ * @param nodes - The nodes selected by the current path, or NULL if it can't be evaluated.
+ *
+ * The current path is evaluated once for the whole block. For each selected node, a single
+ * sweep over its children finds the first child for every name of the block, through a hash
+ * table of the block names; then the name/value pairs are applied in order, updating the
+ * found children or appending new Property nodes. Wide nodes selected by many blocks use
+ * their child index instead of the sweep. Items without a name are matched by value
+ * with set_item when their turn comes, since earlier pairs of the block can change values.
+ * The result is the same as applying every pair on its own.
+ */
+static void apply_modification(ModificationData* modification, NodeSet* nodes) {
+    if (!modification->values)
+        return;
+
+    if (!nodes) {
+        patch_printf(stdout, "XPath not found: [%s]\n", xpath);
+        return;
+    }
+
+    // Index the names of the block; each distinct name gets a slot
+    HashTable names;
+    hash_init(&names, NULL);
+
+    size_t nameCount = 0;
+    for (NameValue* nv = modification->values; nv; nv = nv->next) {
+        if (nv->name && !hash_get(&names, nv->name)) {
+            if (hash_put(&names, nv->name, (void*)(uintptr_t)(nameCount + 1))) {
+                patch_printf(stderr, "Error: Memory allocation for the block index failed\n");
+                hash_free(&names);
+                return;
+            }
+            nameCount++;
+        }
+    }
+
+    xmlNodePtr* found = nameCount ? malloc(nameCount * sizeof(xmlNodePtr)) : NULL;
+    if (nameCount && !found) {
+        patch_printf(stderr, "Error: Memory allocation for the block index failed\n");
+        hash_free(&names);
+        return;
+    }
+
+    for (size_t i = 0; i < nodes->count; i++) {
+        xmlNodePtr node = nodes->nodes[i];
+
+        HashTable* byName = nameCount ? get_child_table(node, 0) : NULL;
+        if (byName) {
+            // Find the first child for every name of the block through the child index
+            memset(found, 0, nameCount * sizeof(xmlNodePtr));
+            for (NameValue* nv = modification->values; nv; nv = nv->next) {
+                if (nv->name) found[(uintptr_t)hash_get(&names, nv->name) - 1] = hash_get(byName, nv->name);
+            }
+        } else if (nameCount) {
+            // Find the first child for every name of the block in a single sweep
+            memset(found, 0, nameCount * sizeof(xmlNodePtr));
+            size_t pending = nameCount;
+            for (xmlNodePtr child = node->children; child && pending; child = child->next) {
+                const char* text;
+                xmlChar* copy = NULL;
+                int hasName = get_attr_text(child, nameAttr, &text);
+                if (hasName < 0) {
+                    // Names with entity references are looked up through a copy
+                    copy = xmlNodeListGetString(doc, find_attr(child, nameAttr)->children, 1);
+                    text = copy ? (const char*)copy : "";
+                }
+                if (hasName) {
+                    uintptr_t slot = (uintptr_t)hash_get(&names, text);
+                    if (slot && !found[slot - 1]) {
+                        found[slot - 1] = child;
+                        pending--;
+                    }
+                }
+                xmlFree(copy);
+            }
+        }
+
+        // Apply the pairs in order
+        for (NameValue* nv = modification->values; nv; nv = nv->next) {
+            if (!nv->name) {
+                set_item(node, NULL, nv->value);
+                continue;
+            }
+            uintptr_t slot = (uintptr_t)hash_get(&names, nv->name);
+            if (found[slot - 1]) {
+                set_property_value(found[slot - 1], nv->value);
+            } else {
+                found[slot - 1] = append_property(node, nv->name, nv->value);
+            }
+        }
+    }
+
+    free(found);
+    hash_free(&names);
+}
+
+/**
+ * Add a node to a set of EXML nodes.
+ *
+ * @param set - The node set.
+ * @param node - The index of the node to add.
+ * @return 0 on success, 1 on memory allocation errors.
+ */
+static int exml_nodeset_add(ExmlNodeSet* set, uint32_t node) {
+    if (set->count == set->capacity) {
+        size_t capacity = set->capacity ? set->capacity * 2 : 64;
+        uint32_t* nodes = realloc(set->nodes, capacity * sizeof(uint32_t));
+        if (!nodes) return 1;
+        set->nodes = nodes;
+        set->capacity = capacity;
+    }
+    set->nodes[set->count++] = node;
+    return 0;
+}
+
+/**
+ * Check whether a node of the EXML document is selected by a step going down from its parent.
+ *
+ * @param step - The step, of type STEP_ANY or STEP_PROPERTY.
+ * @param node - The index of the child node.
+ * @return 1 if the step selects the node, 0 otherwise.
+ */
+static int exml_step_matches(PathStep* step, uint32_t node) {
+    ExmlNode* n = &exmlDoc->nodes[node];
+    if (n->type != EXML_ELEMENT) return 0;
+    if (step->type == STEP_PROPERTY) {
+        if (n->name != EXML_NAME_PROPERTY) return 0;
+        const char* text;
+        if (step->name && (!(text = exml_get_attr(exmlDoc, node, EXML_NAME_NAME)) || strcmp(text, step->name))) return 0;
+        if (step->value && (!(text = exml_get_attr(exmlDoc, node, EXML_NAME_VALUE)) || strcmp(text, step->value))) return 0;
+    }
+    return 1;
+}
+
+/**
+ * Walk the steps of a path from a set of nodes of the EXML document.
+ *
+ * @param start - The nodes to start from, all at the same depth and in document order.
+ * @param steps - The steps to walk.
+ * @param stepCount - The number of steps.
+ * @return The selected nodes, in document order, or NULL on memory allocation errors.
+ *
+ * As walk_steps, the returned set is either the start set or one of the walker node sets.
+ */
+static ExmlNodeSet* exml_walk_steps(ExmlNodeSet* start, PathStep* steps, size_t stepCount) {
+    ExmlNodeSet* current = start;
+
+    for (size_t s = 0; s < stepCount && current->count; s++) {
+        PathStep* step = &steps[s];
+        ExmlNodeSet* next = current == &exmlWalkSets[0] ? &exmlWalkSets[1] : &exmlWalkSets[0];
+        next->count = 0;
+
+        for (size_t i = 0; i < current->count; i++) {
+            uint32_t node = current->nodes[i];
+
+            if (step->type == STEP_PARENT) {
+                // Nodes of a set are at the same depth, so repeated parents are adjacent
+                uint32_t parent = exmlDoc->nodes[node].parent;
+                if (parent != EXML_NONE && (!next->count || next->nodes[next->count - 1] != parent)) {
+                    if (exml_nodeset_add(next, parent)) return NULL;
+                }
+                continue;
+            }
+
+            for (uint32_t child = exmlDoc->nodes[node].firstChild; child != EXML_NONE; child = exmlDoc->nodes[child].next) {
+                if (exml_step_matches(step, child) && exml_nodeset_add(next, child)) return NULL;
+            }
+        }
+
+        current = next;
+    }
+
+    return current;
+}
 
 /**
- * Extract MBIN files from a PAK archive.
+ * Select the nodes of the current path of the EXML document for a modification block.
  *
- * @param destdir - The destination directory to extract the MBIN files to.
- * @param data - The InputPakFileData containing MBIN data.
- * @return 0 if extraction is successful, 1 otherwise.
+ * @param modification - The modification block, whose path is the current path.
+ * @return The selected nodes, or NULL if they can't be selected or aren't needed.
  *
- * This function extracts MBIN files from a PAK archive using PSAR utility.
- * It also compiles the extracted MBIN files to XML using MBINCompiler.
- * Finally, it stores the XML data in the MBINData structures.
+ * The same as select_block_nodes for the DOM; the paths are all native.
  */
-int get_input_files(const char *destdir, InputPakFileData *data) {
-    printf("open %s\n", data->inputPakFile);
+static ExmlNodeSet* exml_select_block_nodes(ModificationData* modification) {
+    const char* cd = modification->xpath;
+    int useCursor = exmlCursorValid && cd && cd[0] != '/';
+    exmlCursorValid = 0;
 
-    char ** argv = malloc( 6 * sizeof( char * ) );
-    size_t argc = 0;
+    ExmlNodeSet* nodes = NULL;
+    long depth = 0, valueDepth = NO_VALUE_DEPTH;
 
-    argv[argc++] = PSAR;
-    argv[argc++] = "-yxf";
-    argv[argc++] = data->inputPakFile;
-    argv[argc++] = "-t";
-    argv[argc++] = (char *) destdir;
-    argv[argc] = NULL;
+    CompiledPath* relative = useCursor ? compile_path(cd) : NULL;
+    if (relative && relative->literal) {
+        depth = exmlCursorDepth + relative->depth;
+        valueDepth = exmlCursorValueDepth;
+        if (relative->valueDepth != NO_VALUE_DEPTH && exmlCursorDepth + relative->valueDepth > valueDepth)
+            valueDepth = exmlCursorDepth + relative->valueDepth;
+        if (!modification->values && valueDepth > depth) return NULL;
 
-    argv = get_mbin_list(argv, &argc, data);
+        nodes = exml_walk_steps(&exmlCursorSet, relative->steps, relative->stepCount);
+    }
 
-    DISABLE_CONSOLE
+    if (!nodes) {
+        // Evaluate the whole path, from "/Data"
+        compiledPath = compile_path(resolvedPath);
+        xpath = compiledPath ? compiledPath->xpath : "";
+        if (!compiledPath || (!modification->values && !compiledPath->cursorSafe))
+            return NULL;
 
-    int result = spawnvp(P_WAIT, PSAR, argv);
+        ExmlNodeSet* root = &exmlWalkSets[0];
+        root->count = 0;
+        uint32_t data = exml_root(exmlDoc);
+        if (data != EXML_NONE && exmlDoc->nodes[data].name == EXML_NAME_DATA && exml_nodeset_add(root, data))
+            return NULL;
 
-    ENABLE_CONSOLE
+        nodes = exml_walk_steps(root, compiledPath->steps, compiledPath->stepCount);
+        depth = compiledPath->depth;
+        valueDepth = compiledPath->cursorSafe ? compiledPath->valueDepth : depth + 1;
+    }
 
-    free(argv);
-    if (result) {
-        fprintf(stderr, "Error extracting MBINs from file: %s\n", data->inputPakFile);
-        return 1;
+    if (nodes && valueDepth <= depth) {
+        if (nodes != &exmlCursorSet) {
+            ExmlNodeSet t = exmlCursorSet;
+            exmlCursorSet = *nodes;
+            *nodes = t;
+            nodes = &exmlCursorSet;
+        }
+        exmlCursorValid = 1;
+        exmlCursorDepth = depth;
+        exmlCursorValueDepth = valueDepth;
     }
+    return nodes;
+}
 
-    argv = malloc( 5 * sizeof( char * ) );
-    argc = 0;
-    argv[argc++] = MBINCompiler;
-    argv[argc++] = "-y";
-    argv[argc++] = "-q";
-    argv[argc++] = "--no-version";
-    argv[argc] = NULL;
+/**
+ * Patch the EXML document of an MBIN with the compact document model and save it.
+ *
+ * @param mbinData - The MBIN whose modifications are applied, loaded in mbinData->exmlData.
+ * @param filename - The EXML file to write.
+ * @return 0 on success, 1 if the modifications need the DOM; the file is then left untouched, -1 if
+ *         the document couldn't be patched or saved.
+ *
+ * The pairs of every block are applied in order with exml_set_item, which gives the same
+ * result as apply_modification on the DOM. Paths that aren't native nmsmc paths need the
+ * libxml2 XPath engine, so their documents are left to the DOM.
+ */
+static int exml_process_mbin(MBINData* mbinData, const char* filename) {
+    // Check the paths of the blocks first, as process_definitions resolves them
+    char* path = strdup(resolvedPath);
+    if (!path) return 1;
+    int native = 1;
+    for (ModificationData* m = mbinData->modifications; m && native; m = m->next) {
+        set_xpath(m->xpath);
+        CompiledPath* compiled = m->values ? compile_path(resolvedPath) : NULL;
+        if (m->values && (!compiled || !compiled->native)) native = 0;
+    }
+    strcpy(resolvedPath, path);
+    free(path);
+    if (!native) return 1;
 
-    argv = get_mbin_list(argv, &argc, data);
+    exmlDoc = mbinData->exmlData;
+    exmlCursorValid = 0;
 
-    // Build the MBINCompiler command to compile the MBIN file to XML
+    int error = 0;
+    for (ModificationData* m = mbinData->modifications; m && !error; m = m->next) {
+        set_xpath(m->xpath);
+        ExmlNodeSet* nodes = exml_select_block_nodes(m);
+        if (!m->values) continue;
+        if (!nodes) {
+            patch_printf(stdout, "XPath not found: [%s]\n", xpath);
+            continue;
+        }
 
-    char *current_dir = get_current_dir();
-    chdir(destdir);
+        for (size_t i = 0; i < nodes->count && !error; i++) {
+            for (NameValue* nv = m->values; nv; nv = nv->next) {
+                if (exml_set_item(exmlDoc, nodes->nodes[i], nv->name, nv->value)) {
+                    patch_printf(stderr, "Error: Memory allocation for the EXML document failed\n");
+                    error = 1;
+                    break;
+                }
+            }
+        }
+    }
 
-    DISABLE_CONSOLE
+    // Documents the modifications didn't change aren't saved, as their MBIN file is used as it is
+    mbinData->dirty = exmlDoc->changed;
+    if (!error && mbinData->dirty && exml_save(exmlDoc, filename)) {
+        patch_printf(stderr, "Error: Could not save %s\n", filename);
+        error = 1;
+    }
+    exmlDoc = NULL;
+    exmlCursorValid = 0;
+    return error ? -1 : 0;
+}
 
-    result = spawnvp(P_WAIT, MBINCompiler, argv);
+// Structure to store a modification block of a document being streamed
+typedef struct StreamBlock {
+    ModificationData* modification;
+    CompiledPath* path;
+    size_t prefixLength;    // steps matched while streaming, the root element being depth 0
+    int expand;             // the rest of the path has ".." steps and is walked on the subtree
+    size_t pairCount;
+} StreamBlock;
 
-    ENABLE_CONSOLE
+// Structure to store a Property node appended to an element while streaming
+typedef struct StreamAppend {
+    const char* name;
+    const char* value;
+    size_t block;           // block that appended the node
+} StreamAppend;
 
-    free(argv);
+// Structure to store an open element while streaming
+typedef struct StreamFrame {
+    const xmlChar* name;
+    int open;               // the start tag is not closed yet
+    size_t* active;         // blocks whose path goes on below the element, in order
+    size_t activeCount;
+    size_t* targets;        // blocks whose path selects the element, in order
+    size_t targetCount;
+    char* consumed;         // pairs of the target blocks already applied to a child
+    StreamAppend* appends;
+    size_t appendCount;
+    size_t appendCapacity;
+} StreamFrame;
 
-    if (result) {
-        chdir(current_dir);
-        free(current_dir);
+// Structure to store the state of a document being streamed
+typedef struct StreamState {
+    xmlTextReaderPtr reader;
+    xmlOutputBufferPtr out;
+    StreamBlock* blocks;
+    size_t blockCount;
+    StreamFrame* frames;
+    size_t frameCount;
+    size_t frameCapacity;
+    const xmlChar* encoding;
+    int started;            // the XML declaration was written
+} StreamState;
 
-        fprintf(stderr, "Error converting MBINs from EXML: %s\n", data->inputPakFile);
-        return 1;
+/**
+ * Write a string to the output, escaped the way libxml2 saves UTF-8 documents.
+ *
+ * @param out - The output buffer.
+ * @param text - The string to write.
+ * @param attribute - 1 to escape it as an attribute value, 0 as element content.
+ */
+static void stream_write_escaped(xmlOutputBufferPtr out, const xmlChar* text, int attribute) {
+    const xmlChar* start = text;
+    const xmlChar* p = text;
+    for (; *p; p++) {
+        const char* entity = NULL;
+        switch (*p) {
+            case '<': entity = "&lt;"; break;
+            case '>': entity = "&gt;"; break;
+            case '&': entity = "&amp;"; break;
+            case '\r': entity = "&#13;"; break;
+            case '"': if (attribute) entity = "&quot;"; break;
+            case '\n': if (attribute) entity = "&#10;"; break;
+            case '\t': if (attribute) entity = "&#9;"; break;
+        }
+        if (entity) {
+            xmlOutputBufferWrite(out, (int)(p - start), (const char*)start);
+            xmlOutputBufferWriteString(out, entity);
+            start = p + 1;
+        }
     }
+    xmlOutputBufferWrite(out, (int)(p - start), (const char*)start);
+}
 
-    // Temporary variables to store file names
-    char filename[MAX_PATH];
+/**
+ * Write an attribute to the output.
+ *
+ * @param out - The output buffer.
+ * @param name - The name of the attribute.
+ * @param value - The value of the attribute.
+ */
+static void stream_write_attr(xmlOutputBufferPtr out, const xmlChar* name, const xmlChar* value) {
+    xmlOutputBufferWriteString(out, " ");
+    xmlOutputBufferWriteString(out, (const char*)name);
+    xmlOutputBufferWriteString(out, "=\"");
+    stream_write_escaped(out, value, 1);
+    xmlOutputBufferWriteString(out, "\"");
+}
 
-    MBINData * mbinData = data->mbinData;
-    while( mbinData ) {
-        // Compile the MBIN file to XML
-        strcpy(filename, mbinData->mbinFile);
-        char* e = strstr(filename, ".MBIN");
-        if (e) strcpy(e, ".EXML");
-        mbinData->xmlData = xmlReadFile(filename, NULL, 0);
-        mbinData = mbinData->next;
-    }
+/**
+ * Write the XML declaration, before the first node of the document.
+ *
+ * @param state - The streaming state.
+ * @return 0 on success, 1 if the document can't be streamed.
+ *
+ * Only UTF-8 documents are streamed, so the output is the same libxml2 writes when saving
+ * the document.
+ */
+static int stream_start(StreamState* state) {
+    if (state->started) return 0;
 
-    chdir(current_dir);
-    free(current_dir);
+    const xmlChar* version = xmlTextReaderConstXmlVersion(state->reader);
+    state->encoding = xmlTextReaderConstEncoding(state->reader);
+    if (!state->encoding || xmlStrcasecmp(state->encoding, BAD_CAST "UTF-8")) return 1;
 
-    return 0; // Success in extracting MBIN files
+    xmlOutputBufferWriteString(state->out, "<?xml version=\"");
+    xmlOutputBufferWriteString(state->out, version ? (const char*)version : "1.0");
+    xmlOutputBufferWriteString(state->out, "\" encoding=\"");
+    xmlOutputBufferWriteString(state->out, (const char*)state->encoding);
+    xmlOutputBufferWriteString(state->out, "\"");
+    int standalone = xmlTextReaderStandalone(state->reader);
+    if (standalone == 0) xmlOutputBufferWriteString(state->out, " standalone=\"no\"");
+    if (standalone == 1) xmlOutputBufferWriteString(state->out, " standalone=\"yes\"");
+    xmlOutputBufferWriteString(state->out, "?>\n");
+
+    state->started = 1;
+    return 0;
 }
 
 /**
- * Add files to a PAK archive.
+ * Close the start tag of the innermost open element, before writing its content.
  *
- * @param sourcedir - The source directory containing files to add to the PAK archive.
- * @param pakData - The OutputPakFileData containing the PAK archive information.
- * @return 0 if adding files is successful, 1 otherwise.
+ * @param state - The streaming state.
+ */
+static void stream_close_start_tag(StreamState* state) {
+    if (!state->frameCount) return;
+    StreamFrame* frame = &state->frames[state->frameCount - 1];
+    if (frame->open) {
+        xmlOutputBufferWriteString(state->out, ">");
+        frame->open = 0;
+    }
+}
+
+/**
+ * Release the lists of a frame.
  *
- * This function adds files to a PAK archive using PSAR utility.
- * It also compiles XML files to MBIN using MBINCompiler.
- * Additionally, it handles adding extra files to the PAK archive.
+ * @param frame - The frame.
  */
-int save_pak(const char* sourcedir, OutputPakFileData * pakData) {
-    if ( pakData->totalMbinCount ) {
-        char ** argv = malloc( 4 * sizeof( char * ) );
-        size_t argc = 0;
+static void stream_free_frame(StreamFrame* frame) {
+    free(frame->active);
+    free(frame->targets);
+    free(frame->consumed);
+    free(frame->appends);
+}
 
-        argv[argc++] = MBINCompiler;
-        argv[argc++] = "-y";
-        argv[argc++] = "-q";
-        argv[argc] = NULL;
-        size_t argc_mbins = argc;
+/**
+ * Apply the blocks of the parent element to a child element, in block order.
+ *
+ * @param state - The streaming state.
+ * @param parent - The frame of the parent element, or NULL for the root element.
+ * @param node - The child element, with its attributes.
+ * @param depth - The depth of the child element.
+ * @param frame - The frame to fill with the blocks whose path reaches the child element.
+ * @param expand - Set to 1 if the subtree of the child element has to be expanded.
+ * @return 0 on success, 1 on memory allocation errors.
+ *
+ * For every block in order, the pairs of the block are applied to the child if the parent is
+ * selected by the block, and the step of the path is checked if the path goes on below the
+ * parent. Interleaving both gives every block the values left by the previous ones, as when
+ * the blocks are applied one after another to the whole document.
+ */
+static int stream_enter_element(StreamState* state, StreamFrame* parent, xmlNodePtr node, size_t depth, StreamFrame* frame, int* expand) {
+    size_t count = parent ? parent->activeCount + parent->targetCount : state->blockCount;
+    if (!count) return 0;
 
-        argv = get_complete_mbin_list(argv, &argc, pakData, 1);
+    frame->active = malloc(count * sizeof(size_t));
+    frame->targets = malloc(count * sizeof(size_t));
+    if (!frame->active || !frame->targets) return 1;
 
-        char *current_dir = get_current_dir();
-        chdir(sourcedir);
+    size_t a = 0, t = 0, pairOffset = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t b;
+        int selected;
 
-        freopen(DEVNULL, "w", stdout);
-        freopen(DEVNULL, "w", stderr);
+        if (!parent) {
+            // The root element is "/Data"
+            b = i;
+            selected = SAME_NAME(node->name, dataElement);
+        } else if (t < parent->targetCount && (a >= parent->activeCount || parent->targets[t] < parent->active[a])) {
+            // The parent is selected by the block: apply the pairs not applied to an earlier child
+            b = parent->targets[t++];
+            char* consumed = &parent->consumed[pairOffset];
+            pairOffset += state->blocks[b].pairCount;
 
-        int result = spawnvp(P_WAIT, MBINCompiler, argv);
+            size_t k = 0;
+            for (NameValue* nv = state->blocks[b].modification->values; nv; nv = nv->next, k++) {
+                if (consumed[k] || (!nv->name && !nv->value)) continue;
+                if (nv->name ? attr_equals(node, nameAttr, nv->name) : attr_equals(node, valueAttr, nv->value)) {
+                    set_property_value(node, nv->value);
+                    consumed[k] = 1;
+                }
+            }
+            continue;
+        } else {
+            // The path of the block goes on below the parent
+            b = parent->active[a++];
+            selected = step_matches(&state->blocks[b].path->steps[depth - 1], node);
+        }
 
-        freopen(DEVCONSOLE, "w", stdout);
-        freopen(DEVCONSOLE, "w", stderr);
+        if (!selected) continue;
 
-        char ** p = &argv[argc_mbins];
-        while (*p) {
-            free(*p);
-            p++;
+        StreamBlock* block = &state->blocks[b];
+        if (depth < block->prefixLength) {
+            frame->active[frame->activeCount++] = b;
+        } else {
+            frame->targets[frame->targetCount++] = b;
+            if (block->expand) *expand = 1;
         }
-        free(argv);
+    }
 
-        chdir(current_dir);
-        free(current_dir);
+    size_t pairs = 0;
+    for (size_t i = 0; i < frame->targetCount; i++) pairs += state->blocks[frame->targets[i]].pairCount;
+    if (!pairs) return 0;
 
-        if (result) {
-            fprintf(stderr, "Error compiling XML files to MBIN\n");
+    frame->consumed = calloc(pairs, 1);
+    return !frame->consumed;
+}
+
+/**
+ * Apply the blocks that reach an element to its expanded subtree, and write the subtree.
+ *
+ * @param state - The streaming state.
+ * @param frame - The blocks whose path reaches the element.
+ * @param node - The element, expanded with its whole subtree.
+ * @param depth - The depth of the element.
+ * @return 0 on success, 1 on errors.
+ *
+ * Paths with ".." steps need to look ahead of the current element, so the subtree of the
+ * shallowest element they come back to is expanded in memory; the blocks are then applied
+ * in order with the DOM walker, from that element.
+ */
+static int stream_expand_element(StreamState* state, StreamFrame* frame, xmlNodePtr node, size_t depth) {
+    // The reader goes on through the subtree it expanded, so the blocks are applied to a copy
+    node = xmlDocCopyNode(node, node->doc, 1);
+    if (!node) return 1;
+
+    xmlNodePtr start[1] = { node };
+    NodeSet startSet = { start, 1, 1 };
+
+    size_t a = 0, t = 0;
+    while (a < frame->activeCount || t < frame->targetCount) {
+        size_t b;
+        if (t < frame->targetCount && (a >= frame->activeCount || frame->targets[t] < frame->active[a]))
+            b = frame->targets[t++];
+        else
+            b = frame->active[a++];
+
+        CompiledPath* path = state->blocks[b].path;
+        NodeSet* nodes = walk_steps(&startSet, path->steps + depth, path->stepCount - depth);
+        if (!nodes) {
+            release_child_indexes();
+            xmlFreeNode(node);
             return 1;
         }
+        apply_modification(state->blocks[b].modification, nodes);
     }
+    release_child_indexes();
 
-    char ** argv = malloc( 6 * sizeof( char * ) );
-    size_t argc = 0;
+    // Attribute values are only written verbatim when the document has an encoding
+    const xmlChar* encoding = node->doc->encoding;
+    node->doc->encoding = state->encoding;
 
-    argv[argc++] = PSAR;
-    argv[argc++] = "-yrczf";
-    argv[argc++] = pakData->outputPakFile;
-    argv[argc++] = "-s";
-    argv[argc++] = (char *) sourcedir;
-    argv[argc] = NULL;
+    xmlBufferPtr buffer = xmlBufferCreate();
+    int error = !buffer || xmlNodeDump(buffer, node->doc, node, 0, 0) < 0;
+    if (!error) xmlOutputBufferWrite(state->out, xmlBufferLength(buffer), (const char*)xmlBufferContent(buffer));
+    xmlBufferFree(buffer);
 
-    argv = get_complete_mbin_list(argv, &argc, pakData, 0);
+    node->doc->encoding = encoding;
+    xmlFreeNode(node);
+    return error;
+}
 
-    if ( pakData->extraFileCount ) {
-        argv = realloc( argv, sizeof(char *) * ( argc + pakData->extraFileCount + 1 ) );
+/**
+ * Close an element: append the Property nodes of the pairs not applied to any child and
+ * write the end tag.
+ *
+ * @param state - The streaming state.
+ * @param depth - The depth of the element.
+ * @return 0 on success, 1 if the document can't be streamed.
+ *
+ * The appended nodes are matched by the later pairs, as they would be in the document. The
+ * document can't be streamed if a later block goes through an appended node.
+ */
+static int stream_leave_element(StreamState* state, size_t depth) {
+    StreamFrame* frame = &state->frames[state->frameCount - 1];
 
-        char tmpFilePath[MAX_PATH];
-        ExtraFile * extraFile = pakData->extraFileList;
-        while( extraFile ) {
-            printf("add %s\n", extraFile->filename);
-            snprintf(tmpFilePath, sizeof(tmpFilePath), "%s/%s", sourcedir, extraFile->filename);
-            if (!copy_file(extraFile->filename, tmpFilePath)) return 0;
+    size_t pairOffset = 0;
+    for (size_t t = 0; t < frame->targetCount; t++) {
+        size_t b = frame->targets[t];
+        char* consumed = &frame->consumed[pairOffset];
+        pairOffset += state->blocks[b].pairCount;
 
-            argv[argc++] = extraFile->filename;
-            extraFile = extraFile->next;
+        size_t k = 0;
+        for (NameValue* nv = state->blocks[b].modification->values; nv; nv = nv->next, k++) {
+            if (consumed[k] || (!nv->name && !nv->value)) continue;
+
+            StreamAppend* found = NULL;
+            for (size_t i = 0; i < frame->appendCount && !found; i++) {
+                StreamAppend* node = &frame->appends[i];
+                if (nv->name ? node->name && !strcmp(node->name, nv->name) : node->value && !strcmp(node->value, nv->value))
+                    found = node;
+            }
+            if (found) {
+                found->value = nv->value;
+                continue;
+            }
+
+            if (frame->appendCount == frame->appendCapacity) {
+                size_t capacity = frame->appendCapacity ? frame->appendCapacity * 2 : 8;
+                StreamAppend* appends = realloc(frame->appends, capacity * sizeof(StreamAppend));
+                if (!appends) return 1;
+                frame->appends = appends;
+                frame->appendCapacity = capacity;
+            }
+            frame->appends[frame->appendCount++] = (StreamAppend){ nv->name, nv->value, b };
+            documentChanged = 1;
         }
-        argv[argc] = NULL;
     }
 
-    printf("save %s\n\n", pakData->outputPakFile);
+    for (size_t i = 0; i < frame->appendCount; i++) {
+        StreamAppend* node = &frame->appends[i];
 
-    DISABLE_CONSOLE
+        // A later block whose path goes through the new node needs the whole document
+        for (size_t a = 0; a < frame->activeCount; a++) {
+            if (frame->active[a] < node->block) continue;
+            PathStep* step = &state->blocks[frame->active[a]].path->steps[depth];
+            if (step->type == STEP_ANY || !step->name || (node->name && !strcmp(step->name, node->name)))
+                return 1;
+        }
 
-    int result = spawnvp(P_WAIT, PSAR, argv);
+        stream_close_start_tag(state);
+        xmlOutputBufferWriteString(state->out, "<Property");
+        if (node->name) stream_write_attr(state->out, BAD_CAST "name", BAD_CAST node->name);
+        if (node->value) stream_write_attr(state->out, BAD_CAST "value", BAD_CAST node->value);
+        xmlOutputBufferWriteString(state->out, "/>");
+    }
 
-    ENABLE_CONSOLE
+    if (frame->open) {
+        xmlOutputBufferWriteString(state->out, "/>");
+    } else {
+        xmlOutputBufferWriteString(state->out, "</");
+        xmlOutputBufferWriteString(state->out, (const char*)frame->name);
+        xmlOutputBufferWriteString(state->out, ">");
+    }
+    if (!depth) xmlOutputBufferWriteString(state->out, "\n");
 
-    // Execute PSAR to compress the files
-    free(argv);
+    stream_free_frame(frame);
+    state->frameCount--;
+    return 0;
+}
 
-    if (result) {
-        fprintf(stderr, "Error creating PAK archive: %s\n", pakData->outputPakFile);
+/**
+ * Handle an element read from the document.
+ *
+ * @param state - The streaming state.
+ * @param depth - The depth of the element.
+ * @param expanded - Set to 1 if the element was expanded and written with its subtree.
+ * @return 0 on success, 1 if the document can't be streamed.
+ */
+static int stream_element(StreamState* state, size_t depth, int* expanded) {
+    xmlNodePtr node = xmlTextReaderCurrentNode(state->reader);
+    if (!node || node->ns || node->nsDef) return 1;
+    for (xmlAttrPtr attr = node->properties; attr; attr = attr->next) {
+        // Namespaces and entity references are left to the DOM
+        if (attr->ns || (attr->children && (attr->children->next || attr->children->type != XML_TEXT_NODE))) return 1;
+    }
+
+    if (!depth) set_document(node->doc);
+
+    if (state->frameCount == state->frameCapacity) {
+        size_t capacity = state->frameCapacity ? state->frameCapacity * 2 : 32;
+        StreamFrame* frames = realloc(state->frames, capacity * sizeof(StreamFrame));
+        if (!frames) return 1;
+        state->frames = frames;
+        state->frameCapacity = capacity;
+    }
+
+    StreamFrame* parent = state->frameCount ? &state->frames[state->frameCount - 1] : NULL;
+    StreamFrame* frame = &state->frames[state->frameCount];
+    memset(frame, 0, sizeof(StreamFrame));
+
+    int expand = 0;
+    if (stream_enter_element(state, parent, node, depth, frame, &expand)) {
+        stream_free_frame(frame);
         return 1;
     }
 
-    return 0; // Success in creating the PAK archive
+    stream_close_start_tag(state);
+
+    if (expand) {
+        *expanded = 1;
+        int error = !xmlTextReaderExpand(state->reader) || stream_expand_element(state, frame, node, depth);
+        stream_free_frame(frame);
+        if (!error && !depth) xmlOutputBufferWriteString(state->out, "\n");
+        return error;
+    }
+
+    xmlOutputBufferWriteString(state->out, "<");
+    xmlOutputBufferWriteString(state->out, (const char*)node->name);
+    for (xmlAttrPtr attr = node->properties; attr; attr = attr->next) {
+        const xmlChar* value = attr->children ? attr->children->content : NULL;
+        stream_write_attr(state->out, attr->name, value ? value : BAD_CAST "");
+    }
+
+    frame->name = node->name;
+    frame->open = 1;
+    state->frameCount++;
+
+    return xmlTextReaderIsEmptyElement(state->reader) ? stream_leave_element(state, depth) : 0;
 }
 
 /**
- * Set the XPath context for XML operations.
+ * Patch the document of an MBIN while streaming it from its EXML file.
  *
- * @param in - The input string defining the XPath context.
+ * @param mbinData - The MBIN whose modifications are applied.
+ * @param source - The EXML file to read.
+ * @param filename - The EXML file to write, which may be the same one.
+ * @return 0 on success, 1 if the document can't be streamed; the files are then left untouched.
  *
- * This function sets the XPath context for XML operations. It takes an input string
- * that defines the XPath context and constructs the appropriate XPath expression
- * based on the input.
+ * The document is read with a xmlTextReader and written as it is read, so only the open
+ * elements are kept in memory, plus the subtrees expanded for paths with ".." steps. The
+ * blocks are applied as they would be one after another on the whole document. Documents
+ * that are not UTF-8, paths that aren't absolute nmsmc paths, and blocks going through nodes
+ * appended by earlier blocks are left to the DOM.
  */
-void set_xpath(char* in) {
-    if (!in) {
-        xpath[0] = '\0';
-        return;
+static int stream_mbin(MBINData* mbinData, const char* source, const char* filename) {
+    StreamState state;
+    memset(&state, 0, sizeof(state));
+
+    size_t count = 0;
+    for (ModificationData* m = mbinData->modifications; m; m = m->next) count++;
+
+    int error = 0;
+    if (count && !(state.blocks = malloc(count * sizeof(StreamBlock)))) error = 1;
+
+    // Resolve the paths of the blocks, as process_definitions does
+    for (ModificationData* m = mbinData->modifications; m && !error; m = m->next) {
+        set_xpath(m->xpath);
+        if (!m->values) continue;
+
+        CompiledPath* path = compile_path(resolvedPath);
+        if (!path || !path->native) {
+            error = 1;
+            break;
+        }
+
+        StreamBlock* block = &state.blocks[state.blockCount++];
+        block->modification = m;
+        block->path = path;
+        block->prefixLength = path->stepCount;
+        block->expand = 0;
+        block->pairCount = 0;
+        for (NameValue* nv = m->values; nv; nv = nv->next) block->pairCount++;
+
+        // Paths with ".." steps are walked from the shallowest element they come back to
+        long depth = 0, minDepth = 0;
+        for (size_t s = 0; s < path->stepCount; s++) {
+            depth += path->steps[s].type == STEP_PARENT ? -1 : 1;
+            if (path->steps[s].type == STEP_PARENT && (!block->expand || depth < minDepth)) {
+                block->expand = 1;
+                minDepth = depth;
+            }
+        }
+        if (block->expand) {
+            if (minDepth < 0) error = 1;
+            block->prefixLength = (size_t)minDepth;
+        }
     }
 
-    char* newxpath;
-    if (in[0] == '/') {
-        strcpy(xpath, "/Data");
-        if (in[1])
-            strcat(xpath, "/");
-    } else {
-        if (xpath[0])
-            strcat(xpath, "/");
+    // A truncated name would write over another file, so such documents are left to the DOM
+    char outname[MAX_PATH];
+    if (snprintf(outname, sizeof(outname), "%s.stream", filename) >= (int) sizeof(outname)) error = 1;
+
+    if (!error) {
+        state.reader = xmlReaderForFile(source, NULL, 0);
+        state.out = state.reader ? xmlOutputBufferCreateFilename(outname, NULL, 0) : NULL;
+        error = !state.out;
     }
 
-    newxpath = &xpath[strlen(xpath)];
+    int ret = error ? -1 : xmlTextReaderRead(state.reader);
+    while (ret == 1 && !error && !(error = stream_start(&state))) {
+        size_t depth = (size_t)xmlTextReaderDepth(state.reader);
+        const xmlChar* value = xmlTextReaderConstValue(state.reader);
+        int expanded = 0;
 
-    char* token = strtok(in, "/");
-    while (token) {
-        char* p;
-        if (token[0] == '*') {
-            strcat(newxpath, "*");
-        } else if (strcmp(token, "..") == 0) {
-            strcat(newxpath, "..");
-        } else if ((p = strstr(token, "="))) {
-            char d = '\0';
-            if (p > token && p[-1] == '[') {
-                d = '[';
-                p[-1] = '\0';
-            }
-            p[0] = '\0';
-            p++;
-            strcat(newxpath, "Property[");
-            if (token[0] && token[0] != '*') {
-                strcat(newxpath, "@name='");
-                strcat(newxpath, token);
-                strcat(newxpath, "' and ");
-            }
-            char* p1 = NULL;
-            if (d == '[') {
-                p1 = strchr(p, ']');
-                if (!p1) {
-                    printf("error, missing ]\n");
-                    exit(EXIT_FAILURE);
+        switch (xmlTextReaderNodeType(state.reader)) {
+            case XML_READER_TYPE_ELEMENT:
+                error = stream_element(&state, depth, &expanded);
+                break;
+
+            case XML_READER_TYPE_END_ELEMENT:
+                error = stream_leave_element(&state, depth);
+                break;
+
+            case XML_READER_TYPE_TEXT:
+            case XML_READER_TYPE_WHITESPACE:
+            case XML_READER_TYPE_SIGNIFICANT_WHITESPACE:
+                stream_close_start_tag(&state);
+                stream_write_escaped(state.out, value ? value : BAD_CAST "", 0);
+                break;
+
+            case XML_READER_TYPE_CDATA:
+                stream_close_start_tag(&state);
+                xmlOutputBufferWriteString(state.out, "<![CDATA[");
+                xmlOutputBufferWriteString(state.out, value ? (const char*)value : "");
+                xmlOutputBufferWriteString(state.out, "]]>");
+                break;
+
+            case XML_READER_TYPE_COMMENT:
+                stream_close_start_tag(&state);
+                xmlOutputBufferWriteString(state.out, "<!--");
+                xmlOutputBufferWriteString(state.out, value ? (const char*)value : "");
+                xmlOutputBufferWriteString(state.out, depth ? "-->" : "-->\n");
+                break;
+
+            case XML_READER_TYPE_PROCESSING_INSTRUCTION:
+                stream_close_start_tag(&state);
+                xmlOutputBufferWriteString(state.out, "<?");
+                xmlOutputBufferWriteString(state.out, (const char*)xmlTextReaderConstName(state.reader));
+                if (value && *value) {
+                    xmlOutputBufferWriteString(state.out, " ");
+                    xmlOutputBufferWriteString(state.out, (const char*)value);
                 }
-                p1[0] = '\0';
-            }
-            strcat(newxpath, "@value='");
-            strcat(newxpath, p);
-            strcat(newxpath, "']");
-            if (p1 && p1[1] != '\0') {
-                printf("error, extra data after ]\n");
-                exit(EXIT_FAILURE);
-            }
-        } else {
-            strcat(newxpath, "Property[@name='");
-            strcat(newxpath, token);
-            strcat(newxpath, "']");
+                xmlOutputBufferWriteString(state.out, depth ? "?>" : "?>\n");
+                break;
+
+            default:
+                // Document types and entity references are left to the DOM
+                error = 1;
+                break;
         }
 
-        token = strtok(NULL, "/");
-        if (token)
-            strcat(newxpath, "/");
+        if (!error) ret = expanded ? xmlTextReaderNext(state.reader) : xmlTextReaderRead(state.reader);
     }
+    if (ret != 0 || state.frameCount) error = 1;
+
+    while (state.frameCount) stream_free_frame(&state.frames[--state.frameCount]);
+    free(state.frames);
+    free(state.blocks);
+    release_child_indexes();
+    set_document(NULL);
+
+    if (state.reader) xmlFreeTextReader(state.reader);
+    if (state.out && xmlOutputBufferClose(state.out) < 0) error = 1;
+
+    if (!error) error = replace_file(outname, filename) != 0;
+    if (error && state.out) remove(outname);
+    return error;
 }
 
 /**
- * Set the value of an item in the XML document using XPath.
+ * Write the snapshot of a compact EXML document, for cache_write().
  *
- * @param name - The name of the item.
- * @param value - The value to set for the item.
+ * @param data - The document.
+ * @param path - The path of the file to write.
+ * @return 0 on success, 1 on error.
+ */
+static int write_snapshot(void* data, const char* path) {
+    return exml_save_snapshot(data, path);
+}
+
+/**
+ * Load the compact EXML document of an MBIN from its snapshot in the cache, or from its EXML file
+ * and then save its snapshot.
  *
- * This function sets the value of an item in the XML document using XPath. It takes
- * the name and value of the item and updates the XML document accordingly. If the
- * item does not exist, it creates a new node and sets its value.
+ * @param mbinData - The MBIN whose document is loaded.
+ * @param filename - The path of the EXML file.
+ * @return The document, or NULL if the file isn't in the subset of the compact model or on error.
+ *
+ * The snapshot is named after the XML file in the cache directory of its input PAK file, so it
+ * is kept apart by the same identity of the PAK file and MBINCompiler as the XML file; its size
+ * must match too.
  */
-void set_item(char* name, char* value) {
-    if (!name && !value)
-        return;
+static ExmlDocument* load_compact_document(MBINData* mbinData, const char* filename) {
+    char name[MAX_PATH];
+    char snapshot[MAX_PATH];
+    struct stat st;
+    if (!snapshotDir || stat(filename, &st)) return exml_load(filename);
+
+    // Names that don't fit would load or save the snapshot of another document
+    if (get_exml_name(mbinData->mbinFile, name, sizeof(name) - strlen(".snapshot"))) return exml_load(filename);
+    strcat(name, ".snapshot");
+    if (snprintf(snapshot, sizeof(snapshot), "%s/%s", snapshotDir, name) >= (int) sizeof(snapshot)) return exml_load(filename);
+
+    ExmlDocument* doc = exml_load_snapshot(snapshot, (uint64_t) st.st_size);
+    if (doc) return doc;
+
+    doc = exml_load(filename);
+    if (doc) cache_write(snapshotDir, name, write_snapshot, doc);
+    return doc;
+}
+
+/**
+ * Load the EXML file of an MBIN, just before its modifications are applied.
+ *
+ * @param mbinData - The MBIN whose document is loaded.
+ * @param filename - The path of the EXML file.
+ * @param compact - 1 to try the compact model first, 0 to load the file with libxml2.
+ * @return 0 on success, 1 if the file can't be loaded.
+ *
+ * Documents inside the subset of the compact model are loaded in mbinData->exmlData, from their
+ * snapshot when the cache has it, and the others in mbinData->xmlData, through a parser context
+ * shared by all of them. With --max-resident, the calling thread waits until fewer documents than
+ * the limit are loaded by all the patch threads, so that at most that many are in memory at once.
+ */
+static int load_document(MBINData* mbinData, const char* filename, int compact) {
+    if (residentLimit) {
+        mutex_lock(&residentMutex);
+        while (residentCount >= residentLimit) condition_wait(&residentCondition, &residentMutex, PIPELINE_POLL_INTERVAL);
+        residentCount++;
+        mutex_unlock(&residentMutex);
+    }
+
+    if (compact) mbinData->exmlData = load_compact_document(mbinData, filename);
+    if (!mbinData->exmlData) {
+        if (!parserContext) parserContext = xmlNewParserCtxt();
+        if (parserContext) mbinData->xmlData = xmlCtxtReadFile(parserContext, filename, NULL, XML_LOAD_OPTIONS);
+    }
+    if (!mbinData->exmlData && !mbinData->xmlData) {
+        patch_printf(stderr, "Error loading XML file: %s\n", filename);
+        release_resident();
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Give back the place of a document in the --max-resident budget, waking up the patch threads
+ * waiting for one.
+ */
+static void release_resident(void) {
+    if (!residentLimit) return;
+    mutex_lock(&residentMutex);
+    residentCount--;
+    condition_broadcast(&residentCondition);
+    mutex_unlock(&residentMutex);
+}
+
+/**
+ * Release the document of an MBIN, if it is loaded.
+ *
+ * @param mbinData - The MBIN whose document is released.
+ */
+static void release_document(MBINData* mbinData) {
+    if (!mbinData->exmlData && !mbinData->xmlData) return;
+    exml_free(mbinData->exmlData);
+    if (mbinData->xmlData) xmlFreeDoc(mbinData->xmlData);
+    mbinData->exmlData = NULL;
+    mbinData->xmlData = NULL;
+    release_resident();
+}
+
+/**
+ * Apply the modifications of an MBIN to its EXML file.
+ *
+ * @param mbinData - The MBIN whose modifications are applied.
+ * @param source - The EXML file to read.
+ * @param filename - The EXML file the patched document is saved to, which may be the same one.
+ * @return 0 if the document was patched, 1 if the file couldn't be loaded, patched or saved.
+ *
+ * The document is loaded just before it is patched and released as soon as it is saved. The MBIN is marked dirty if its modifications changed
+ * the document; documents that didn't change aren't saved, unless they were streamed.
+ */
+static int patch_mbin(MBINData* mbinData, const char* source, const char* filename) {
+    patch_printf(stdout, "process %s\n", mbinData->mbinFile);
+    mbinData->dirty = 0;
+    documentChanged = 0;
 
-    // Initialize XPath context
-    xmlXPathContextPtr context = xmlXPathNewContext(doc);
-    if (context == NULL) {
-        fprintf(stderr, "Error creating XPath context.\n");
-        xmlFreeDoc(doc);
+    if ( streamMode ) {
+        // Patch the EXML file while reading it, or load it if it can't be streamed
+        char *path = strdup(resolvedPath);
+        if ( path && !stream_mbin(mbinData, source, filename) ) {
+            free(path);
+            mbinData->dirty = documentChanged;
+            return 0;
+        }
+        if ( path ) {
+            strcpy(resolvedPath, path);
+            free(path);
+        }
+        documentChanged = 0;
+        if ( load_document(mbinData, source, 0) ) return 1;
+    } else {
+        // Documents outside of the subset of the compact model are loaded with libxml2
+        if ( load_document(mbinData, source, 1) ) return 1;
+        if ( mbinData->exmlData ) {
+            // Patch the compact EXML document, or load the DOM if the paths need it
+            int result = exml_process_mbin(mbinData, filename);
+            release_document(mbinData);
+            if ( result <= 0 ) return result ? 1 : 0;
+            if ( load_document(mbinData, source, 0) ) return 1;
+        }
+    }
+
+    // Iterate through modifications for each MBIN file
+    ModificationData * modification = mbinData->modifications;
+    set_document(mbinData->xmlData);
+    while( modification ) {
+        // Set the XPath context for modification
+        set_xpath(modification->xpath);
+
+        // Apply the name-value pairs of the modification
+        apply_modification(modification, select_block_nodes(modification));
+        modification = modification->next;
+    }
+    release_child_indexes();
+
+    // Save the modified XML file, with libxml2 if the document has more than EXML
+    mbinData->dirty = documentChanged;
+    int error = 0;
+    if ( mbinData->dirty && exml_save_dom(mbinData->xmlData, filename) && xmlSaveFormatFile(filename, mbinData->xmlData, 0) < 0 ) {
+        patch_printf(stderr, "Error: Could not save %s\n", filename);
+        error = 1;
+    }
+    set_document(NULL);
+    release_document(mbinData);
+    return error;
+}
+
+/**
+ * Take the compiled MBIN file of a patched XML file from the cache, if it is there.
+ *
+ * @param job - The input PAK file.
+ * @param compiled - The CompiledFile of the MBIN file.
+ * @param mbinFile - The path of the MBIN file.
+ * @param filename - The patched XML file.
+ *
+ * The MBIN file is copied to the working directory, where MBINCompiler would have written it. The
+ * name of the file in the cache is kept either way, to add it once it is compiled.
+ */
+static void fetch_compiled(InputJob* job, CompiledFile* compiled, const char* mbinFile, const char* filename) {
+    if (cache_compiled_name(filename, compiled->name, sizeof(compiled->name))) {
+        compiled->name[0] = '\0';
         return;
     }
+    if (!cache_has(cache_compiled_dir(), compiled->name)) return;
 
-    // Evaluate the XPath expression
-    xmlXPathObjectPtr result = xmlXPathEvalExpression(BAD_CAST xpath, context);
-    if (result != NULL) {
-        // The XPath exists in the XML document or has been created
-        // If it doesn't exist, create a new node and set its value
-        if (result->nodesetval) {
-            char* search_attr = NULL;
-            char* search_value = NULL;
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s/%s", job->data->workDir, mbinFile);
+    compiled->cached = !cache_fetch(cache_compiled_dir(), compiled->name, path);
+}
 
-            if (name) {
-                search_attr = "name";
-                search_value = name;
-            } else {
-                search_attr = "value";
-                search_value = value;
-            }
-
-            for (int i = 0; i < result->nodesetval->nodeNr; i++) {
-                xmlNodePtr node = result->nodesetval->nodeTab[i];
-                xmlNodePtr child = node->children;
-                int found = 0;
-                while (child) {
-                    // Search for the "value" attribute
-                    xmlChar* attr = xmlGetProp(child, BAD_CAST search_attr);
-                    if (attr) {
-                        if (!xmlStrcmp(attr, BAD_CAST search_value)) {
-                            xmlAttrPtr attrValue = xmlHasProp(child, BAD_CAST "value");
-                            if (attrValue) {
-                                // Update the content of the "value" attribute
-                                xmlNodeSetContent(attrValue->children, BAD_CAST value);
-                            } else {
-                                // The "value" attribute does not exist, create a new attribute and set its value
-                                xmlNewProp(child, BAD_CAST "value", BAD_CAST value);
-                            }
-                            xmlFree(attr);
-                            found = 1;
-                            break;
-                        }
-                        xmlFree(attr);
-                    }
-                    child = child->next;
-                }
-                if (!found) {
-                    // Create a new node at the specified XPath location
-                    xmlNodePtr newNode = xmlNewNode(NULL, BAD_CAST "Property");
-                    if (name)
-                        xmlNewProp(newNode, BAD_CAST "name", BAD_CAST name);
-                    if (value)
-                        xmlNewProp(newNode, BAD_CAST "value", BAD_CAST value);
-                    xmlAddChild(node, newNode);
+/**
+ * Patch the MBIN files of an input PAK file, in its patch thread.
+ *
+ * @param arg - The InputJob of the input PAK file.
+ *
+ * Each MBIN file starts from the current path computed by pipeline_init(). The XML files the cache
+ * has are read from it, and saved patched to the working directory, and the others are added to
+ * it before they are patched, and their MBIN files after. The files the modifications didn't change
+ * keep their extracted MBIN file and are reported, and the patched files that were compiled before
+ * get their MBIN file from the cache. The progress is reported to the pipeline after every file,
+ * so that it can be compiled at once. A file that can't be loaded, patched or saved stops the
+ * thread with job->failed set, so that its output PAK file isn't packed.
+ */
+static void patch_input(void* arg) {
+    InputJob* job = arg;
+    Pipeline* pipeline = job->pipeline;
+    patchLog = &job->log;
+    snapshotDir = job->cacheExmlDir;
+
+    // Reported here rather than when it is extracted, so that it comes before its own messages
+    patch_printf(stdout, "open %s\n", job->data->inputPakFile);
+
+    size_t n = 0;
+    for (MBINData* mbinData = job->data->mbinData; mbinData; mbinData = mbinData->next) {
+        char exml[MAX_PATH];
+        char filename[MAX_PATH];
+        char source[MAX_PATH];
+        char mbin[MAX_PATH];
+        get_exml_name(mbinData->mbinFile, exml, sizeof(exml));
+        if (snprintf(filename, sizeof(filename), "%s/%s", job->data->workDir, exml) >= (int) sizeof(filename) ||
+            snprintf(mbin, sizeof(mbin), "%s/%s", job->data->workDir, mbinData->mbinFile) >= (int) sizeof(mbin)) {
+            patch_printf(stderr, "Error: path too long: %s/%s\n", job->data->workDir, mbinData->mbinFile);
+            job->failed = 1;
+            break;
+        }
+        strcpy(source, filename);
+
+        int cached = job->cached && job->cached[n] == CACHED_EXML;
+        if (cached) {
+            if (snprintf(source, sizeof(source), "%s/%s", job->cacheExmlDir, exml) >= (int) sizeof(source)) {
+                patch_printf(stderr, "Error: path too long: %s/%s\n", job->cacheExmlDir, exml);
+                job->failed = 1;
+                break;
+            }
+
+            // Create the subdirectories of the file, as it wasn't extracted
+            mkpath_parent(filename, 0755);
+        } else if (job->cached) {
+            cache_store(filename, job->cacheExmlDir, exml, 0);
+        }
+
+        // A document that can't be patched fails its input PAK file, rather than being packed as it is
+        strcpy(resolvedPath, job->startPaths[n]);
+        if (patch_mbin(mbinData, source, filename)) {
+            job->failed = 1;
+            break;
+        }
+
+        // The MBIN files of the documents that didn't change are packed as they were extracted;
+        // those only the cache has are compiled from their XML file if needed
+        if (!mbinData->dirty) {
+            patch_printf(stdout, "unchanged %s\n", mbinData->mbinFile);
+            if (cached && cache_fetch(job->cacheDir, mbinData->mbinFile, mbin)) {
+                mbinData->dirty = 1;
+                if (cache_fetch(job->cacheExmlDir, exml, filename)) {
+                    patch_printf(stderr, "Error copying file from the cache: %s\n", exml);
+                    job->failed = 1;
+                    break;
                 }
             }
         }
-    } else {
-        printf("XPath not found: [%s]\n", xpath);
+
+        // The MBIN file is replaced when its XML file is compiled, so it is moved rather than copied
+        if (job->cached && job->cached[n] == CACHED_NONE) cache_store(mbin, job->cacheDir, mbinData->mbinFile, mbinData->dirty);
+        if (mbinData->dirty && job->compiled) fetch_compiled(job, &job->compiled[n], mbinData->mbinFile, filename);
+        n++;
+
+        mutex_lock(&pipeline->mutex);
+        job->patched = n;
+        pipeline->signaled = 1;
+        condition_broadcast(&pipeline->condition);
+        mutex_unlock(&pipeline->mutex);
     }
 
-    xmlXPathFreeObject(result);
-    xmlXPathFreeContext(context);
-}
+    release_patch_state();
+    patchLog = NULL;
+    snapshotDir = NULL;
 
+    mutex_lock(&pipeline->mutex);
+    job->finished = 1;
+    pipeline->signaled = 1;
+    condition_broadcast(&pipeline->condition);
+    mutex_unlock(&pipeline->mutex);
+}
 
 /**
  * Process definitions and modify XML files within PAK archives.
@@ -872,55 +4329,27 @@ void set_item(char* name, char* value) {
  * @param outputPakFileList - The list of OutputPakFileData structures to process.
  * @return 0 on success, 1 on failure.
  *
- * This function processes definitions and modifies XML files within PAK archives. It iterates
- * through the provided list of OutputPakFileData structures, extracts MBIN files, applies
- * modifications specified in the XML data, and saves the modified files back to the archive.
+ * This function processes definitions and modifies XML files within PAK archives. Up to --jobs
+ * psar and MBINCompiler processes run as a pipeline: the input PAK files are extracted and
+ * decompiled, each one is patched by its own thread as soon as it is ready, with up to --jobs
+ * threads at once, every patched XML file is queued to be compiled back to MBIN as soon as it is
+ * saved, and each output PAK archive is packed once all its MBIN files are compiled. Independent
+ * output PAK archives are thus built at the same time, each one in its own directories. The MBIN
+ * and XML files found in the cache are not extracted or decompiled again.
  */
 int process_definitions(OutputPakFileData * outputPakFileList) {
-    // Iterate through the list of OutputPakFileData structures
-    OutputPakFileData * outputPakFile = outputPakFileList;
-    while( outputPakFile ) {
-        // Iterate through the input PAK files within each OutputPakFileData
-        InputPakFileData * inputPakFile = outputPakFile->inputPakFileList;
-        while( inputPakFile ) {
-            // Extract MBIN files from the input PAK file
-            if ( get_input_files(tmpdir, inputPakFile) ) return 1;
-            
-            // Iterate through the MBIN files
-            MBINData * mbinData = inputPakFile->mbinData;
-            while( mbinData ) {
-                // Iterate through modifications for each MBIN file
-                ModificationData * modification = mbinData->modifications;
-                doc = mbinData->xmlData;
-                printf("process %s\n", mbinData->mbinFile);
-                while( modification ) {
-                    // Set the XPath context for modification
-                    set_xpath(modification->xpath);
-                    
-                    // Iterate through name-value pairs for the modification
-                    NameValue * namevalue = modification->values;
-                    while( namevalue ) {
-                        // Set the value of an item in the XML document using XPath
-                        set_item(namevalue->name, namevalue->value);
-                        namevalue = namevalue->next;
-                    }
-                    modification = modification->next;
-                }
-                // Save the modified XML file
-                char filename[MAX_PATH];
-                sprintf(filename, "%s/%s", tmpdir, mbinData->mbinFile);
-                char *e = strstr(filename, ".MBIN");
-                if ( e ) strcpy( e, ".EXML");
-                xmlSaveFormatFile(filename, mbinData->xmlData, 0);
-                mbinData = mbinData->next;
-            }
-            inputPakFile = inputPakFile->next;
-        }
+    Pipeline pipeline;
+    if ( pipeline_init(&pipeline, outputPakFileList) ) {
+        pipeline_free(&pipeline);
+        return 1;
+    }
 
-        // Save the modified PAK archive
-        if ( save_pak(tmpdir, outputPakFile)) return 1;
+    pipeline_run(&pipeline);
 
-        outputPakFile = outputPakFile->next;
-    }
-    return 0; // Success
+    // Print the messages of the input PAK files patched after one that wasn't, after an error
+    for (size_t i = pipeline.nextLog; i < pipeline.inputCount; i++) print_patch_log(&pipeline.inputs[i].log);
+
+    int error = pipeline.error;
+    pipeline_free(&pipeline);
+    return error; // Success
 }
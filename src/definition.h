@@ -37,6 +37,9 @@
 #ifndef __DEFINITION_H
 #define __DEFINITION_H
 
+#include "hashtable.h"
+#include "exml.h"
+
 // Structure to store name-value pairs
 typedef struct NameValue {
     char* name;
@@ -58,6 +61,8 @@ typedef struct MBINData {
     ModificationData * modifications;
     ModificationData * lastModifications;
     xmlDocPtr xmlData;
+    ExmlDocument * exmlData;
+    int dirty;                  // set once patched if its modifications changed its document
     struct MBINData * next;
 } MBINData;
 
@@ -67,6 +72,8 @@ typedef struct InputPakFileData {
     MBINData * mbinData;
     size_t mbinCount;
     MBINData * lastMbinData;
+    HashTable mbinIndex;
+    char* workDir;              // directory the MBIN files are extracted to
     struct InputPakFileData * next;
 } InputPakFileData;
 
@@ -81,6 +88,7 @@ typedef struct OutputPakFileData {
     char* outputPakFile;
     InputPakFileData * inputPakFileList;
     InputPakFileData * lastInputPakFileList;
+    HashTable inputPakIndex;
     size_t totalMbinCount;
     ExtraFile * extraFileList;
     size_t extraFileCount;
@@ -89,6 +97,8 @@ typedef struct OutputPakFileData {
 
 // Function declarations
 OutputPakFileData* parse_definition(const char* filename, OutputPakFileData* ouputPakFileDataList);
+OutputPakFileData* load_definition_cache(const char* filename);
+int save_definition_cache(const char* filename, OutputPakFileData* outputPakFileList);
 int process_definitions(OutputPakFileData * outputPakFileList);
 void definition_cleanup(OutputPakFileData* outputPakFileList);
 
@@ -0,0 +1,1687 @@
+/**
+ * @file exml.c
+ * @brief Implementation of the compact EXML document model for the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * This source file provides the parser, the serializer and the Property operations of the flat EXML
+ * document model. Documents are parsed in place: entity references are decoded inside the loaded
+ * buffer and attribute values are null-terminated there, so loading a file takes a few allocations
+ * instead of several per node.
+ *
+ * This file is part of the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 Juan José Ponteprino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author Juan José Ponteprino
+ * @date October 2023
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "exml.h"
+
+/**
+ * Number of lookups on the children of a node before they get indexed.
+ */
+#define EXML_INDEX_QUERIES          4
+
+/**
+ * Minimum number of element children of a node for them to be indexed.
+ */
+#define EXML_INDEX_MIN_CHILDREN     32
+
+/**
+ * Number of interned names searched linearly before using the name table.
+ */
+#define EXML_LINEAR_NAMES           16
+
+/**
+ * Size of the output buffer of the serializer.
+ */
+#define EXML_WRITE_BUFFER_SIZE      65536
+
+// Structure to store a table of a child index
+typedef struct ExmlChildTable {
+    HashTable table;        // attribute value -> first child with that value + 1
+    unsigned misses;        // lookups done by scanning since the table was last valid
+    int built;              // the table is up to date
+} ExmlChildTable;
+
+// Structure to store the lookup state and index of the children of a node
+typedef struct ExmlChildIndex {
+    int wide;               // 1 if the node has enough children to be indexed, 0 if not, -1 if unknown
+    ExmlChildTable byName;  // keyed by the "name" attribute
+    ExmlChildTable byValue; // keyed by the "value" attribute
+} ExmlChildIndex;
+
+// Structure to store the state of the parser
+typedef struct ExmlParser {
+    ExmlDocument * doc;
+    char * p;               // next character to parse
+} ExmlParser;
+
+// Structure to store the state of the serializer
+typedef struct ExmlWriter {
+    FILE * file;
+    size_t used;
+    int error;
+    char buffer[EXML_WRITE_BUFFER_SIZE];
+} ExmlWriter;
+
+#define IS_BLANK(c)         ((c) == ' ' || (c) == '\t' || (c) == '\n')
+#define IS_NAME_START(c)    (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z') || (c) == '_' || (unsigned char)(c) >= 0x80)
+#define IS_NAME_CHAR(c)     (IS_NAME_START(c) || ((c) >= '0' && (c) <= '9') || (c) == '-' || (c) == '.')
+
+/*
+ * Vector operations used to scan the markup a block of bytes at a time. AVX2 is used when the
+ * compiler targets it, SSE2 on every other x86 target, and plain loops elsewhere.
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define EXML_VECTOR_SIZE    32
+typedef __m256i ExmlVector;
+#define exml_vload(p)       _mm256_loadu_si256((const __m256i*)(p))
+#define exml_vset(c)        _mm256_set1_epi8((char)(c))
+#define exml_veq(a, b)      _mm256_cmpeq_epi8((a), (b))
+#define exml_vlt(a, b)      _mm256_cmpgt_epi8((b), (a))
+#define exml_vor(a, b)      _mm256_or_si256((a), (b))
+#define exml_vandnot(a, b)  _mm256_andnot_si256((a), (b))
+#define exml_vmask(v)       ((uint32_t)_mm256_movemask_epi8(v))
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define EXML_VECTOR_SIZE    16
+typedef __m128i ExmlVector;
+#define exml_vload(p)       _mm_loadu_si128((const __m128i*)(p))
+#define exml_vset(c)        _mm_set1_epi8((char)(c))
+#define exml_veq(a, b)      _mm_cmpeq_epi8((a), (b))
+#define exml_vlt(a, b)      _mm_cmplt_epi8((a), (b))
+#define exml_vor(a, b)      _mm_or_si128((a), (b))
+#define exml_vandnot(a, b)  _mm_andnot_si128((a), (b))
+#define exml_vmask(v)       ((uint32_t)_mm_movemask_epi8(v))
+#endif
+
+#ifdef EXML_VECTOR_SIZE
+#ifdef _MSC_VER
+#include <intrin.h>
+static unsigned exml_first_bit(uint32_t mask) {
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+}
+#else
+#define exml_first_bit(mask)    ((unsigned)__builtin_ctz(mask))
+#endif
+#endif
+
+/**
+ * Bytes allocated after the terminator of a loaded file, so that the parser can load whole
+ * vectors up to it.
+ */
+#define EXML_BUFFER_PADDING 32
+
+/**
+ * Skip the bytes of a run that the parser copies without looking at them.
+ *
+ * The run ends at the first delimiter, byte above 0x7f or control character, including the
+ * terminator of the buffer. Tabs and line feeds only end it when blanks are not allowed.
+ *
+ * @param p         The start of the run, in a loaded buffer.
+ * @param d1        A delimiter. Pass the same one several times to use fewer.
+ * @param d2        A delimiter.
+ * @param d3        A delimiter.
+ * @param d4        A delimiter.
+ * @param blanks    1 if tabs and line feeds belong to the run.
+ *
+ * @return          The end of the run.
+ */
+static char* exml_skip_plain(char* p, char d1, char d2, char d3, char d4, int blanks) {
+#ifdef EXML_VECTOR_SIZE
+    // The buffer is padded past its terminator, which ends every run
+    const ExmlVector space = exml_vset(0x20);
+    const ExmlVector v1 = exml_vset(d1), v2 = exml_vset(d2), v3 = exml_vset(d3), v4 = exml_vset(d4);
+    const ExmlVector tab = exml_vset('\t'), lf = exml_vset('\n');
+    for (;;) {
+        ExmlVector v = exml_vload(p);
+        // Signed comparison: bytes above 0x7f are negative
+        ExmlVector special = exml_vlt(v, space);
+        if (blanks) special = exml_vandnot(exml_vor(exml_veq(v, tab), exml_veq(v, lf)), special);
+        special = exml_vor(special, exml_vor(exml_vor(exml_veq(v, v1), exml_veq(v, v2)),
+                                             exml_vor(exml_veq(v, v3), exml_veq(v, v4))));
+        uint32_t mask = exml_vmask(special);
+        if (mask) return p + exml_first_bit(mask);
+        p += EXML_VECTOR_SIZE;
+    }
+#else
+    for (;; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c < 0x20) {
+            if (!blanks || (c != '\t' && c != '\n')) return p;
+        } else if (c >= 0x80 || c == (unsigned char)d1 || c == (unsigned char)d2 ||
+                   c == (unsigned char)d3 || c == (unsigned char)d4) {
+            return p;
+        }
+    }
+#endif
+}
+
+/**
+ * Find the first character of a text that the serializer has to escape.
+ *
+ * @param p         The start of the text.
+ * @param end       The end of the text.
+ * @param attribute 1 to escape it as an attribute value, 0 as element content.
+ *
+ * @return          The first character to escape, or end if there is none.
+ */
+static const char* exml_find_escape(const char* p, const char* end, int attribute) {
+#ifdef EXML_VECTOR_SIZE
+    const ExmlVector lt = exml_vset('<'), gt = exml_vset('>'), amp = exml_vset('&'), cr = exml_vset('\r');
+    const ExmlVector quot = exml_vset('"'), lf = exml_vset('\n'), tab = exml_vset('\t');
+    for (; end - p >= EXML_VECTOR_SIZE; p += EXML_VECTOR_SIZE) {
+        ExmlVector v = exml_vload(p);
+        ExmlVector special = exml_vor(exml_vor(exml_veq(v, lt), exml_veq(v, gt)),
+                                      exml_vor(exml_veq(v, amp), exml_veq(v, cr)));
+        if (attribute) {
+            special = exml_vor(special, exml_vor(exml_veq(v, quot), exml_vor(exml_veq(v, lf), exml_veq(v, tab))));
+        }
+        uint32_t mask = exml_vmask(special);
+        if (mask) return p + exml_first_bit(mask);
+    }
+#endif
+    for (; p < end; p++) {
+        char c = *p;
+        if (c == '<' || c == '>' || c == '&' || c == '\r') return p;
+        if (attribute && (c == '"' || c == '\n' || c == '\t')) return p;
+    }
+    return end;
+}
+
+/**
+ * Get the length of the UTF-8 sequence of a character allowed in XML documents.
+ *
+ * @param p     The first byte of the sequence, at least 0x80. The buffer is null-terminated.
+ *
+ * @return      The length of the sequence, or 0 if it isn't a valid character.
+ */
+static size_t exml_utf8_length(const unsigned char* p) {
+    unsigned c = p[0];
+    if (c < 0xc2) return 0;
+    if (c < 0xe0) return (p[1] & 0xc0) == 0x80 ? 2 : 0;
+    if (c < 0xf0) {
+        if ((p[1] & 0xc0) != 0x80 || (p[2] & 0xc0) != 0x80) return 0;
+        unsigned cp = ((c & 0x0f) << 12) | ((p[1] & 0x3f) << 6) | (p[2] & 0x3f);
+        if (cp < 0x800 || (cp >= 0xd800 && cp <= 0xdfff) || cp >= 0xfffe) return 0;
+        return 3;
+    }
+    if (c < 0xf5) {
+        if ((p[1] & 0xc0) != 0x80 || (p[2] & 0xc0) != 0x80 || (p[3] & 0xc0) != 0x80) return 0;
+        unsigned cp = ((c & 0x07) << 18) | ((p[1] & 0x3f) << 12) | ((p[2] & 0x3f) << 6) | (p[3] & 0x3f);
+        if (cp < 0x10000 || cp > 0x10ffff) return 0;
+        return 4;
+    }
+    return 0;
+}
+
+/**
+ * Decode an entity or character reference.
+ *
+ * @param pp    A pointer to the reference, at its '&'. It is moved past the reference.
+ * @param out   Where the decoded character is written. It never goes past the reference.
+ *
+ * @return      The position after the decoded character, or NULL if the reference isn't supported.
+ */
+static char* exml_decode_reference(char** pp, char* out) {
+    char* p = *pp + 1;
+
+    if (*p != '#') {
+        char c;
+        if (!strncmp(p, "lt;", 3)) c = '<', p += 3;
+        else if (!strncmp(p, "gt;", 3)) c = '>', p += 3;
+        else if (!strncmp(p, "amp;", 4)) c = '&', p += 4;
+        else if (!strncmp(p, "quot;", 5)) c = '"', p += 5;
+        else if (!strncmp(p, "apos;", 5)) c = '\'', p += 5;
+        else return NULL;
+        *pp = p;
+        *out++ = c;
+        return out;
+    }
+
+    unsigned long cp = 0;
+    int digits = 0;
+    p++;
+    if (*p == 'x') {
+        for (p++; ; p++, digits++) {
+            if (*p >= '0' && *p <= '9') cp = cp * 16 + (*p - '0');
+            else if (*p >= 'a' && *p <= 'f') cp = cp * 16 + (*p - 'a' + 10);
+            else if (*p >= 'A' && *p <= 'F') cp = cp * 16 + (*p - 'A' + 10);
+            else break;
+            if (cp > 0x10ffff) return NULL;
+        }
+    } else {
+        for (; *p >= '0' && *p <= '9'; p++, digits++) {
+            cp = cp * 10 + (*p - '0');
+            if (cp > 0x10ffff) return NULL;
+        }
+    }
+    if (!digits || *p != ';') return NULL;
+    *pp = p + 1;
+
+    // Characters allowed in XML documents
+    if (cp < 0x20 ? cp != 0x9 && cp != 0xa && cp != 0xd : (cp >= 0xd800 && cp <= 0xdfff) || cp == 0xfffe || cp == 0xffff)
+        return NULL;
+
+    if (cp < 0x80) {
+        *out++ = (char)cp;
+    } else if (cp < 0x800) {
+        *out++ = (char)(0xc0 | (cp >> 6));
+        *out++ = (char)(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+        *out++ = (char)(0xe0 | (cp >> 12));
+        *out++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+        *out++ = (char)(0x80 | (cp & 0x3f));
+    } else {
+        *out++ = (char)(0xf0 | (cp >> 18));
+        *out++ = (char)(0x80 | ((cp >> 12) & 0x3f));
+        *out++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+        *out++ = (char)(0x80 | (cp & 0x3f));
+    }
+    return out;
+}
+
+/**
+ * Intern a name in a document.
+ *
+ * @param doc       The document.
+ * @param name      The name (not null-terminated).
+ * @param length    The length of the name.
+ *
+ * @return          The id of the name, or EXML_NONE on memory allocation errors.
+ */
+static uint32_t exml_intern(ExmlDocument* doc, const char* name, size_t length) {
+    if (doc->nameCount <= EXML_LINEAR_NAMES) {
+        // EXML files use a handful of names
+        for (uint32_t i = 0; i < doc->nameCount; i++) {
+            if (!strncmp(doc->names[i], name, length) && !doc->names[i][length]) return i;
+        }
+    }
+
+    char* copy = arena_alloc(&doc->arena, length + 1);
+    if (!copy) return EXML_NONE;
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+
+    if (doc->nameCount > EXML_LINEAR_NAMES) {
+        uintptr_t id = (uintptr_t)hash_get(&doc->nameIds, copy);
+        if (id) return (uint32_t)(id - 1);
+    }
+
+    if (doc->nameCount == doc->nameCapacity) {
+        uint32_t capacity = doc->nameCapacity ? doc->nameCapacity * 2 : 16;
+        const char** names = realloc(doc->names, capacity * sizeof(const char*));
+        if (!names) return EXML_NONE;
+        doc->names = names;
+        doc->nameCapacity = capacity;
+    }
+
+    uint32_t id = doc->nameCount;
+    if (hash_put(&doc->nameIds, copy, (void*)(uintptr_t)(id + 1))) return EXML_NONE;
+    doc->names[doc->nameCount++] = copy;
+    return id;
+}
+
+/**
+ * Add a node to a document, as the last child of its parent.
+ *
+ * @param doc       The document.
+ * @param type      The type of the node.
+ * @param parent    The index of the parent node, or EXML_NONE.
+ *
+ * @return          The index of the new node, or EXML_NONE on memory allocation errors.
+ *                  Pointers to the nodes of the document are invalidated.
+ */
+static uint32_t exml_new_node(ExmlDocument* doc, ExmlNodeType type, uint32_t parent) {
+    if (doc->nodeCount == doc->nodeCapacity) {
+        if (doc->nodeCapacity >= EXML_NONE / 4) return EXML_NONE;
+        uint32_t capacity = doc->nodeCapacity ? doc->nodeCapacity * 2 : 1024;
+        ExmlNode* nodes = realloc(doc->nodes, capacity * sizeof(ExmlNode));
+        if (!nodes) return EXML_NONE;
+        doc->nodes = nodes;
+        doc->nodeCapacity = capacity;
+    }
+
+    uint32_t id = doc->nodeCount++;
+    ExmlNode* node = &doc->nodes[id];
+    node->type = type;
+    node->name = EXML_NONE;
+    node->parent = parent;
+    node->firstChild = EXML_NONE;
+    node->lastChild = EXML_NONE;
+    node->next = EXML_NONE;
+    node->attrs = doc->attrCount;
+    node->attrCount = 0;
+    node->index = EXML_NONE;
+    node->textLength = 0;
+    node->text = NULL;
+
+    if (parent != EXML_NONE) {
+        ExmlNode* p = &doc->nodes[parent];
+        if (p->lastChild == EXML_NONE) p->firstChild = id;
+        else doc->nodes[p->lastChild].next = id;
+        p->lastChild = id;
+    }
+    return id;
+}
+
+/**
+ * Add an attribute to an element.
+ *
+ * @param doc       The document.
+ * @param node      The index of the element.
+ * @param name      The interned name id of the attribute.
+ * @param value     The value of the attribute, kept as is.
+ *
+ * @return          0 on success, 1 on memory allocation errors.
+ *
+ * The attributes of an element are contiguous; they are moved to the end of the array if
+ * other attributes follow them.
+ */
+static int exml_add_attr(ExmlDocument* doc, uint32_t node, uint32_t name, const char* value) {
+    ExmlNode* n = &doc->nodes[node];
+    int move = n->attrCount && n->attrs + n->attrCount != doc->attrCount;
+
+    uint32_t needed = doc->attrCount + (move ? n->attrCount : 0) + 1;
+    if (needed > doc->attrCapacity) {
+        if (needed >= EXML_NONE / 4) return 1;
+        uint32_t capacity = doc->attrCapacity ? doc->attrCapacity : 1024;
+        while (capacity < needed) capacity *= 2;
+        ExmlAttr* attrs = realloc(doc->attrs, capacity * sizeof(ExmlAttr));
+        if (!attrs) return 1;
+        doc->attrs = attrs;
+        doc->attrCapacity = capacity;
+    }
+
+    if (move) {
+        memcpy(&doc->attrs[doc->attrCount], &doc->attrs[n->attrs], n->attrCount * sizeof(ExmlAttr));
+        n->attrs = doc->attrCount;
+        doc->attrCount += n->attrCount;
+    } else if (!n->attrCount) {
+        n->attrs = doc->attrCount;
+    }
+
+    doc->attrs[doc->attrCount].name = name;
+    doc->attrs[doc->attrCount].value = value;
+    doc->attrCount++;
+    n->attrCount++;
+    return 0;
+}
+
+/**
+ * Parse a name.
+ *
+ * @param parser    The parser, at the first character of the name.
+ * @param length    Where the length of the name is stored.
+ *
+ * @return          The start of the name, or NULL if there is no name or it has a namespace prefix.
+ */
+static const char* exml_parse_name(ExmlParser* parser, size_t* length) {
+    char* start = parser->p;
+    char* p = start;
+    if (!IS_NAME_START(*p)) return NULL;
+    while (IS_NAME_CHAR(*p)) {
+        if ((unsigned char)*p >= 0x80) {
+            size_t n = exml_utf8_length((const unsigned char*)p);
+            if (!n) return NULL;
+            p += n;
+        } else {
+            p++;
+        }
+    }
+    // Namespaces are left to libxml2
+    if (*p == ':') return NULL;
+
+    parser->p = p;
+    *length = (size_t)(p - start);
+    return start;
+}
+
+/**
+ * Skip blanks.
+ *
+ * @param parser    The parser.
+ *
+ * @return          1 if there was at least one blank, 0 otherwise.
+ */
+static int exml_skip_blanks(ExmlParser* parser) {
+    char* p = parser->p;
+    while (IS_BLANK(*p)) p++;
+    int skipped = p != parser->p;
+    parser->p = p;
+    return skipped;
+}
+
+/**
+ * Parse a quoted attribute value, decoding and normalizing it in place.
+ *
+ * @param parser    The parser, at the opening quote.
+ *
+ * @return          The null-terminated value, or NULL if it isn't well-formed.
+ */
+static const char* exml_parse_attr_value(ExmlParser* parser) {
+    char quote = *parser->p;
+    if (quote != '"' && quote != '\'') return NULL;
+
+    char* p = parser->p + 1;
+    char* value = p;
+    char* out = p;
+    while (*p != quote) {
+        char* plain = exml_skip_plain(p, quote, '&', '<', '<', 0);
+        if (plain != p) {
+            if (out != p) memmove(out, p, (size_t)(plain - p));
+            out += plain - p;
+            p = plain;
+            continue;
+        }
+
+        unsigned char c = (unsigned char)*p;
+        if (c == '&') {
+            out = exml_decode_reference(&p, out);
+            if (!out) return NULL;
+        } else if (c == '\t' || c == '\n') {
+            // Attribute value normalization
+            *out++ = ' ';
+            p++;
+        } else if (c < 0x20 || c == '<') {
+            return NULL;
+        } else if (c >= 0x80) {
+            size_t n = exml_utf8_length((const unsigned char*)p);
+            if (!n) return NULL;
+            if (out != p) memmove(out, p, n);
+            out += n;
+            p += n;
+        } else {
+            *out++ = *p++;
+        }
+    }
+    *out = '\0';
+    parser->p = p + 1;
+    return value;
+}
+
+/**
+ * Parse a comment.
+ *
+ * @param parser    The parser, at its "<!--".
+ * @param parent    The index of the parent node.
+ *
+ * @return          0 on success, 1 if it isn't well-formed or on memory allocation errors.
+ */
+static int exml_parse_comment(ExmlParser* parser, uint32_t parent) {
+    char* start = parser->p + 4;
+    char* p = start;
+    for (;;) {
+        p = exml_skip_plain(p, '-', '-', '-', '-', 1);
+        unsigned char c = (unsigned char)*p;
+        if (c == '-' && p[1] == '-') {
+            if (p[2] != '>') return 1;
+            break;
+        }
+        if (c >= 0x80) {
+            size_t n = exml_utf8_length((const unsigned char*)p);
+            if (!n) return 1;
+            p += n;
+        } else {
+            if (c < 0x20 && c != '\t' && c != '\n') return 1;
+            p++;
+        }
+    }
+
+    uint32_t node = exml_new_node(parser->doc, EXML_COMMENT, parent);
+    if (node == EXML_NONE) return 1;
+    parser->doc->nodes[node].text = start;
+    parser->doc->nodes[node].textLength = (uint32_t)(p - start);
+    parser->p = p + 3;
+    return 0;
+}
+
+/**
+ * Parse the character data of an element, decoding it in place.
+ *
+ * @param parser    The parser, at the first character.
+ * @param parent    The index of the element.
+ *
+ * @return          0 on success, 1 if it isn't well-formed or on memory allocation errors.
+ */
+static int exml_parse_text(ExmlParser* parser, uint32_t parent) {
+    char* start = parser->p;
+    char* p = start;
+    char* out = start;
+    int brackets = 0;
+
+    while (*p != '<') {
+        // '>' ends the run too, to check for "]]>"
+        char* plain = exml_skip_plain(p, '<', '&', ']', '>', 1);
+        if (plain != p) {
+            if (out != p) memmove(out, p, (size_t)(plain - p));
+            out += plain - p;
+            p = plain;
+            brackets = 0;
+            continue;
+        }
+
+        unsigned char c = (unsigned char)*p;
+        if (c == '&') {
+            out = exml_decode_reference(&p, out);
+            if (!out) return 1;
+            brackets = 0;
+            continue;
+        }
+        if (c >= 0x80) {
+            size_t n = exml_utf8_length((const unsigned char*)p);
+            if (!n) return 1;
+            if (out != p) memmove(out, p, n);
+            out += n;
+            p += n;
+            brackets = 0;
+            continue;
+        }
+        if (c < 0x20 && c != '\t' && c != '\n') return 1;
+        // "]]>" can't appear in character data
+        if (c == '>' && brackets >= 2) return 1;
+        brackets = c == ']' ? brackets + 1 : 0;
+        *out++ = *p++;
+    }
+
+    uint32_t node = exml_new_node(parser->doc, EXML_TEXT, parent);
+    if (node == EXML_NONE) return 1;
+    parser->doc->nodes[node].text = start;
+    parser->doc->nodes[node].textLength = (uint32_t)(out - start);
+    parser->p = p;
+    return 0;
+}
+
+/**
+ * Parse a start tag and its attributes.
+ *
+ * @param parser    The parser, at its '<'.
+ * @param parent    The index of the parent node.
+ * @param empty     Set to 1 for empty-element tags.
+ *
+ * @return          The index of the element, or EXML_NONE if it isn't well-formed or on memory
+ *                  allocation errors.
+ */
+static uint32_t exml_parse_start_tag(ExmlParser* parser, uint32_t parent, int* empty) {
+    ExmlDocument* doc = parser->doc;
+    size_t length;
+
+    parser->p++;
+    const char* name = exml_parse_name(parser, &length);
+    if (!name) return EXML_NONE;
+
+    uint32_t node = exml_new_node(doc, EXML_ELEMENT, parent);
+    if (node == EXML_NONE) return EXML_NONE;
+    if ((doc->nodes[node].name = exml_intern(doc, name, length)) == EXML_NONE) return EXML_NONE;
+
+    for (;;) {
+        int blank = exml_skip_blanks(parser);
+        if (*parser->p == '>') {
+            parser->p++;
+            *empty = 0;
+            return node;
+        }
+        if (parser->p[0] == '/' && parser->p[1] == '>') {
+            parser->p += 2;
+            *empty = 1;
+            return node;
+        }
+        if (!blank) return EXML_NONE;
+
+        const char* attrName = exml_parse_name(parser, &length);
+        if (!attrName) return EXML_NONE;
+        // Namespace declarations are left to libxml2
+        if (length == 5 && !strncmp(attrName, "xmlns", 5)) return EXML_NONE;
+        uint32_t attr = exml_intern(doc, attrName, length);
+        if (attr == EXML_NONE) return EXML_NONE;
+
+        exml_skip_blanks(parser);
+        if (*parser->p != '=') return EXML_NONE;
+        parser->p++;
+        exml_skip_blanks(parser);
+
+        const char* value = exml_parse_attr_value(parser);
+        if (!value) return EXML_NONE;
+
+        ExmlNode* n = &doc->nodes[node];
+        for (uint32_t i = 0; i < n->attrCount; i++) {
+            if (doc->attrs[n->attrs + i].name == attr) return EXML_NONE;
+        }
+        if (exml_add_attr(doc, node, attr, value)) return EXML_NONE;
+    }
+}
+
+/**
+ * Parse the root element and its content.
+ *
+ * @param parser    The parser, at the '<' of the root element.
+ *
+ * @return          0 on success, 1 if it isn't well-formed or on memory allocation errors.
+ */
+static int exml_parse_element(ExmlParser* parser) {
+    ExmlDocument* doc = parser->doc;
+    int empty;
+
+    uint32_t current = exml_parse_start_tag(parser, EXML_DOCUMENT_NODE, &empty);
+    if (current == EXML_NONE) return 1;
+    if (empty) return 0;
+
+    for (;;) {
+        char* p = parser->p;
+        if (*p != '<') {
+            if (exml_parse_text(parser, current)) return 1;
+            continue;
+        }
+
+        if (p[1] == '/') {
+            // End tag of the current element
+            const char* name = doc->names[doc->nodes[current].name];
+            size_t length = strlen(name);
+            if (strncmp(p + 2, name, length)) return 1;
+            parser->p = p + 2 + length;
+            exml_skip_blanks(parser);
+            if (*parser->p != '>') return 1;
+            parser->p++;
+
+            current = doc->nodes[current].parent;
+            if (current == EXML_DOCUMENT_NODE) return 0;
+        } else if (p[1] == '!') {
+            // CDATA sections and declarations are left to libxml2
+            if (strncmp(p, "<!--", 4) || exml_parse_comment(parser, current)) return 1;
+        } else if (p[1] == '?') {
+            return 1;
+        } else {
+            uint32_t node = exml_parse_start_tag(parser, current, &empty);
+            if (node == EXML_NONE) return 1;
+            if (!empty) current = node;
+        }
+    }
+}
+
+/**
+ * Parse the XML declaration.
+ *
+ * @param parser    The parser, at the start of the document.
+ *
+ * @return          0 on success, 1 if it is missing, not well-formed or not for UTF-8.
+ */
+static int exml_parse_declaration(ExmlParser* parser) {
+    ExmlDocument* doc = parser->doc;
+
+    if (strncmp(parser->p, "<?xml", 5) || !IS_BLANK(parser->p[5])) return 1;
+    parser->p += 5;
+
+    const char* names[3] = { "version", "encoding", "standalone" };
+    const char* values[3] = { NULL, NULL, NULL };
+    int next = 0;
+    for (;;) {
+        int blank = exml_skip_blanks(parser);
+        if (parser->p[0] == '?' && parser->p[1] == '>') {
+            parser->p += 2;
+            break;
+        }
+        if (!blank) return 1;
+
+        // The pseudo-attributes come in order, and only the version is required
+        int found = -1;
+        for (int i = next; i < 3 && found < 0; i++) {
+            size_t length = strlen(names[i]);
+            if (!strncmp(parser->p, names[i], length)) {
+                found = i;
+                parser->p += length;
+            }
+        }
+        if (found < 0 || (found > 0 && !values[0])) return 1;
+        next = found + 1;
+
+        exml_skip_blanks(parser);
+        if (*parser->p != '=') return 1;
+        parser->p++;
+        exml_skip_blanks(parser);
+        if (!(values[found] = exml_parse_attr_value(parser))) return 1;
+    }
+
+    if (!values[0] || strcmp(values[0], "1.0")) return 1;
+
+    // Only UTF-8 documents are written back as they are by libxml2
+    const char* encoding = values[1];
+    if (!encoding || strlen(encoding) != 5) return 1;
+    for (int i = 0; i < 5; i++) {
+        char c = encoding[i] >= 'a' && encoding[i] <= 'z' ? encoding[i] - 'a' + 'A' : encoding[i];
+        if (c != "UTF-8"[i]) return 1;
+    }
+
+    doc->version = values[0];
+    doc->encoding = encoding;
+    if (!values[2]) doc->standalone = -1;
+    else if (!strcmp(values[2], "yes")) doc->standalone = 1;
+    else if (!strcmp(values[2], "no")) doc->standalone = 0;
+    else return 1;
+    return 0;
+}
+
+/**
+ * Parse a whole document.
+ *
+ * @param parser    The parser, at the start of the document.
+ *
+ * @return          0 on success, 1 if it isn't in the supported subset or on memory allocation errors.
+ */
+static int exml_parse_document(ExmlParser* parser) {
+    // Byte order mark
+    if (!strncmp(parser->p, "\xef\xbb\xbf", 3)) parser->p += 3;
+
+    if (exml_parse_declaration(parser)) return 1;
+
+    int root = 0;
+    for (;;) {
+        exml_skip_blanks(parser);
+        char* p = parser->p;
+        if (!*p) break;
+        if (*p != '<') return 1;
+
+        if (!strncmp(p, "<!--", 4)) {
+            if (exml_parse_comment(parser, EXML_DOCUMENT_NODE)) return 1;
+        } else if (p[1] == '!' || p[1] == '?' || root) {
+            // Document types and processing instructions are left to libxml2
+            return 1;
+        } else {
+            if (exml_parse_element(parser)) return 1;
+            root = 1;
+        }
+    }
+    return !root;
+}
+
+/**
+ * Normalize the line ends of a buffer to line feeds, as XML parsers do.
+ *
+ * @param buffer    The null-terminated buffer.
+ * @param size      The size of the buffer, without the terminator.
+ */
+static void exml_normalize_line_ends(char* buffer, size_t size) {
+    char* out = buffer;
+    for (size_t i = 0; i < size; i++) {
+        if (buffer[i] == '\r') {
+            *out++ = '\n';
+            if (i + 1 < size && buffer[i + 1] == '\n') i++;
+        } else {
+            *out++ = buffer[i];
+        }
+    }
+    *out = '\0';
+}
+
+ExmlDocument *exml_load(const char *filename) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) return NULL;
+
+    ExmlDocument* doc = calloc(1, sizeof(ExmlDocument));
+    long size = -1;
+    if (doc && !fseek(file, 0, SEEK_END) && (size = ftell(file)) >= 0 && !fseek(file, 0, SEEK_SET)) {
+        doc->buffer = calloc(1, (size_t)size + 1 + EXML_BUFFER_PADDING);
+        if (doc->buffer && fread(doc->buffer, 1, (size_t)size, file) != (size_t)size) size = -1;
+    }
+    fclose(file);
+
+    if (!doc || !doc->buffer || size < 0) {
+        exml_free(doc);
+        return NULL;
+    }
+    doc->buffer[size] = '\0';
+    doc->size = (size_t)size;
+
+    // Embedded null characters aren't allowed, and would end the parse early
+    if (memchr(doc->buffer, '\0', (size_t)size)) {
+        exml_free(doc);
+        return NULL;
+    }
+    if (memchr(doc->buffer, '\r', (size_t)size)) exml_normalize_line_ends(doc->buffer, (size_t)size);
+
+    hash_init(&doc->nameIds, NULL);
+    doc->standalone = -1;
+
+    // The names every document uses get fixed ids
+    static const char* fixedNames[] = { "Data", "Property", "name", "value" };
+    for (size_t i = 0; i < sizeof(fixedNames) / sizeof(fixedNames[0]); i++) {
+        if (exml_intern(doc, fixedNames[i], strlen(fixedNames[i])) != i) {
+            exml_free(doc);
+            return NULL;
+        }
+    }
+
+    ExmlParser parser = { doc, doc->buffer };
+    if (exml_new_node(doc, EXML_DOCUMENT, EXML_NONE) != EXML_DOCUMENT_NODE || exml_parse_document(&parser)) {
+        exml_free(doc);
+        return NULL;
+    }
+    return doc;
+}
+
+/**
+ * Write the buffered output to the file.
+ *
+ * @param writer    The serializer.
+ */
+static void exml_flush(ExmlWriter* writer) {
+    if (writer->used && fwrite(writer->buffer, 1, writer->used, writer->file) != writer->used) writer->error = 1;
+    writer->used = 0;
+}
+
+/**
+ * Write bytes to the output.
+ *
+ * @param writer    The serializer.
+ * @param data      The bytes to write.
+ * @param size      The number of bytes.
+ */
+static void exml_write(ExmlWriter* writer, const char* data, size_t size) {
+    if (size > EXML_WRITE_BUFFER_SIZE - writer->used) {
+        exml_flush(writer);
+        if (size > EXML_WRITE_BUFFER_SIZE) {
+            if (fwrite(data, 1, size, writer->file) != size) writer->error = 1;
+            return;
+        }
+    }
+    memcpy(writer->buffer + writer->used, data, size);
+    writer->used += size;
+}
+
+#define exml_write_string(writer, str)  exml_write((writer), (str), strlen(str))
+
+/**
+ * Write text to the output, escaped the way libxml2 saves UTF-8 documents.
+ *
+ * @param writer    The serializer.
+ * @param text      The text to write.
+ * @param length    The length of the text.
+ * @param attribute 1 to escape it as an attribute value, 0 as element content.
+ */
+static void exml_write_escaped(ExmlWriter* writer, const char* text, size_t length, int attribute) {
+    const char* start = text;
+    const char* end = text + length;
+    const char* p;
+    while ((p = exml_find_escape(start, end, attribute)) < end) {
+        const char* entity;
+        switch (*p) {
+            case '<': entity = "&lt;"; break;
+            case '>': entity = "&gt;"; break;
+            case '&': entity = "&amp;"; break;
+            case '\r': entity = "&#13;"; break;
+            // Only found in attribute values
+            case '"': entity = "&quot;"; break;
+            case '\n': entity = "&#10;"; break;
+            default: entity = "&#9;"; break;
+        }
+        exml_write(writer, start, (size_t)(p - start));
+        exml_write_string(writer, entity);
+        start = p + 1;
+    }
+    exml_write(writer, start, (size_t)(end - start));
+}
+
+/**
+ * Write an attribute to the output, with the space before it.
+ *
+ * @param writer    The serializer.
+ * @param name      The name of the attribute.
+ * @param value     The value of the attribute.
+ */
+static void exml_write_attr(ExmlWriter* writer, const char* name, const char* value) {
+    size_t nameLength = strlen(name);
+    size_t valueLength = strlen(value);
+    const char* end = value + valueLength;
+
+    // Most values have nothing to escape and are copied to the buffer in one go
+    if (exml_find_escape(value, end, 1) == end && nameLength + valueLength + 4 <= EXML_WRITE_BUFFER_SIZE - writer->used) {
+        char* out = writer->buffer + writer->used;
+        *out++ = ' ';
+        memcpy(out, name, nameLength);
+        out += nameLength;
+        *out++ = '=';
+        *out++ = '"';
+        memcpy(out, value, valueLength);
+        out += valueLength;
+        *out++ = '"';
+        writer->used = (size_t)(out - writer->buffer);
+        return;
+    }
+
+    exml_write(writer, " ", 1);
+    exml_write(writer, name, nameLength);
+    exml_write(writer, "=\"", 2);
+    exml_write_escaped(writer, value, valueLength, 1);
+    exml_write(writer, "\"", 1);
+}
+
+/**
+ * Write the start tag of an element, without its closing '>'.
+ *
+ * @param writer    The serializer.
+ * @param doc       The document.
+ * @param node      The element.
+ */
+static void exml_write_start_tag(ExmlWriter* writer, const ExmlDocument* doc, const ExmlNode* node) {
+    exml_write(writer, "<", 1);
+    exml_write_string(writer, doc->names[node->name]);
+    for (uint32_t i = 0; i < node->attrCount; i++) {
+        const ExmlAttr* attr = &doc->attrs[node->attrs + i];
+        exml_write_attr(writer, doc->names[attr->name], attr->value);
+    }
+}
+
+/**
+ * Write a node and its subtree.
+ *
+ * @param writer    The serializer.
+ * @param doc       The document.
+ * @param top       The index of the node.
+ */
+static void exml_write_node(ExmlWriter* writer, const ExmlDocument* doc, uint32_t top) {
+    uint32_t id = top;
+    for (;;) {
+        const ExmlNode* node = &doc->nodes[id];
+
+        if (node->type == EXML_ELEMENT) {
+            exml_write_start_tag(writer, doc, node);
+            if (node->firstChild != EXML_NONE) {
+                exml_write(writer, ">", 1);
+                id = node->firstChild;
+                continue;
+            }
+            exml_write(writer, "/>", 2);
+        } else if (node->type == EXML_TEXT) {
+            exml_write_escaped(writer, node->text, node->textLength, 0);
+        } else if (node->type == EXML_COMMENT) {
+            exml_write(writer, "<!--", 4);
+            exml_write(writer, node->text, node->textLength);
+            exml_write(writer, "-->", 3);
+        }
+
+        // Close the elements whose last child was written
+        while (id != top && doc->nodes[id].next == EXML_NONE) {
+            id = doc->nodes[id].parent;
+            exml_write(writer, "</", 2);
+            exml_write_string(writer, doc->names[doc->nodes[id].name]);
+            exml_write(writer, ">", 1);
+        }
+        if (id == top) return;
+        id = doc->nodes[id].next;
+    }
+}
+
+/**
+ * Create a serializer writing to a file.
+ *
+ * @param filename  The path of the file.
+ *
+ * @return          The serializer, or NULL if the file can't be created.
+ */
+static ExmlWriter* exml_open_writer(const char* filename) {
+    ExmlWriter* writer = malloc(sizeof(ExmlWriter));
+    if (!writer) return NULL;
+    writer->file = fopen(filename, "wb");
+    writer->used = 0;
+    writer->error = 0;
+    if (!writer->file) {
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+/**
+ * Flush the output of a serializer, close its file and release it.
+ *
+ * @param writer    The serializer.
+ *
+ * @return          0 on success, 1 if the output couldn't be written.
+ */
+static int exml_close_writer(ExmlWriter* writer) {
+    exml_flush(writer);
+    int error = writer->error;
+    if (fclose(writer->file)) error = 1;
+    free(writer);
+    return error;
+}
+
+/**
+ * Write the XML declaration.
+ *
+ * @param writer    The serializer.
+ * @param version   The XML version.
+ * @param encoding  The encoding.
+ * @param standalone 1 or 0 for the standalone declaration, -1 to leave it out.
+ */
+static void exml_write_declaration(ExmlWriter* writer, const char* version, const char* encoding, int standalone) {
+    exml_write_string(writer, "<?xml version=\"");
+    exml_write_string(writer, version);
+    exml_write_string(writer, "\" encoding=\"");
+    exml_write_string(writer, encoding);
+    exml_write_string(writer, "\"");
+    if (standalone == 0) exml_write_string(writer, " standalone=\"no\"");
+    if (standalone == 1) exml_write_string(writer, " standalone=\"yes\"");
+    exml_write_string(writer, "?>\n");
+}
+
+int exml_save(ExmlDocument *doc, const char *filename) {
+    ExmlWriter* writer = exml_open_writer(filename);
+    if (!writer) return 1;
+
+    exml_write_declaration(writer, doc->version, doc->encoding, doc->standalone);
+
+    // Every top-level node goes on its own line
+    for (uint32_t id = doc->nodes[EXML_DOCUMENT_NODE].firstChild; id != EXML_NONE; id = doc->nodes[id].next) {
+        exml_write_node(writer, doc, id);
+        exml_write(writer, "\n", 1);
+    }
+
+    return exml_close_writer(writer);
+}
+
+/**
+ * Get the node that follows another one in document order, without entering its children, and
+ * write the end tags of the elements left.
+ *
+ * @param writer    The serializer.
+ * @param doc       The document.
+ * @param node      The node.
+ *
+ * @return          The next node, or NULL at the end of the document.
+ */
+static xmlNodePtr exml_dom_next(ExmlWriter* writer, xmlDocPtr doc, xmlNodePtr node) {
+    while (!node->next) {
+        node = node->parent;
+        if (!node || node == (xmlNodePtr)doc) return NULL;
+        exml_write(writer, "</", 2);
+        exml_write_string(writer, (const char*)node->name);
+        exml_write(writer, ">", 1);
+    }
+    // Every top-level node goes on its own line
+    if (node->parent == (xmlNodePtr)doc) exml_write(writer, "\n", 1);
+    return node->next;
+}
+
+/**
+ * Check that a libxml2 node is written by the serializer the way libxml2 does.
+ *
+ * @param node      The node.
+ *
+ * @return          1 if it is supported, 0 if not.
+ */
+static int exml_dom_supported(xmlNodePtr node) {
+    if (node->type == XML_ELEMENT_NODE) {
+        if (node->ns || node->nsDef) return 0;
+        for (xmlAttrPtr attr = node->properties; attr; attr = attr->next) {
+            if (attr->ns) return 0;
+            for (xmlNodePtr text = attr->children; text; text = text->next) {
+                if (text->type != XML_TEXT_NODE) return 0;
+            }
+        }
+        return 1;
+    }
+    // Text nodes named like xmlStringTextNoenc are written without escaping
+    if (node->type == XML_TEXT_NODE) return !xmlStrEqual(node->name, BAD_CAST "textnoenc");
+    return node->type == XML_COMMENT_NODE;
+}
+
+int exml_save_dom(xmlDocPtr doc, const char *filename) {
+    if (!doc->encoding || xmlStrcasecmp(doc->encoding, BAD_CAST "UTF-8")) return 1;
+    if (doc->intSubset || doc->extSubset) return 1;
+
+    ExmlWriter* writer = exml_open_writer(filename);
+    if (!writer) return 1;
+
+    exml_write_declaration(writer, doc->version ? (const char*)doc->version : "1.0", (const char*)doc->encoding,
+                           doc->standalone);
+
+    xmlNodePtr node = doc->children;
+    while (node) {
+        // The file is left for libxml2 to write again
+        if (!exml_dom_supported(node)) {
+            writer->error = 1;
+            break;
+        }
+
+        if (node->type == XML_ELEMENT_NODE) {
+            exml_write(writer, "<", 1);
+            exml_write_string(writer, (const char*)node->name);
+            for (xmlAttrPtr attr = node->properties; attr; attr = attr->next) {
+                xmlNodePtr text = attr->children;
+                if (!text || !text->next) {
+                    exml_write_attr(writer, (const char*)attr->name, text && text->content ? (const char*)text->content : "");
+                    continue;
+                }
+
+                // Values made of several text nodes
+                exml_write(writer, " ", 1);
+                exml_write_string(writer, (const char*)attr->name);
+                exml_write(writer, "=\"", 2);
+                for (; text; text = text->next) {
+                    if (text->content) {
+                        exml_write_escaped(writer, (const char*)text->content, strlen((const char*)text->content), 1);
+                    }
+                }
+                exml_write(writer, "\"", 1);
+            }
+            if (node->children) {
+                exml_write(writer, ">", 1);
+                node = node->children;
+                continue;
+            }
+            exml_write(writer, "/>", 2);
+        } else if (node->content) {
+            // libxml2 writes nothing for text and comment nodes without content
+            if (node->type == XML_TEXT_NODE) {
+                exml_write_escaped(writer, (const char*)node->content, strlen((const char*)node->content), 0);
+            } else {
+                exml_write(writer, "<!--", 4);
+                exml_write_string(writer, (const char*)node->content);
+                exml_write(writer, "-->", 3);
+            }
+        }
+        node = exml_dom_next(writer, doc, node);
+    }
+    if (doc->children && !writer->error) exml_write(writer, "\n", 1);
+
+    return exml_close_writer(writer);
+}
+
+/**
+ * Magic string and version of the snapshot files.
+ */
+#define EXML_SNAPSHOT_MAGIC     "NMSEXMS"
+#define EXML_SNAPSHOT_VERSION   1
+
+// Structure to store the header of a snapshot file
+typedef struct ExmlSnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeCount;
+    uint32_t attrCount;
+    uint32_t nameCount;
+    uint64_t sourceSize;    // size of the EXML file the document was loaded from
+    uint64_t namesSize;     // size of the null-terminated names
+    uint64_t stringsSize;   // size of the texts and attribute values
+    uint32_t versionOffset; // offset of the version in the strings
+    uint32_t encodingOffset;// offset of the encoding in the strings
+    int32_t standalone;
+    uint32_t reserved;
+} ExmlSnapshotHeader;
+
+// Structure to store a node in a snapshot file
+typedef struct ExmlSnapshotNode {
+    uint32_t type;
+    uint32_t parent;        // EXML_NONE for the document node
+    uint32_t name;          // interned name id of elements, length of the text of other nodes
+    uint32_t value;         // number of attributes of elements, offset of the text of other nodes
+} ExmlSnapshotNode;
+
+// Structure to store an attribute in a snapshot file
+typedef struct ExmlSnapshotAttr {
+    uint32_t name;
+    uint32_t value;         // offset of the null-terminated value
+} ExmlSnapshotAttr;
+
+/**
+ * Check that the links of a document are the ones its nodes would get by being added in order.
+ *
+ * @param doc       The document.
+ *
+ * @return          0 if they are, 1 if the document was changed or on memory allocation errors.
+ *
+ * Snapshots only store the parent of each node and the number of attributes of each element,
+ * so documents whose nodes or attributes were added, moved or reordered can't be saved.
+ */
+static int exml_snapshot_check(const ExmlDocument* doc) {
+    uint32_t* last = malloc(doc->nodeCount * sizeof(uint32_t));
+    if (!last) return 1;
+
+    int error = doc->nodes[EXML_DOCUMENT_NODE].parent != EXML_NONE;
+    uint32_t attrs = 0;
+    for (uint32_t i = 0; i < doc->nodeCount && !error; i++) {
+        const ExmlNode* node = &doc->nodes[i];
+        last[i] = EXML_NONE;
+        if (node->type == EXML_ELEMENT && node->attrCount) {
+            error = node->attrs != attrs;
+            attrs += node->attrCount;
+        }
+        if (!i) continue;
+
+        uint32_t parent = node->parent;
+        if (parent >= i) {
+            error = 1;
+        } else {
+            error |= last[parent] == EXML_NONE ? doc->nodes[parent].firstChild != i : doc->nodes[last[parent]].next != i;
+            last[parent] = i;
+        }
+    }
+    for (uint32_t i = 0; i < doc->nodeCount && !error; i++) {
+        error = doc->nodes[i].lastChild != last[i] || (last[i] != EXML_NONE && doc->nodes[last[i]].next != EXML_NONE);
+    }
+    free(last);
+    return error || attrs != doc->attrCount;
+}
+
+int exml_save_snapshot(const ExmlDocument *doc, const char *filename) {
+    if (exml_snapshot_check(doc)) return 1;
+
+    ExmlSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EXML_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = EXML_SNAPSHOT_VERSION;
+    header.nodeCount = doc->nodeCount;
+    header.attrCount = doc->attrCount;
+    header.nameCount = doc->nameCount;
+    header.sourceSize = doc->size;
+    header.standalone = doc->standalone;
+    for (uint32_t i = 0; i < doc->nameCount; i++) header.namesSize += strlen(doc->names[i]) + 1;
+
+    // The strings are stored in the order of the nodes and attributes that use them, after them
+    uint64_t offset = 0;
+    header.versionOffset = (uint32_t)offset;
+    offset += strlen(doc->version) + 1;
+    header.encodingOffset = (uint32_t)offset;
+    offset += strlen(doc->encoding) + 1;
+    for (uint32_t i = 0; i < doc->nodeCount; i++) {
+        if (doc->nodes[i].type == EXML_TEXT || doc->nodes[i].type == EXML_COMMENT) offset += doc->nodes[i].textLength;
+    }
+    for (uint32_t i = 0; i < doc->attrCount; i++) offset += strlen(doc->attrs[i].value) + 1;
+    if (offset >= EXML_NONE) return 1;
+    header.stringsSize = offset;
+
+    ExmlWriter* writer = exml_open_writer(filename);
+    if (!writer) return 1;
+    exml_write(writer, (const char*)&header, sizeof(header));
+
+    offset = header.encodingOffset + strlen(doc->encoding) + 1;
+    for (uint32_t i = 0; i < doc->nodeCount; i++) {
+        const ExmlNode* node = &doc->nodes[i];
+        ExmlSnapshotNode n = { (uint32_t)node->type, node->parent, node->name, node->attrCount };
+        if (node->type == EXML_TEXT || node->type == EXML_COMMENT) {
+            n.name = node->textLength;
+            n.value = (uint32_t)offset;
+            offset += node->textLength;
+        }
+        exml_write(writer, (const char*)&n, sizeof(n));
+    }
+    for (uint32_t i = 0; i < doc->attrCount; i++) {
+        ExmlSnapshotAttr a = { doc->attrs[i].name, (uint32_t)offset };
+        offset += strlen(doc->attrs[i].value) + 1;
+        exml_write(writer, (const char*)&a, sizeof(a));
+    }
+
+    for (uint32_t i = 0; i < doc->nameCount; i++) exml_write(writer, doc->names[i], strlen(doc->names[i]) + 1);
+
+    exml_write(writer, doc->version, strlen(doc->version) + 1);
+    exml_write(writer, doc->encoding, strlen(doc->encoding) + 1);
+    for (uint32_t i = 0; i < doc->nodeCount; i++) {
+        const ExmlNode* node = &doc->nodes[i];
+        if (node->type == EXML_TEXT || node->type == EXML_COMMENT) exml_write(writer, node->text, node->textLength);
+    }
+    for (uint32_t i = 0; i < doc->attrCount; i++) exml_write(writer, doc->attrs[i].value, strlen(doc->attrs[i].value) + 1);
+
+    return exml_close_writer(writer);
+}
+
+/**
+ * Check that a string of a snapshot is inside its strings and, for null-terminated ones, ends there.
+ *
+ * @param strings   The strings of the snapshot.
+ * @param size      The size of the strings.
+ * @param offset    The offset of the string.
+ * @param length    The length of the string, or 0 for a null-terminated string.
+ *
+ * @return          1 if it is valid, 0 otherwise.
+ */
+static int exml_snapshot_string(const char* strings, size_t size, uint32_t offset, uint32_t length) {
+    if (offset > size || length > size - offset) return 0;
+    return length || memchr(strings + offset, '\0', size - offset) != NULL;
+}
+
+ExmlDocument *exml_load_snapshot(const char *filename, uint64_t size) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) return NULL;
+
+    ExmlSnapshotHeader header;
+    ExmlDocument* doc = NULL;
+    ExmlSnapshotNode* nodes = NULL;
+    ExmlSnapshotAttr* attrs = NULL;
+    char* names = NULL;
+    size_t stringsSize = 0;
+    int error = fread(&header, sizeof(header), 1, file) != 1 ||
+                memcmp(header.magic, EXML_SNAPSHOT_MAGIC, sizeof(header.magic)) ||
+                header.version != EXML_SNAPSHOT_VERSION || header.sourceSize != size ||
+                !header.nodeCount || header.nodeCount >= EXML_NONE / 4 || header.attrCount >= EXML_NONE / 4 ||
+                header.nameCount < 4 || header.namesSize >= EXML_NONE || header.stringsSize >= EXML_NONE;
+
+    // The nodes and attributes are read as they are stored, and converted below
+    if (!error) {
+        doc = calloc(1, sizeof(ExmlDocument));
+        nodes = malloc(header.nodeCount * sizeof(ExmlSnapshotNode));
+        attrs = malloc((header.attrCount ? header.attrCount : 1) * sizeof(ExmlSnapshotAttr));
+        names = malloc((size_t)header.namesSize + 1);
+        error = !doc || !nodes || !attrs || !names;
+    }
+    if (!error) {
+        hash_init(&doc->nameIds, NULL);
+        doc->size = (size_t)header.sourceSize;
+        doc->standalone = header.standalone;
+        stringsSize = (size_t)header.stringsSize;
+        doc->buffer = calloc(1, stringsSize + 1 + EXML_BUFFER_PADDING);
+        doc->nodes = malloc(header.nodeCount * sizeof(ExmlNode));
+        doc->attrs = malloc((header.attrCount ? header.attrCount : 1) * sizeof(ExmlAttr));
+        doc->nodeCapacity = doc->nodeCount = header.nodeCount;
+        doc->attrCapacity = doc->attrCount = header.attrCount;
+        error = !doc->buffer || !doc->nodes || !doc->attrs ||
+                fread(nodes, sizeof(ExmlSnapshotNode), header.nodeCount, file) != header.nodeCount ||
+                fread(attrs, sizeof(ExmlSnapshotAttr), header.attrCount, file) != header.attrCount ||
+                fread(names, 1, (size_t)header.namesSize, file) != header.namesSize ||
+                fread(doc->buffer, 1, stringsSize, file) != stringsSize;
+    }
+    fclose(file);
+
+    // The names are interned again in order, which gives them the same ids
+    if (!error) {
+        names[header.namesSize] = '\0';
+        const char* name = names;
+        for (uint32_t i = 0; i < header.nameCount && !error; i++) {
+            size_t length = strlen(name);
+            error = name + length >= names + header.namesSize || exml_intern(doc, name, length) != i;
+            name += length + 1;
+        }
+    }
+
+    if (!error) {
+        error = !exml_snapshot_string(doc->buffer, stringsSize, header.versionOffset, 0) ||
+                !exml_snapshot_string(doc->buffer, stringsSize, header.encodingOffset, 0);
+        doc->version = doc->buffer + header.versionOffset;
+        doc->encoding = doc->buffer + header.encodingOffset;
+    }
+
+    // The nodes are linked as they are added, as exml_new_node() does; the parents come first
+    uint32_t attrCount = 0;
+    for (uint32_t i = 0; i < doc->nodeCount && !error; i++) {
+        const ExmlSnapshotNode* n = &nodes[i];
+        ExmlNode* node = &doc->nodes[i];
+        node->type = (ExmlNodeType)n->type;
+        node->name = EXML_NONE;
+        node->parent = n->parent;
+        node->firstChild = EXML_NONE;
+        node->lastChild = EXML_NONE;
+        node->next = EXML_NONE;
+        node->attrs = attrCount;
+        node->attrCount = 0;
+        node->index = EXML_NONE;
+        node->textLength = 0;
+        node->text = NULL;
+
+        if (n->type == EXML_ELEMENT) {
+            error = n->name >= doc->nameCount || n->value > doc->attrCount - attrCount;
+            node->name = n->name;
+            node->attrCount = n->value;
+            attrCount += error ? 0 : n->value;
+        } else if (n->type == EXML_TEXT || n->type == EXML_COMMENT) {
+            error = !exml_snapshot_string(doc->buffer, stringsSize, n->value, n->name);
+            node->textLength = n->name;
+            node->text = doc->buffer + n->value;
+        } else {
+            error = i != EXML_DOCUMENT_NODE;
+        }
+
+        if (!i) {
+            error |= n->parent != EXML_NONE;
+        } else if (n->parent >= i) {
+            error = 1;
+        } else {
+            ExmlNode* p = &doc->nodes[n->parent];
+            if (p->lastChild == EXML_NONE) p->firstChild = i;
+            else doc->nodes[p->lastChild].next = i;
+            p->lastChild = i;
+        }
+    }
+    error |= attrCount != doc->attrCount;
+
+    for (uint32_t i = 0; i < doc->attrCount && !error; i++) {
+        error = attrs[i].name >= doc->nameCount || !exml_snapshot_string(doc->buffer, stringsSize, attrs[i].value, 0);
+        doc->attrs[i].name = attrs[i].name;
+        doc->attrs[i].value = doc->buffer + attrs[i].value;
+    }
+
+    free(nodes);
+    free(attrs);
+    free(names);
+    if (error) {
+        exml_free(doc);
+        return NULL;
+    }
+    return doc;
+}
+
+void exml_free(ExmlDocument *doc) {
+    if (!doc) return;
+    for (uint32_t i = 0; i < doc->childIndexCount; i++) {
+        hash_free(&doc->childIndexes[i].byName.table);
+        hash_free(&doc->childIndexes[i].byValue.table);
+    }
+    free(doc->childIndexes);
+    hash_free(&doc->nameIds);
+    free(doc->names);
+    free(doc->attrs);
+    free(doc->nodes);
+    free(doc->buffer);
+    arena_release(&doc->arena);
+    free(doc);
+}
+
+uint32_t exml_root(const ExmlDocument *doc) {
+    for (uint32_t id = doc->nodes[EXML_DOCUMENT_NODE].firstChild; id != EXML_NONE; id = doc->nodes[id].next) {
+        if (doc->nodes[id].type == EXML_ELEMENT) return id;
+    }
+    return EXML_NONE;
+}
+
+const char *exml_get_attr(const ExmlDocument *doc, uint32_t node, uint32_t name) {
+    const ExmlNode* n = &doc->nodes[node];
+    for (uint32_t i = 0; i < n->attrCount; i++) {
+        if (doc->attrs[n->attrs + i].name == name) return doc->attrs[n->attrs + i].value;
+    }
+    return NULL;
+}
+
+/**
+ * Drop a table of a child index.
+ *
+ * @param table     The table. It is rebuilt after EXML_INDEX_QUERIES more lookups.
+ */
+static void exml_drop_child_table(ExmlChildTable* table) {
+    hash_free(&table->table);
+    table->built = 0;
+    table->misses = 0;
+}
+
+/**
+ * Fill a table of a child index.
+ *
+ * @param doc       The document.
+ * @param node      The index of the node whose children are indexed.
+ * @param table     The table to fill.
+ * @param attr      The attribute used as key (EXML_NAME_NAME or EXML_NAME_VALUE).
+ *
+ * @return          0 on success, 1 on memory allocation errors.
+ *
+ * Only the first child with each key is stored, which is the one a linear scan would find.
+ */
+static int exml_build_child_table(ExmlDocument* doc, uint32_t node, ExmlChildTable* table, uint32_t attr) {
+    hash_free(&table->table);
+    for (uint32_t child = doc->nodes[node].firstChild; child != EXML_NONE; child = doc->nodes[child].next) {
+        const char* key = exml_get_attr(doc, child, attr);
+        if (key && !hash_get(&table->table, key) && hash_put(&table->table, key, (void*)(uintptr_t)(child + 1))) return 1;
+    }
+    table->built = 1;
+    return 0;
+}
+
+/**
+ * Get a table of the child index of a node for a lookup.
+ *
+ * @param doc       The document.
+ * @param node      The index of the node whose children are searched.
+ * @param byValue   1 to get the table keyed by "value", 0 for the one keyed by "name".
+ *
+ * @return          The table, or NULL if the caller should scan the children.
+ *
+ * As for the DOM, a table is only built for nodes with at least EXML_INDEX_MIN_CHILDREN element
+ * children, after EXML_INDEX_QUERIES lookups have scanned them.
+ */
+static HashTable* exml_get_child_table(ExmlDocument* doc, uint32_t node, int byValue) {
+    if (doc->nodes[node].index == EXML_NONE) {
+        if (doc->childIndexCount == doc->childIndexCapacity) {
+            uint32_t capacity = doc->childIndexCapacity ? doc->childIndexCapacity * 2 : 16;
+            ExmlChildIndex* indexes = realloc(doc->childIndexes, capacity * sizeof(ExmlChildIndex));
+            if (!indexes) return NULL;
+            doc->childIndexes = indexes;
+            doc->childIndexCapacity = capacity;
+        }
+        ExmlChildIndex* index = &doc->childIndexes[doc->childIndexCount];
+        memset(index, 0, sizeof(ExmlChildIndex));
+        index->wide = -1;
+        hash_init(&index->byName.table, NULL);
+        hash_init(&index->byValue.table, NULL);
+        doc->nodes[node].index = doc->childIndexCount++;
+    }
+
+    ExmlChildIndex* index = &doc->childIndexes[doc->nodes[node].index];
+    ExmlChildTable* table = byValue ? &index->byValue : &index->byName;
+    if (table->built) return &table->table;
+
+    if (!index->wide || table->misses < EXML_INDEX_QUERIES) {
+        table->misses++;
+        return NULL;
+    }
+
+    if (index->wide < 0) {
+        uint32_t count = 0;
+        for (uint32_t child = doc->nodes[node].firstChild; child != EXML_NONE; child = doc->nodes[child].next) {
+            if (doc->nodes[child].type == EXML_ELEMENT) count++;
+        }
+        index->wide = count >= EXML_INDEX_MIN_CHILDREN;
+        if (!index->wide) return NULL;
+    }
+
+    if (exml_build_child_table(doc, node, table, byValue ? EXML_NAME_VALUE : EXML_NAME_NAME)) {
+        exml_drop_child_table(table);
+        index->wide = 0;
+        return NULL;
+    }
+    return &table->table;
+}
+
+uint32_t exml_find_child(ExmlDocument *doc, uint32_t node, uint32_t attr, const char *value) {
+    HashTable* table = exml_get_child_table(doc, node, attr == EXML_NAME_VALUE);
+    if (table) {
+        uintptr_t child = (uintptr_t)hash_get(table, value);
+        return child ? (uint32_t)(child - 1) : EXML_NONE;
+    }
+
+    for (uint32_t child = doc->nodes[node].firstChild; child != EXML_NONE; child = doc->nodes[child].next) {
+        const char* text = exml_get_attr(doc, child, attr);
+        if (text && !strcmp(text, value)) return child;
+    }
+    return EXML_NONE;
+}
+
+int exml_set_value(ExmlDocument *doc, uint32_t node, const char *value) {
+    if (!value) value = "";
+
+    ExmlNode* n = &doc->nodes[node];
+    ExmlAttr* attr = NULL;
+    for (uint32_t i = 0; i < n->attrCount && !attr; i++) {
+        if (doc->attrs[n->attrs + i].name == EXML_NAME_VALUE) attr = &doc->attrs[n->attrs + i];
+    }
+
+    // Nothing to do if the value doesn't change
+    if (attr && !strcmp(attr->value, value)) return 0;
+
+    // The value index of the parent points to the old value
+    uint32_t parent = n->parent;
+    if (parent != EXML_NONE && doc->nodes[parent].index != EXML_NONE) {
+        ExmlChildIndex* index = &doc->childIndexes[doc->nodes[parent].index];
+        if (index->byValue.built) exml_drop_child_table(&index->byValue);
+    }
+
+    char* copy = arena_strdup(&doc->arena, value);
+    if (!copy) return 1;
+    doc->changed = 1;
+    if (attr) {
+        attr->value = copy;
+        return 0;
+    }
+    return exml_add_attr(doc, node, EXML_NAME_VALUE, copy);
+}
+
+uint32_t exml_append_property(ExmlDocument *doc, uint32_t parent, const char *name, const char *value) {
+    char* nameCopy = name ? arena_strdup(&doc->arena, name) : NULL;
+    char* valueCopy = value ? arena_strdup(&doc->arena, value) : NULL;
+    if ((name && !nameCopy) || (value && !valueCopy)) return EXML_NONE;
+
+    uint32_t child = exml_new_node(doc, EXML_ELEMENT, parent);
+    if (child == EXML_NONE) return EXML_NONE;
+    doc->changed = 1;
+    doc->nodes[child].name = EXML_NAME_PROPERTY;
+    if (nameCopy && exml_add_attr(doc, child, EXML_NAME_NAME, nameCopy)) return EXML_NONE;
+    if (valueCopy && exml_add_attr(doc, child, EXML_NAME_VALUE, valueCopy)) return EXML_NONE;
+
+    // Keep the child index of the parent up to date
+    if (doc->nodes[parent].index != EXML_NONE) {
+        ExmlChildIndex* index = &doc->childIndexes[doc->nodes[parent].index];
+        if (index->byName.built && nameCopy && !hash_get(&index->byName.table, nameCopy)) {
+            if (hash_put(&index->byName.table, nameCopy, (void*)(uintptr_t)(child + 1))) exml_drop_child_table(&index->byName);
+        }
+        if (index->byValue.built && valueCopy && !hash_get(&index->byValue.table, valueCopy)) {
+            if (hash_put(&index->byValue.table, valueCopy, (void*)(uintptr_t)(child + 1))) exml_drop_child_table(&index->byValue);
+        }
+    }
+    return child;
+}
+
+int exml_set_item(ExmlDocument *doc, uint32_t node, const char *name, const char *value) {
+    if (!name && !value)
+        return 0;
+
+    uint32_t child = name ? exml_find_child(doc, node, EXML_NAME_NAME, name)
+                          : exml_find_child(doc, node, EXML_NAME_VALUE, value);
+    if (child != EXML_NONE)
+        return exml_set_value(doc, child, value);
+
+    // Create a new node at the specified path
+    return exml_append_property(doc, node, name, value) == EXML_NONE;
+}
@@ -0,0 +1,268 @@
+/**
+ * @file exml.h
+ * @brief Compact document model for EXML files in the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * This header file declares a flat document model for the EXML files written by MBINCompiler, which
+ * are made of "Data" and "Property" elements with "name" and "value" attributes. The nodes are kept
+ * in a single array and linked by index, element and attribute names are interned as small ids, and
+ * attribute values point into the loaded file. It comes with its own parser and serializer, which
+ * write the same bytes libxml2 does, and with the Property operations used to apply modifications.
+ * The serializer can also save libxml2 documents made of the same kind of nodes, and documents can
+ * be saved to and loaded from binary snapshots.
+ *
+ * This file is part of the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 Juan José Ponteprino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author Juan José Ponteprino
+ * @date October 2023
+ */
+
+#ifndef __EXML_H
+#define __EXML_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <libxml/tree.h>
+
+#include "arena.h"
+#include "hashtable.h"
+
+/**
+ * Index of a missing node.
+ */
+#define EXML_NONE           0xffffffffU
+
+/**
+ * Index of the document node, the parent of the top-level nodes.
+ */
+#define EXML_DOCUMENT_NODE  0
+
+/**
+ * Ids of the names interned by every document.
+ */
+#define EXML_NAME_DATA      0
+#define EXML_NAME_PROPERTY  1
+#define EXML_NAME_NAME      2
+#define EXML_NAME_VALUE     3
+
+// Types of the nodes of an EXML document
+typedef enum {
+    EXML_DOCUMENT,
+    EXML_ELEMENT,
+    EXML_TEXT,
+    EXML_COMMENT
+} ExmlNodeType;
+
+// Structure to store an attribute of an element
+typedef struct ExmlAttr {
+    uint32_t name;          // interned name id
+    const char* value;      // null-terminated value, without entity references
+} ExmlAttr;
+
+// Structure to store a node of an EXML document
+typedef struct ExmlNode {
+    ExmlNodeType type;
+    uint32_t name;          // interned name id of elements
+    uint32_t parent;
+    uint32_t firstChild;
+    uint32_t lastChild;
+    uint32_t next;
+    uint32_t attrs;         // index of the first attribute of elements in the attribute array
+    uint32_t attrCount;
+    uint32_t index;         // child index of the node, EXML_NONE if it has none
+    uint32_t textLength;
+    const char* text;       // content of text and comment nodes (not null-terminated)
+} ExmlNode;
+
+struct ExmlChildIndex;
+
+// Structure to store an EXML document
+typedef struct ExmlDocument {
+    char * buffer;          // contents of the file; attribute values and texts point into it
+    size_t size;            // size of the file it was loaded from
+    ExmlNode * nodes;
+    uint32_t nodeCount;
+    uint32_t nodeCapacity;
+    ExmlAttr * attrs;
+    uint32_t attrCount;
+    uint32_t attrCapacity;
+    const char ** names;    // interned names, by id
+    uint32_t nameCount;
+    uint32_t nameCapacity;
+    HashTable nameIds;      // name -> id + 1
+    const char * version;
+    const char * encoding;
+    int standalone;         // -1 if the declaration doesn't say
+    struct ExmlChildIndex * childIndexes;
+    uint32_t childIndexCount;
+    uint32_t childIndexCapacity;
+    Arena arena;            // names and values set after loading
+    int changed;            // set when a value changes or a Property is appended after loading
+} ExmlDocument;
+
+/**
+ * Load an EXML file.
+ *
+ * Only the subset of XML written by MBINCompiler is accepted: a UTF-8 document with elements,
+ * attributes, text and comments, without namespaces, DTD, CDATA sections, processing instructions
+ * or entities other than the predefined ones and character references. Files outside of it, and
+ * files that are not well-formed, are left to libxml2.
+ *
+ * @param filename  The path of the file.
+ *
+ * @return          The document, or NULL if the file can't be read or isn't in the supported subset.
+ */
+ExmlDocument *exml_load(const char *filename);
+
+/**
+ * Save an EXML document.
+ *
+ * The output is the one xmlSaveFormatFile writes without formatting for the same document.
+ *
+ * @param doc       The document.
+ * @param filename  The path of the file to write.
+ *
+ * @return          0 on success, 1 on error.
+ */
+int exml_save(ExmlDocument *doc, const char *filename);
+
+/**
+ * Save a libxml2 document with the serializer of the compact model.
+ *
+ * The output is the one xmlSaveFormatFile writes without formatting. Only UTF-8 documents made of
+ * elements, attributes, text and comments without namespaces are supported; the caller saves the
+ * others with libxml2.
+ *
+ * @param doc       The document.
+ * @param filename  The path of the file to write.
+ *
+ * @return          0 on success, 1 if the document isn't supported or on error.
+ */
+int exml_save_dom(xmlDocPtr doc, const char *filename);
+
+/**
+ * Save a snapshot of an EXML document, to load it later without parsing the file again.
+ *
+ * The nodes and attributes are stored as compact records with offsets into the names and the texts
+ * they use, so that loading them only has to link the nodes again. The nodes and attributes must
+ * be in the order they were added, as they are after loading a file and appending Properties.
+ *
+ * @param doc       The document.
+ * @param filename  The path of the file to write.
+ *
+ * @return          0 on success, 1 if the nodes are out of order or on error.
+ */
+int exml_save_snapshot(const ExmlDocument *doc, const char *filename);
+
+/**
+ * Load an EXML document from a snapshot.
+ *
+ * @param filename  The path of the snapshot file.
+ * @param size      The size of the EXML file the snapshot must have been saved from.
+ *
+ * @return          The document, or NULL if the file can't be read, doesn't match the size or isn't
+ *                  valid.
+ */
+ExmlDocument *exml_load_snapshot(const char *filename, uint64_t size);
+
+/**
+ * Release an EXML document.
+ *
+ * @param doc       The document, or NULL.
+ */
+void exml_free(ExmlDocument *doc);
+
+/**
+ * Get the root element of a document.
+ *
+ * @param doc       The document.
+ *
+ * @return          The index of the root element, or EXML_NONE if there is none.
+ */
+uint32_t exml_root(const ExmlDocument *doc);
+
+/**
+ * Get the value of an attribute of an element.
+ *
+ * @param doc       The document.
+ * @param node      The index of the element.
+ * @param name      The interned name id of the attribute.
+ *
+ * @return          The value of the attribute, or NULL if the element doesn't have it.
+ */
+const char *exml_get_attr(const ExmlDocument *doc, uint32_t node, uint32_t name);
+
+/**
+ * Set the "value" attribute of a Property element, adding it if the element doesn't have it.
+ *
+ * @param doc       The document.
+ * @param node      The index of the element.
+ * @param value     The value to set (NULL sets an empty value). The string is copied.
+ *
+ * @return          0 on success, 1 on memory allocation errors.
+ */
+int exml_set_value(ExmlDocument *doc, uint32_t node, const char *value);
+
+/**
+ * Append a new Property element to a node.
+ *
+ * @param doc       The document.
+ * @param parent    The index of the parent node.
+ * @param name      The "name" attribute of the new element, or NULL. The string is copied.
+ * @param value     The "value" attribute of the new element, or NULL. The string is copied.
+ *
+ * @return          The index of the new element, or EXML_NONE on memory allocation errors.
+ */
+uint32_t exml_append_property(ExmlDocument *doc, uint32_t parent, const char *name, const char *value);
+
+/**
+ * Find the first child of a node with a given attribute value.
+ *
+ * Children of wide nodes that are looked up repeatedly are found through an index.
+ *
+ * @param doc       The document.
+ * @param node      The index of the node whose children are searched.
+ * @param attr      The attribute to compare (EXML_NAME_NAME or EXML_NAME_VALUE).
+ * @param value     The value to search for.
+ *
+ * @return          The index of the first matching child, or EXML_NONE if there is none.
+ */
+uint32_t exml_find_child(ExmlDocument *doc, uint32_t node, uint32_t attr, const char *value);
+
+/**
+ * Set the value of an item of a node.
+ *
+ * The first child whose "name" attribute (or "value" attribute, for items without a name)
+ * matches the item gets the value; if there is none, a new Property element is appended.
+ *
+ * @param doc       The document.
+ * @param node      The index of the node.
+ * @param name      The name of the item, or NULL.
+ * @param value     The value to set for the item, or NULL.
+ *
+ * @return          0 on success, 1 on memory allocation errors.
+ */
+int exml_set_item(ExmlDocument *doc, uint32_t node, const char *name, const char *value);
+
+#endif /* __EXML_H */
@@ -41,6 +41,9 @@
 #include <unistd.h>
 #include <libgen.h>
 #include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -48,8 +51,12 @@
 #define stat _stat
 #define mkdir(path, mode) _mkdir(path)
 #define snprintf _snprintf
+#else
+#include <sys/mman.h>
 #endif
 
+#include "hashtable.h"
+#include "misc.h"
 #include "fs_utils.h"
 
 #define MAX_SIZE 4096
@@ -100,6 +107,110 @@ char *get_current_dir() {
     return path;
 }
 
+/**
+ * Get the canonical absolute path of an existing file.
+ *
+ * This function resolves relative components, symbolic links (on Unix-like systems) and
+ * path separators, so that two different paths to the same file produce the same result.
+ *
+ * @param path  The path of the file.
+ *
+ * @return      A dynamically allocated string containing the canonical path,
+ *              or NULL if the file does not exist or on error.
+ */
+char *canonical_path(const char *path) {
+#ifdef _WIN32
+    char *resolved = _fullpath(NULL, path, 0);
+    if (!resolved) return NULL;
+    if (GetFileAttributesA(resolved) == INVALID_FILE_ATTRIBUTES) {
+        free(resolved);
+        return NULL;
+    }
+    // Windows paths are case insensitive
+    for (char *p = resolved; *p; p++) *p = tolower((unsigned char)*p);
+    return path_to_unix(NULL, resolved);
+#else
+    return realpath(path, NULL);
+#endif
+}
+
+/**
+ * Map the contents of a file into memory for reading.
+ *
+ * This function memory-maps the whole file read-only (on Windows through a file mapping object).
+ * The returned buffer is not null-terminated and must be released with unmap_file.
+ *
+ * @param path  The path of the file.
+ * @param size  A pointer where the size of the file in bytes is stored.
+ *
+ * @return      A pointer to the contents of the file, or NULL on error.
+ *              Empty files return a valid pointer and a size of 0.
+ */
+const char *map_file(const char *path, size_t *size) {
+    static const char empty[1] = "";
+    const char *buffer = NULL;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    *size = (size_t)fileSize.QuadPart;
+    if (!*size) {
+        CloseHandle(file);
+        return empty;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping) {
+        buffer = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return NULL;
+
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) || !S_ISREG(statbuf.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    *size = (size_t)statbuf.st_size;
+    if (!*size) {
+        close(fd);
+        return empty;
+    }
+
+    void *map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) buffer = map;
+    close(fd);
+#endif
+
+    return buffer;
+}
+
+/**
+ * Release a buffer returned by map_file.
+ *
+ * @param buffer    The buffer returned by map_file.
+ * @param size      The size returned by map_file.
+ */
+void unmap_file(const char *buffer, size_t size) {
+    if (!buffer || !size) return;
+#ifdef _WIN32
+    UnmapViewOfFile(buffer);
+#else
+    munmap((void *)buffer, size);
+#endif
+}
+
 /**
  * Convert a Windows-style path to a Unix-style path.
  *
@@ -226,6 +337,48 @@ int mkpath(const char *path, mode_t mode) {
     return (rv);
 }
 
+/**
+ * Create the directories a file goes in.
+ *
+ * This function creates the directory part of the path of a file, and its parent directories.
+ *
+ * @param path  The path of the file.
+ * @param mode  The permissions mode for the created directories.
+ *
+ * @return      0 on success, or if the path has no directory part, -1 on failure.
+ */
+int mkpath_parent(const char *path, mode_t mode) {
+    const char *slash = strrchr(path, '/');
+    if (!slash) return 0;
+
+    char *dir = malloc(slash - path + 1);
+    if (!dir) return -1;
+    memcpy(dir, path, slash - path);
+    dir[slash - path] = '\0';
+
+    int rv = mkpath(dir, mode);
+    free(dir);
+    return rv;
+}
+
+/**
+ * Move a file to a new path, replacing the file there, if any.
+ *
+ * rename() doesn't replace existing files on Windows, where the file is moved with MoveFileEx.
+ *
+ * @param source    The path of the file to move.
+ * @param dest      The path to move it to.
+ *
+ * @return          0 on success, -1 on failure.
+ */
+int replace_file(const char *source, const char *dest) {
+#ifdef _WIN32
+    return MoveFileExA(source, dest, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+#else
+    return rename(source, dest) ? -1 : 0;
+#endif
+}
+
 #ifdef _WIN32
 /**
  * Create a unique temporary directory.
@@ -386,12 +539,76 @@ int copy_file(const char* source, const char* dest) {
     char buffer[MAX_SIZE];
     size_t bytesRead;
 
+    int result = 1;
     while ((bytesRead = fread(buffer, 1, sizeof(buffer), srcFile)) > 0) {
-        fwrite(buffer, 1, bytesRead, destFile);
+        if (fwrite(buffer, 1, bytesRead, destFile) != bytesRead) {
+            result = 0; // Failed to write the destination file
+            break;
+        }
     }
+    if (ferror(srcFile)) result = 0;
 
     fclose(srcFile);
-    fclose(destFile);
+    if (fclose(destFile)) result = 0;
+
+    return result; // 1 if the file copy was successful
+}
+
+/**
+ * Compute the identity of a file from its canonical path, size and modification time.
+ *
+ * @param path      The path of the file.
+ * @param id        Where the identity is stored.
+ *
+ * @return          0 on success, 1 if the file doesn't exist or on error.
+ */
+int file_identity(const char* path, uint64_t* id) {
+    char* canonical = canonical_path(path);
+    struct stat st;
+    if (!canonical || stat(canonical, &st)) {
+        free(canonical);
+        return 1;
+    }
+
+    long long size = (long long) st.st_size;
+    long long mtime = (long long) st.st_mtime;
+    uint64_t hash = hash_bytes(canonical, strlen(canonical), HASH_SEED);
+    hash = hash_bytes(&size, sizeof(size), hash);
+    *id = hash_bytes(&mtime, sizeof(mtime), hash);
+
+    free(canonical);
+    return 0;
+}
+
+/**
+ * Find the executable file a program is started from, the way spawnvp() does.
+ *
+ * @param name      The name or path of the program.
+ *
+ * @return          A dynamically allocated string containing the path of the file, or NULL if
+ *                  it can't be found.
+ */
+char* find_program(const char* name) {
+    char path[MAX_PATH];
+#ifdef _WIN32
+    DWORD length = SearchPathA(NULL, name, ".exe", sizeof(path), path, NULL);
+    if (!length || length >= sizeof(path)) return NULL;
+    return strdup(path);
+#else
+    if (strchr(name, '/')) return strdup(name);
 
-    return 1; // File copy successful
+    const char* dirs = getenv("PATH");
+    while (dirs && *dirs) {
+        const char* end = strchr(dirs, ':');
+        if (!end) end = dirs + strlen(dirs);
+
+        // Empty entries stand for the current directory
+        int length = (int) (end - dirs);
+        snprintf(path, sizeof(path), "%.*s/%s", length ? length : 1, length ? dirs : ".", name);
+        if (!access(path, X_OK)) return strdup(path);
+
+        dirs = *end ? end + 1 : end;
+    }
+    return NULL;
+#endif
 }
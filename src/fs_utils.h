@@ -37,6 +37,7 @@
 #ifndef __FS_UTILS_H
 #define __FS_UTILS_H
 
+#include <stdint.h>
 #include <sys/types.h>
 
 #ifdef _WIN32
@@ -70,6 +71,41 @@ const char *tempdir();
  */
 char *get_current_dir();
 
+/**
+ * Get the canonical absolute path of an existing file.
+ *
+ * This function resolves relative components, symbolic links (on Unix-like systems) and
+ * path separators, so that two different paths to the same file produce the same result.
+ *
+ * @param path              The path of the file.
+ *
+ * @return                  A dynamically allocated string containing the canonical path,
+ *                          or NULL if the file does not exist or on error.
+ */
+char *canonical_path(const char *path);
+
+/**
+ * Map the contents of a file into memory for reading.
+ *
+ * This function memory-maps the whole file read-only (on Windows through a file mapping object).
+ * The returned buffer is not null-terminated and must be released with unmap_file.
+ *
+ * @param path              The path of the file.
+ * @param size              A pointer where the size of the file in bytes is stored.
+ *
+ * @return                  A pointer to the contents of the file, or NULL on error.
+ *                          Empty files return a valid pointer and a size of 0.
+ */
+const char *map_file(const char *path, size_t *size);
+
+/**
+ * Release a buffer returned by map_file.
+ *
+ * @param buffer            The buffer returned by map_file.
+ * @param size              The size returned by map_file.
+ */
+void unmap_file(const char *buffer, size_t size);
+
 #ifdef _WIN32
 /**
  * Change the current working directory.
@@ -113,6 +149,30 @@ char* mkdtemp(char* template);
  */
 int mkpath(const char *path, mode_t mode);
 
+/**
+ * Create the directories a file goes in.
+ *
+ * This function creates the directory part of the path of a file, and its parent directories.
+ *
+ * @param path  The path of the file.
+ * @param mode  The permissions mode for the created directories.
+ *
+ * @return      0 on success, or if the path has no directory part, -1 on failure.
+ */
+int mkpath_parent(const char *path, mode_t mode);
+
+/**
+ * Move a file to a new path, replacing the file there, if any.
+ *
+ * rename() doesn't replace existing files on Windows, where the file is moved with MoveFileEx.
+ *
+ * @param source    The path of the file to move.
+ * @param dest      The path to move it to.
+ *
+ * @return          0 on success, -1 on failure.
+ */
+int replace_file(const char *source, const char *dest);
+
 /**
  * Recursively remove a directory and its contents.
  *
@@ -174,4 +234,29 @@ char *path_to_unix(const char* path, char *converted_path);
 
 char *path_to_dos(const char* path, char *converted_path);
 
+/**
+ * Compute the identity of a file.
+ *
+ * The identity is a hash of the canonical path, size and modification time of the file, which
+ * changes whenever the file is replaced or written to.
+ *
+ * @param path              The path of the file.
+ * @param id                Where the identity is stored.
+ *
+ * @return                  0 on success, 1 if the file doesn't exist or on error.
+ */
+int file_identity(const char *path, uint64_t *id);
+
+/**
+ * Find the executable file a program is started from.
+ *
+ * Names without a directory are searched in the PATH, the way spawnvp does.
+ *
+ * @param name              The name or path of the program.
+ *
+ * @return                  A dynamically allocated string containing the path of the file,
+ *                          or NULL if it can't be found.
+ */
+char *find_program(const char *name);
+
 #endif /* __FS_UTILS_H */
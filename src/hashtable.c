@@ -0,0 +1,168 @@
+/**
+ * @file hashtable.c
+ * @brief Implementation of the string-keyed hash table for the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * This source file contains the implementation of the open addressing hash table and the hash functions
+ * used within the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * This file is part of the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 Juan José Ponteprino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author Juan José Ponteprino
+ * @date October 2023
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashtable.h"
+
+/**
+ * Initial number of slots of a hash table. Must be a power of two.
+ */
+#define HASH_INITIAL_CAPACITY   16
+
+/**
+ * Compute the 64-bit FNV-1a hash of a buffer.
+ *
+ * @param data  The buffer to hash.
+ * @param size  The size of the buffer in bytes.
+ * @param seed  The initial hash value, or the result of a previous call to continue a hash.
+ *
+ * @return      The hash value.
+ */
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* p = data;
+    uint64_t hash = seed;
+    while (size--) {
+        hash ^= *p++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Initialize an empty hash table.
+ *
+ * Keys are not copied; they must remain valid while they are stored in the table.
+ *
+ * @param table The hash table to initialize.
+ * @param arena The arena used for the slots, or NULL to use the heap. Slots taken from
+ *              an arena are released with the arena, and hash_free does nothing for them.
+ */
+void hash_init(HashTable* table, Arena* arena) {
+    table->entries = NULL;
+    table->capacity = 0;
+    table->count = 0;
+    table->arena = arena;
+}
+
+/**
+ * Find the slot of a key, or the empty slot where it should be inserted.
+ *
+ * @param entries   The slots of the table.
+ * @param capacity  The number of slots (a power of two).
+ * @param key       The key to search for.
+ * @param hash      The hash of the key.
+ *
+ * @return          A pointer to the slot.
+ */
+static HashEntry* hash_find_slot(HashEntry* entries, size_t capacity, const char* key, size_t hash) {
+    size_t i = hash & (capacity - 1);
+    while (entries[i].key) {
+        if (entries[i].hash == hash && !strcmp(entries[i].key, key)) break;
+        i = (i + 1) & (capacity - 1);
+    }
+    return &entries[i];
+}
+
+/**
+ * Look up a key in a hash table.
+ *
+ * @param table The hash table.
+ * @param key   The key to search for.
+ *
+ * @return      The value stored for the key, or NULL if the key is not present.
+ */
+void* hash_get(const HashTable* table, const char* key) {
+    if (!table->count) return NULL;
+    HashEntry* entry = hash_find_slot(table->entries, table->capacity, key, (size_t)hash_string(key));
+    return entry->key ? entry->value : NULL;
+}
+
+/**
+ * Insert or replace a key in a hash table.
+ *
+ * The table grows to twice its size when it becomes half full.
+ *
+ * @param table The hash table.
+ * @param key   The key to store.
+ * @param value The value to store for the key.
+ *
+ * @return      0 on success, -1 on memory allocation errors.
+ */
+int hash_put(HashTable* table, const char* key, void* value) {
+    if ((table->count + 1) * 2 > table->capacity) {
+        size_t capacity = table->capacity ? table->capacity * 2 : HASH_INITIAL_CAPACITY;
+        HashEntry* entries = table->arena ? arena_calloc(table->arena, capacity * sizeof(HashEntry))
+                                          : calloc(capacity, sizeof(HashEntry));
+        if (!entries) return -1;
+
+        // Rehash the stored keys into the new slots
+        for (size_t i = 0; i < table->capacity; i++) {
+            if (table->entries[i].key) {
+                *hash_find_slot(entries, capacity, table->entries[i].key, table->entries[i].hash) = table->entries[i];
+            }
+        }
+
+        if (!table->arena) free(table->entries);
+        table->entries = entries;
+        table->capacity = capacity;
+    }
+
+    size_t hash = (size_t)hash_string(key);
+    HashEntry* entry = hash_find_slot(table->entries, table->capacity, key, hash);
+    if (!entry->key) {
+        entry->key = key;
+        entry->hash = hash;
+        table->count++;
+    }
+    entry->value = value;
+
+    return 0;
+}
+
+/**
+ * Release the slots of a hash table allocated from the heap.
+ *
+ * The table is left empty and can be reused.
+ *
+ * @param table The hash table.
+ */
+void hash_free(HashTable* table) {
+    if (!table->arena) free(table->entries);
+    table->entries = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
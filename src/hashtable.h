@@ -0,0 +1,127 @@
+/**
+ * @file hashtable.h
+ * @brief String-keyed hash table for the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * This header file declares an open addressing hash table that maps strings to pointers, used within
+ * the No Man's Sky Mod Creator (nmsmc) project to index definition data and XML nodes by name.
+ * It also provides the hash functions used by the project.
+ *
+ * This file is part of the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 Juan José Ponteprino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author Juan José Ponteprino
+ * @date October 2023
+ */
+
+#ifndef __HASHTABLE_H
+#define __HASHTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.h"
+
+// Structure to store a hash table slot
+typedef struct HashEntry {
+    const char* key;
+    size_t hash;
+    void* value;
+} HashEntry;
+
+// Structure to store a hash table
+typedef struct HashTable {
+    HashEntry * entries;
+    size_t capacity;
+    size_t count;
+    Arena * arena;
+} HashTable;
+
+/**
+ * Initialize an empty hash table.
+ *
+ * Keys are not copied; they must remain valid while they are stored in the table.
+ *
+ * @param table The hash table to initialize.
+ * @param arena The arena used for the slots, or NULL to use the heap. Slots taken from
+ *              an arena are released with the arena, and hash_free does nothing for them.
+ */
+void hash_init(HashTable* table, Arena* arena);
+
+/**
+ * Look up a key in a hash table.
+ *
+ * @param table The hash table.
+ * @param key   The key to search for.
+ *
+ * @return      The value stored for the key, or NULL if the key is not present.
+ */
+void* hash_get(const HashTable* table, const char* key);
+
+/**
+ * Insert or replace a key in a hash table.
+ *
+ * @param table The hash table.
+ * @param key   The key to store.
+ * @param value The value to store for the key.
+ *
+ * @return      0 on success, -1 on memory allocation errors.
+ */
+int hash_put(HashTable* table, const char* key, void* value);
+
+/**
+ * Release the slots of a hash table allocated from the heap.
+ *
+ * The table is left empty and can be reused.
+ *
+ * @param table The hash table.
+ */
+void hash_free(HashTable* table);
+
+/**
+ * Compute the 64-bit FNV-1a hash of a buffer.
+ *
+ * @param data  The buffer to hash.
+ * @param size  The size of the buffer in bytes.
+ * @param seed  The initial hash value, or the result of a previous call to continue a hash.
+ *
+ * @return      The hash value.
+ */
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed);
+
+/**
+ * Initial value for hash_bytes.
+ */
+#define HASH_SEED   0xcbf29ce484222325ULL
+
+/**
+ * Compute the hash of a string.
+ *
+ * @param str   The string to hash.
+ *
+ * @return      The hash value.
+ */
+#define hash_string(str)    hash_bytes((str), strlen(str), HASH_SEED)
+
+#endif /* __HASHTABLE_H */
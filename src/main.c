@@ -37,11 +37,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <limits.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 #include <libxml/xpath.h>
 
 //#include "definition.h"
+#include "cache.h"
+#include "manifest.h"
 #include "fs_utils.h"
 #include "misc.h"
 #include "definition.h"
@@ -51,6 +54,12 @@ char tmpdir_template[MAX_PATH];
 char* MBINCompiler = NULL;
 char* PSAR = NULL;
 char* tmpdir = NULL;
+int streamMode = 0;
+int maxResident = 0;
+int jobs = 1;
+int useCache = 1;
+int forceBuild = 0;
+const char* cacheDir = NULL;
 
 OutputPakFileData* outputPakFileList = NULL;
 
@@ -58,6 +67,9 @@ void cleanup() {
     // Clean up resources and reset data structures related to file definitions
     definition_cleanup(outputPakFileList);
 
+    // Release the cache of extracted and decompiled files
+    cache_cleanup();
+
     // Free dynamically allocated memory
     free(MBINCompiler);
     free(PSAR);
@@ -82,11 +94,27 @@ void displayHelp() {
     printf("No Man's Sky Mod Creator v1.0 - (c) 2023 Juan José Ponteprino (SplinterGU)\n\n");
     printf("Usage: nmsmc [OPTIONS] <definition_file>\n\n");
     printf("Examples:\n");
-    printf("  nmsmc modification.def  - Create a mod using 'modification.def' as the definition file\n");
-    printf("  nmsmc -V                - Display the version information\n\n");
+    printf("  nmsmc modification.def      - Create a mod using 'modification.def' as the definition file\n");
+    printf("  nmsmc -s modification.def   - Create the same mod, streaming the EXML files\n");
+    printf("  nmsmc -j 4 modification.def - Create the same mod, extracting 4 PAK files at once\n");
+    printf("  nmsmc -V                    - Display the version information\n\n");
     printf("Options:\n");
     printf("  -h, --help        Show this help message and exit\n");
-    printf("  -V, --version     Show version information\n\n");
+    printf("  -V, --version     Show version information\n");
+    printf("  -s, --stream      Patch the EXML files while reading them, without loading\n");
+    printf("                    whole documents in memory\n");
+    printf("  -j, --jobs N      Run up to N psar and MBINCompiler processes and patch up\n");
+    printf("                    to N input PAK files at once, and split MBINCompiler\n");
+    printf("                    batches in up to N (default 1)\n");
+    printf("  -r, --max-resident N\n");
+    printf("                    Keep at most N EXML documents loaded at once, across all\n");
+    printf("                    the patch threads (no limit by default; each one is\n");
+    printf("                    released as soon as it is saved)\n");
+    printf("  --cache-dir DIR   Keep the extracted MBIN files and their EXML files in DIR\n");
+    printf("                    (default: $XDG_CACHE_HOME/nmsmc or ~/.cache/nmsmc)\n");
+    printf("  --no-cache        Don't read or write the cache of extracted files\n");
+    printf("  -f, --force       Build every output PAK file, even the ones whose manifest\n");
+    printf("                    says they are up to date\n\n");
     printf("This software is provided under the terms of the MIT License.\n");
     printf("You may freely use, modify, and distribute this software, subject\n");
     printf("to the conditions and limitations of the MIT License.\n\n");
@@ -116,6 +144,39 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
+    // Parse the options before the definition file
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--stream") == 0) {
+            streamMode = 1;
+        } else if ((strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--max-resident") == 0) && i + 1 < argc - 1) {
+            char *end;
+            long n = strtol(argv[++i], &end, 10);
+            if (*end || n < 1 || n > INT_MAX) {
+                fprintf(stderr, "nmsmc: invalid number of documents '%s'\n", argv[i]);
+                return 1;
+            }
+            maxResident = (int) n;
+        } else if ((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) && i + 1 < argc - 1) {
+            char *end;
+            long n = strtol(argv[++i], &end, 10);
+            if (*end || n < 1 || n > INT_MAX) {
+                fprintf(stderr, "nmsmc: invalid number of jobs '%s'\n", argv[i]);
+                return 1;
+            }
+            jobs = (int) n;
+        } else if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc - 1) {
+            cacheDir = argv[++i];
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            useCache = 0;
+        } else if (strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--force") == 0) {
+            forceBuild = 1;
+        } else {
+            fprintf(stderr, "nmsmc: unknown option '%s'\n", argv[i]);
+            fprintf(stderr, "Try 'nmsmc --help' for more information.\n");
+            return 1;
+        }
+    }
+
     // Initialize the libxml2 library
     xmlInitParser();
 
@@ -125,17 +186,20 @@ int main(int argc, char* argv[]) {
     // Register the signal handler for SIGINT (Ctrl+C)
     signal(SIGINT, sigintHandler);
  
-    char *t = (char *) tempdir();
-
-#ifdef _WIN32
-    path_to_unix(NULL, t);
-#endif
+    // The temporary directory is kept as an absolute path, so that relative TMPDIR values don't
+    // depend on the directory psar and MBINCompiler run in
+    char *t = canonical_path(tempdir());
+    if (!t) {
+        fprintf(stderr, "Can't find the temporary directory: %s\n", tempdir());
+        return 1;
+    }
 
     char tail = t[strlen(t)-1];
 
-    sprintf(tmpdir_template,"%s%sNMSMC_XXXXXX", t, tail == '/' ? "" : "/");
+    int length = snprintf(tmpdir_template, sizeof(tmpdir_template), "%s%sNMSMC_XXXXXX", t, tail == '/' ? "" : "/");
+    free(t);
 
-    if (!(tmpdir = mkdtemp(tmpdir_template))) {
+    if (length >= (int) sizeof(tmpdir_template) || !(tmpdir = mkdtemp(tmpdir_template))) {
         fprintf(stderr, "Can't create a temporary directory\n");
         return 1;
     }
@@ -144,11 +208,21 @@ int main(int argc, char* argv[]) {
     MBINCompiler = strdup("MBINCompiler");
     PSAR = strdup("psar");
 
+    // Open the cache of extracted and decompiled files; without it, every MBIN is extracted again
+    if (useCache) cache_init(cacheDir);
+
+    // Find the tools recorded in the manifests of the output PAK files
+    manifest_init(argv[0]);
+
     const char* definitionFile = argv[argc - 1];
 
-    // Process the definition file
-    outputPakFileList = parse_definition(definitionFile, NULL);
-    process_definitions(outputPakFileList);
+    // Load the precompiled definition, or parse the definition file and precompile it
+    outputPakFileList = load_definition_cache(definitionFile);
+    if (!outputPakFileList) {
+        outputPakFileList = parse_definition(definitionFile, NULL);
+        save_definition_cache(definitionFile, outputPakFileList);
+    }
 
-    return 0;
+    // Process the definition file
+    return process_definitions(outputPakFileList);
 }
@@ -0,0 +1,263 @@
+/**
+ * @file manifest.c
+ * @brief Build manifests of the output PAK files for the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * This source file implements the manifests written next to the output PAK files, which tell
+ * whether they have to be built again.
+ *
+ * This file is part of the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 Juan José Ponteprino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author Juan José Ponteprino
+ * @date October 2023
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "common.h"
+#include "fs_utils.h"
+#include "hashtable.h"
+#include "misc.h"
+#include "manifest.h"
+
+/**
+ * First line of the manifests; changing it builds every output PAK file again.
+ */
+#define MANIFEST_HEADER     "nmsmc manifest 1\n"
+
+// Number of tools recorded in the manifests
+#define MANIFEST_TOOLS      3
+
+// Names and identities of the tools
+static const char* toolNames[MANIFEST_TOOLS] = { "nmsmc", "MBINCompiler", "psar" };
+static uint64_t toolIds[MANIFEST_TOOLS];
+
+/**
+ * Get the identity of a tool.
+ *
+ * @param name      The name or path of the program.
+ *
+ * @return          Its identity, or 0 if it can't be found.
+ */
+static uint64_t tool_identity(const char* name) {
+    uint64_t id = 0;
+    char* path = find_program(name);
+    if (!path || file_identity(path, &id)) id = 0;
+    free(path);
+    return id;
+}
+
+/**
+ * Find the tools the output PAK files are built with.
+ *
+ * @param program   The path nmsmc was started from (argv[0]).
+ */
+void manifest_init(const char* program) {
+    toolIds[0] = tool_identity(program);
+    toolIds[1] = tool_identity(MBINCompiler);
+    toolIds[2] = tool_identity(PSAR);
+}
+
+/**
+ * Get the name of the manifest of an output PAK file.
+ *
+ * @param pakFile   The path of the output PAK file.
+ * @param name      A buffer of MAX_PATH characters for the name of the manifest.
+ *
+ * @return          0 on success, 1 if the name is too long.
+ */
+static int get_manifest_name(const char* pakFile, char* name) {
+    return snprintf(name, MAX_PATH, "%s.manifest", pakFile) >= MAX_PATH;
+}
+
+/**
+ * Append text to a manifest.
+ *
+ * @param manifest  The manifest.
+ * @param text      The text.
+ * @param length    The length of the text.
+ *
+ * @return          0 on success, 1 on memory allocation errors.
+ */
+static int manifest_append(Manifest* manifest, const char* text, size_t length) {
+    if (manifest->length + length > manifest->capacity) {
+        size_t capacity = manifest->capacity ? manifest->capacity * 2 : 1024;
+        while (capacity < manifest->length + length) capacity *= 2;
+        char* t = realloc(manifest->text, capacity);
+        if (!t) return 1;
+        manifest->text = t;
+        manifest->capacity = capacity;
+    }
+    memcpy(manifest->text + manifest->length, text, length);
+    manifest->length += length;
+    return 0;
+}
+
+/**
+ * Start the manifest of an output PAK file, with the identities of the tools.
+ *
+ * @param manifest  The manifest; release it with manifest_free().
+ *
+ * @return          0 on success, 1 on memory allocation errors.
+ */
+int manifest_create(Manifest* manifest) {
+    memset(manifest, 0, sizeof(Manifest));
+    int error = manifest_append(manifest, MANIFEST_HEADER, strlen(MANIFEST_HEADER));
+    for (int i = 0; i < MANIFEST_TOOLS && !error; i++) error = manifest_add(manifest, "tool", toolIds[i], toolNames[i]);
+    return error;
+}
+
+/**
+ * Add an entry to a manifest, as a line with its kind, hash and name.
+ *
+ * @param manifest  The manifest.
+ * @param kind      The kind of the entry.
+ * @param hash      The hash of what the entry stands for.
+ * @param name      The name of the entry, or NULL.
+ *
+ * @return          0 on success, 1 on memory allocation errors.
+ */
+int manifest_add(Manifest* manifest, const char* kind, uint64_t hash, const char* name) {
+    char line[64];
+    int length = snprintf(line, sizeof(line), "%s %016llx%s", kind, (unsigned long long) hash, name ? " " : "");
+    if (length < 0 || length >= (int) sizeof(line)) return 1;
+    return manifest_append(manifest, line, length) ||
+           (name && manifest_append(manifest, name, strlen(name))) ||
+           manifest_append(manifest, "\n", 1);
+}
+
+/**
+ * Add a file to a manifest by its contents.
+ *
+ * @param manifest  The manifest.
+ * @param kind      The kind of the entry.
+ * @param path      The path of the file.
+ *
+ * @return          0 on success, 1 on memory allocation errors.
+ */
+int manifest_add_file(Manifest* manifest, const char* kind, const char* path) {
+    uint64_t hash = 0;
+    size_t size;
+    const char* buffer = map_file(path, &size);
+    if (buffer) {
+        hash = hash_bytes(&size, sizeof(size), hash_bytes(buffer, size, HASH_SEED));
+        unmap_file(buffer, size);
+    }
+    return manifest_add(manifest, kind, hash, path);
+}
+
+/**
+ * Add a file to a manifest by its identity.
+ *
+ * @param manifest  The manifest.
+ * @param kind      The kind of the entry.
+ * @param path      The path of the file.
+ *
+ * @return          0 on success, 1 on memory allocation errors.
+ */
+int manifest_add_identity(Manifest* manifest, const char* kind, const char* path) {
+    uint64_t id;
+    if (file_identity(path, &id)) id = 0;
+    return manifest_add(manifest, kind, id, path);
+}
+
+/**
+ * Get the last line of the manifest of an output PAK file, with the identity of the PAK file.
+ *
+ * @param pakFile   The path of the output PAK file.
+ * @param line      A buffer of 64 characters for the line.
+ *
+ * @return          The length of the line, or 0 if the PAK file doesn't exist.
+ */
+static int get_output_line(const char* pakFile, char* line) {
+    uint64_t id;
+    if (file_identity(pakFile, &id)) return 0;
+    return snprintf(line, 64, "output %016llx\n", (unsigned long long) id);
+}
+
+/**
+ * Check whether an output PAK file was built from what a manifest records.
+ *
+ * @param manifest  The manifest of the next build.
+ * @param pakFile   The path of the output PAK file.
+ *
+ * @return          1 if the PAK file is there, unchanged, and its manifest is the same; 0 otherwise.
+ */
+int manifest_unchanged(const Manifest* manifest, const char* pakFile) {
+    char name[MAX_PATH];
+    char line[64];
+    int length = get_output_line(pakFile, line);
+    if (!length || get_manifest_name(pakFile, name)) return 0;
+
+    size_t size;
+    const char* buffer = map_file(name, &size);
+    if (!buffer) return 0;
+
+    int unchanged = size == manifest->length + length &&
+                    !memcmp(buffer, manifest->text, manifest->length) &&
+                    !memcmp(buffer + manifest->length, line, length);
+    unmap_file(buffer, size);
+    return unchanged;
+}
+
+/**
+ * Write the manifest of an output PAK file once it is built.
+ *
+ * @param manifest  The manifest.
+ * @param pakFile   The path of the output PAK file.
+ *
+ * @return          0 on success, 1 on error.
+ *
+ * The manifest ends with the identity of the PAK file, so that a PAK file changed or replaced
+ * afterwards is built again.
+ */
+int manifest_save(const Manifest* manifest, const char* pakFile) {
+    char name[MAX_PATH];
+    char line[64];
+    int length = get_output_line(pakFile, line);
+    if (!length || get_manifest_name(pakFile, name)) return 1;
+
+    FILE* file = fopen(name, "wb");
+    if (!file) return 1;
+
+    int error = fwrite(manifest->text, 1, manifest->length, file) != manifest->length ||
+                fwrite(line, 1, length, file) != (size_t) length;
+    error |= fclose(file) != 0;
+    if (error) remove(name);
+    return error;
+}
+
+/**
+ * Release a manifest.
+ *
+ * @param manifest  The manifest.
+ */
+void manifest_free(Manifest* manifest) {
+    free(manifest->text);
+    memset(manifest, 0, sizeof(Manifest));
+}
@@ -0,0 +1,135 @@
+/**
+ * @file manifest.h
+ * @brief Build manifests of the output PAK files for the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * This header file declares the manifests written next to the output PAK files. A manifest records
+ * what an output PAK file was built from: the tools, its resolved definition, the identities of its
+ * input PAK files, the contents of its extra files and the identity of the PAK file itself. When the
+ * manifest of the next build is the same, the output PAK file is up to date and isn't built again.
+ *
+ * This file is part of the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 Juan José Ponteprino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author Juan José Ponteprino
+ * @date October 2023
+ */
+
+#ifndef __MANIFEST_H
+#define __MANIFEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Structure to store a manifest while it is built
+typedef struct Manifest {
+    char * text;
+    size_t length;
+    size_t capacity;
+} Manifest;
+
+/**
+ * Find the tools the output PAK files are built with.
+ *
+ * The identities of nmsmc, MBINCompiler and psar are recorded in every manifest, so that a new
+ * version of any of them builds everything again. Tools that can't be found get a null identity.
+ *
+ * @param program   The path nmsmc was started from (argv[0]).
+ */
+void manifest_init(const char *program);
+
+/**
+ * Start the manifest of an output PAK file, with the identities of the tools.
+ *
+ * @param manifest  The manifest; release it with manifest_free().
+ *
+ * @return          0 on success, 1 on memory allocation errors.
+ */
+int manifest_create(Manifest *manifest);
+
+/**
+ * Add an entry to a manifest.
+ *
+ * @param manifest  The manifest.
+ * @param kind      The kind of the entry.
+ * @param hash      The hash of what the entry stands for.
+ * @param name      The name of the entry, or NULL.
+ *
+ * @return          0 on success, 1 on memory allocation errors.
+ */
+int manifest_add(Manifest *manifest, const char *kind, uint64_t hash, const char *name);
+
+/**
+ * Add a file to a manifest by its contents.
+ *
+ * Files that can't be read get a null hash.
+ *
+ * @param manifest  The manifest.
+ * @param kind      The kind of the entry.
+ * @param path      The path of the file.
+ *
+ * @return          0 on success, 1 on memory allocation errors.
+ */
+int manifest_add_file(Manifest *manifest, const char *kind, const char *path);
+
+/**
+ * Add a file to a manifest by its identity (canonical path, size and modification time).
+ *
+ * Used for the input PAK files, which are too big to be read. Missing files get a null identity.
+ *
+ * @param manifest  The manifest.
+ * @param kind      The kind of the entry.
+ * @param path      The path of the file.
+ *
+ * @return          0 on success, 1 on memory allocation errors.
+ */
+int manifest_add_identity(Manifest *manifest, const char *kind, const char *path);
+
+/**
+ * Check whether an output PAK file was built from what a manifest records.
+ *
+ * @param manifest  The manifest of the next build.
+ * @param pakFile   The path of the output PAK file.
+ *
+ * @return          1 if the PAK file is there, unchanged, and its manifest is the same; 0 otherwise.
+ */
+int manifest_unchanged(const Manifest *manifest, const char *pakFile);
+
+/**
+ * Write the manifest of an output PAK file once it is built, next to it ("mod.pak.manifest").
+ *
+ * @param manifest  The manifest.
+ * @param pakFile   The path of the output PAK file.
+ *
+ * @return          0 on success, 1 on error.
+ */
+int manifest_save(const Manifest *manifest, const char *pakFile);
+
+/**
+ * Release a manifest.
+ *
+ * @param manifest  The manifest.
+ */
+void manifest_free(Manifest *manifest);
+
+#endif /* __MANIFEST_H */
@@ -46,29 +46,15 @@
 #endif
 
 /**
- * Constants for specifying standard device file paths on different platforms.
- * These constants define paths for the console and null devices for both Windows and Unix-like systems.
+ * Constant for specifying the null device path on different platforms.
+ * It is used to discard the output of the psar and MBINCompiler processes.
  */
 #ifdef _WIN32
-#define DEVCONSOLE     "CON"
 #define DEVNULL        "NUL"
 #else
-#define DEVCONSOLE     "/dev/tty"
 #define DEVNULL        "/dev/null"
 #endif
 
-/**
- * Macro for disabling console output by redirecting stdout and stderr to the null device.
- * Use this macro to suppress console output temporarily.
- */
-#define DISABLE_CONSOLE     freopen(DEVNULL, "w", stdout); freopen(DEVNULL, "w", stderr);
-
-/**
- * Macro for enabling console output by redirecting stdout and stderr back to the console.
- * Use this macro to restore console output after it has been disabled.
- */
-#define ENABLE_CONSOLE      freopen(DEVCONSOLE, "w", stdout); freopen(DEVCONSOLE, "w", stderr);
-
 /**
  * Trim leading and trailing white spaces from a string.
  *
@@ -36,13 +36,23 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
-#include <errno.h>
+#endif
 
+#include "misc.h"
 #include "spawn.h"
 
+#ifndef _WIN32
+
 /**
  * Spawns a new process using the provided path.
  *
@@ -132,3 +142,115 @@ int spawnvp(int mode, const char* file, char* const argv[]) {
         exit(EXIT_FAILURE);
     }
 }
+#endif
+
+#ifdef _WIN32
+/**
+ * Quote an argument for a Windows command line, the way the C runtime splits it again.
+ *
+ * @param arg The argument.
+ * @param out The buffer where the quoted argument is written, or NULL to only measure it.
+ * @return Returns the length of the quoted argument.
+ */
+static size_t quote_argument(const char* arg, char* out) {
+    size_t length = 0;
+#define PUT(c)  do { if (out) out[length] = (c); length++; } while (0)
+
+    if (*arg && !strpbrk(arg, " \t\"")) {
+        while (*arg) PUT(*arg++);
+        return length;
+    }
+
+    PUT('"');
+    for (;; arg++) {
+        size_t backslashes = 0;
+        while (*arg == '\\') {
+            backslashes++;
+            arg++;
+        }
+        if (!*arg) {
+            // Backslashes before the closing quote are doubled
+            while (backslashes--) { PUT('\\'); PUT('\\'); }
+            break;
+        }
+        if (*arg == '"') {
+            // Backslashes before a quote are doubled, and the quote is escaped
+            while (backslashes--) { PUT('\\'); PUT('\\'); }
+            PUT('\\');
+        } else {
+            while (backslashes--) PUT('\\');
+        }
+        PUT(*arg);
+    }
+    PUT('"');
+
+#undef PUT
+    return length;
+}
+#endif
+
+/**
+ * Spawns a new process using the PATH environment variable, in a given directory and with its
+ * standard output and error sent to the null device, without waiting for it.
+ *
+ * The directory and the streams are only changed in the new process, so the current directory and
+ * the streams of the calling process, which other threads may be using, are left untouched.
+ *
+ * @param dir The working directory of the new process, or NULL to use the current one.
+ * @param file The name of the executable (resolved using the PATH environment variable).
+ * @param argv An array of strings representing command-line arguments.
+ * @return Returns the PID of the child process (its process handle on Windows), or -1 on error.
+ */
+intptr_t spawnvp_quiet(const char* dir, const char* file, char* const argv[]) {
+#ifdef _WIN32
+    // Build the command line, with the executable in place of argv[0]
+    size_t length = 1;
+    for (size_t i = 0; argv[i]; i++) length += quote_argument(i ? argv[i] : file, NULL) + 1;
+    char* commandLine = malloc(length);
+    if (!commandLine) return -1;
+    char* p = commandLine;
+    for (size_t i = 0; argv[i]; i++) {
+        if (i) *p++ = ' ';
+        p += quote_argument(i ? argv[i] : file, p);
+    }
+    *p = '\0';
+
+    SECURITY_ATTRIBUTES inherit = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+    HANDLE null = CreateFileA(DEVNULL, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &inherit, OPEN_EXISTING, 0, NULL);
+    if (null == INVALID_HANDLE_VALUE) {
+        free(commandLine);
+        return -1;
+    }
+
+    STARTUPINFOA startup;
+    memset(&startup, 0, sizeof(startup));
+    startup.cb = sizeof(startup);
+    startup.dwFlags = STARTF_USESTDHANDLES;
+    startup.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    startup.hStdOutput = null;
+    startup.hStdError = null;
+
+    PROCESS_INFORMATION process;
+    BOOL created = CreateProcessA(NULL, commandLine, NULL, NULL, TRUE, 0, NULL, dir, &startup, &process);
+    CloseHandle(null);
+    free(commandLine);
+    if (!created) return -1;
+
+    CloseHandle(process.hThread);
+    return (intptr_t) process.hProcess;
+#else
+    pid_t pid = fork();
+    if (pid == -1) return -1;
+
+    if (pid == 0) {
+        // Only async-signal-safe calls until exec, as other threads of the parent may hold locks
+        int null = open(DEVNULL, O_WRONLY);
+        if (null == -1 || dup2(null, STDOUT_FILENO) == -1 || dup2(null, STDERR_FILENO) == -1) _exit(127);
+        if (null > STDERR_FILENO) close(null);
+        if (dir && chdir(dir)) _exit(127);
+        execvp(file, argv);
+        _exit(127);
+    }
+    return pid;
+#endif
+}
@@ -36,6 +36,10 @@
 #ifndef __SPAWN_H
 #define __SPAWN_H
 
+#include <stdint.h>
+
+#ifndef _WIN32
+
 /**
  * Constant for specifying that the spawned process should be waited for to complete (synchronous execution).
  * This means the parent process will wait for the child process to finish before continuing.
@@ -87,5 +91,20 @@ int spawnv(int mode, const char* path, char* const argv[]);
  *         Returns -1 in case of an error.
  */
 int spawnvp(int mode, const char* file, char* const argv[]);
+#endif
+
+/**
+ * Spawns a new process using the PATH environment variable, in a given directory and with its
+ * standard output and error sent to the null device, without waiting for it.
+ *
+ * The directory and the streams are only changed in the new process, so the current directory and
+ * the streams of the calling process, which other threads may be using, are left untouched.
+ *
+ * @param dir The working directory of the new process, or NULL to use the current one.
+ * @param file The name of the executable (resolved using the PATH environment variable).
+ * @param argv An array of strings representing command-line arguments.
+ * @return Returns the PID of the child process (its process handle on Windows), or -1 on error.
+ */
+intptr_t spawnvp_quiet(const char* dir, const char* file, char* const argv[]);
 
 #endif /* __SPAWN_H */
@@ -0,0 +1,215 @@
+/**
+ * @file thread.c
+ * @brief Implementation of thread utility functions for the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * This source file contains the implementation of the thread utility functions used within the
+ * No Man's Sky Mod Creator (nmsmc) project, on top of POSIX threads or Windows threads.
+ *
+ * This file is part of the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 Juan José Ponteprino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author Juan José Ponteprino
+ * @date October 2023
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "thread.h"
+
+// Structure to store the function of a thread until the thread starts
+typedef struct ThreadStart {
+    void (*start)(void *);
+    void *arg;
+} ThreadStart;
+
+/**
+ * Run the function of a thread started by thread_start().
+ */
+#ifdef _WIN32
+static DWORD WINAPI thread_main(LPVOID data) {
+#else
+static void *thread_main(void *data) {
+#endif
+    ThreadStart s = *(ThreadStart *) data;
+    free(data);
+    s.start(s.arg);
+    return 0;
+}
+
+/**
+ * Start a thread.
+ *
+ * @param thread    Where the started thread is stored.
+ * @param start     The function run by the thread.
+ * @param arg       The argument passed to the function.
+ *
+ * @return          0 on success, 1 on error.
+ */
+int thread_start(Thread *thread, void (*start)(void *), void *arg) {
+    ThreadStart *s = malloc(sizeof(ThreadStart));
+    if (!s) return 1;
+    s->start = start;
+    s->arg = arg;
+
+#ifdef _WIN32
+    *thread = CreateThread(NULL, 0, thread_main, s, 0, NULL);
+    if (*thread) return 0;
+#else
+    if (!pthread_create(thread, NULL, thread_main, s)) return 0;
+#endif
+    free(s);
+    return 1;
+}
+
+/**
+ * Wait for a thread to finish and release it.
+ *
+ * @param thread    The thread.
+ */
+void thread_join(Thread thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+/**
+ * Initialize a mutex.
+ *
+ * @param mutex     The mutex.
+ */
+void mutex_init(Mutex *mutex) {
+#ifdef _WIN32
+    InitializeCriticalSection(mutex);
+#else
+    pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+/**
+ * Release a mutex.
+ *
+ * @param mutex     The mutex, which must not be locked.
+ */
+void mutex_destroy(Mutex *mutex) {
+#ifdef _WIN32
+    DeleteCriticalSection(mutex);
+#else
+    pthread_mutex_destroy(mutex);
+#endif
+}
+
+/**
+ * Lock a mutex, waiting for it if another thread has it locked.
+ *
+ * @param mutex     The mutex.
+ */
+void mutex_lock(Mutex *mutex) {
+#ifdef _WIN32
+    EnterCriticalSection(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+/**
+ * Unlock a mutex locked by the calling thread.
+ *
+ * @param mutex     The mutex.
+ */
+void mutex_unlock(Mutex *mutex) {
+#ifdef _WIN32
+    LeaveCriticalSection(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+/**
+ * Initialize a condition variable.
+ *
+ * @param condition The condition variable.
+ */
+void condition_init(Condition *condition) {
+#ifdef _WIN32
+    InitializeConditionVariable(condition);
+#else
+    pthread_cond_init(condition, NULL);
+#endif
+}
+
+/**
+ * Release a condition variable.
+ *
+ * @param condition The condition variable, which no thread may be waiting for.
+ */
+void condition_destroy(Condition *condition) {
+#ifdef _WIN32
+    (void) condition;
+#else
+    pthread_cond_destroy(condition);
+#endif
+}
+
+/**
+ * Wake up all the threads waiting for a condition variable.
+ *
+ * @param condition The condition variable.
+ */
+void condition_broadcast(Condition *condition) {
+#ifdef _WIN32
+    WakeAllConditionVariable(condition);
+#else
+    pthread_cond_broadcast(condition);
+#endif
+}
+
+/**
+ * Wait for a condition variable to be signaled, for a limited time.
+ *
+ * The mutex is unlocked while waiting and locked again before returning. As with any condition
+ * variable, the wait can also end spuriously, so the caller checks its condition again.
+ *
+ * @param condition     The condition variable.
+ * @param mutex         The mutex, locked by the calling thread.
+ * @param milliseconds  The longest time to wait.
+ */
+void condition_wait(Condition *condition, Mutex *mutex, unsigned milliseconds) {
+#ifdef _WIN32
+    SleepConditionVariableCS(condition, mutex, milliseconds);
+#else
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += milliseconds / 1000;
+    deadline.tv_nsec += (long) (milliseconds % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(condition, mutex, &deadline);
+#endif
+}
@@ -0,0 +1,144 @@
+/**
+ * @file thread.h
+ * @brief Thread utility functions for the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * This header file provides a small portable layer over POSIX threads and Windows threads for use
+ * within the No Man's Sky Mod Creator (nmsmc) project. It includes functions to start and join
+ * threads, mutexes, condition variables and the storage class of thread-local variables.
+ *
+ * This file is part of the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 Juan José Ponteprino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author Juan José Ponteprino
+ * @date October 2023
+ */
+
+#ifndef __THREAD_H
+#define __THREAD_H
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/**
+ * Storage class of the variables with a separate instance for each thread.
+ */
+#ifdef _MSC_VER
+#define THREAD_LOCAL    __declspec(thread)
+#else
+#define THREAD_LOCAL    _Thread_local
+#endif
+
+#ifdef _WIN32
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE Condition;
+#else
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Condition;
+#endif
+
+/**
+ * Start a thread.
+ *
+ * @param thread    Where the started thread is stored.
+ * @param start     The function run by the thread.
+ * @param arg       The argument passed to the function.
+ *
+ * @return          0 on success, 1 on error.
+ */
+int thread_start(Thread *thread, void (*start)(void *), void *arg);
+
+/**
+ * Wait for a thread to finish and release it.
+ *
+ * @param thread    The thread.
+ */
+void thread_join(Thread thread);
+
+/**
+ * Initialize a mutex.
+ *
+ * @param mutex     The mutex.
+ */
+void mutex_init(Mutex *mutex);
+
+/**
+ * Release a mutex.
+ *
+ * @param mutex     The mutex, which must not be locked.
+ */
+void mutex_destroy(Mutex *mutex);
+
+/**
+ * Lock a mutex, waiting for it if another thread has it locked.
+ *
+ * @param mutex     The mutex.
+ */
+void mutex_lock(Mutex *mutex);
+
+/**
+ * Unlock a mutex locked by the calling thread.
+ *
+ * @param mutex     The mutex.
+ */
+void mutex_unlock(Mutex *mutex);
+
+/**
+ * Initialize a condition variable.
+ *
+ * @param condition The condition variable.
+ */
+void condition_init(Condition *condition);
+
+/**
+ * Release a condition variable.
+ *
+ * @param condition The condition variable, which no thread may be waiting for.
+ */
+void condition_destroy(Condition *condition);
+
+/**
+ * Wake up all the threads waiting for a condition variable.
+ *
+ * @param condition The condition variable.
+ */
+void condition_broadcast(Condition *condition);
+
+/**
+ * Wait for a condition variable to be signaled, for a limited time.
+ *
+ * The mutex is unlocked while waiting and locked again before returning. As with any condition
+ * variable, the wait can also end spuriously, so the caller checks its condition again.
+ *
+ * @param condition     The condition variable.
+ * @param mutex         The mutex, locked by the calling thread.
+ * @param milliseconds  The longest time to wait.
+ */
+void condition_wait(Condition *condition, Mutex *mutex, unsigned milliseconds);
+
+#endif /* __THREAD_H */
@@ -0,0 +1,80 @@
+#!/bin/sh
+# Benchmark the attribute lookups of the patch engine.
+#
+# usage: tools/bench/attributes.sh <nmsmc> [<nmsmc>...]
+#
+# Generates an EXML document whose root has CHILDREN Property elements (20000 by default) and a
+# definition with BLOCKS blocks (5000 by default) that look the children up both by name and by
+# value, then builds it RUNS times (3 by default) with each nmsmc executable. For each executable it
+# prints the best wall time and, when a C compiler is available, the number of allocations made by
+# nmsmc, counted with malloc_count.c. psar and MBINCompiler are replaced by the stand-ins in
+# tools/fake, so the times are those of nmsmc itself.
+#
+# Passing the executables built from two commits compares them, for example the commits before and
+# after a change to the patch engine.
+
+CHILDREN=${CHILDREN:-20000}
+BLOCKS=${BLOCKS:-5000}
+RUNS=${RUNS:-3}
+
+[ $# -gt 0 ] || { echo "usage: $0 <nmsmc> [<nmsmc>...]" >&2; exit 2; }
+
+tools=$(cd "$(dirname "$0")/.." && pwd)
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+
+# Allocation counter, when it can be built
+counter=
+if ${CC:-cc} -O2 -shared -fPIC -o "$work/malloc_count.so" "$tools/bench/malloc_count.c" -ldl 2>/dev/null; then
+    counter=$work/malloc_count.so
+fi
+
+# Input PAK file and definition
+mkdir -p "$work/run/WIDE.pak"
+awk -v children="$CHILDREN" -v blocks="$BLOCKS" -v dir="$work/run" 'BEGIN {
+    srand(1)
+    mbin = dir "/WIDE.pak/WIDE.MBIN"
+    printf "MBIN:<?xml version=\"1.0\" encoding=\"utf-8\"?>\n" > mbin
+    printf "<!--File created using MBINCompiler version (4.44.1.1)-->\n" > mbin
+    printf "<Data template=\"GcWide\">\n" > mbin
+    for (i = 0; i < children; i++) printf "  <Property name=\"N%d\" value=\"V%d\" />\n", i, i > mbin
+    printf "  <Property name=\"Sub\">\n" > mbin
+    for (i = 0; i < children / 10; i++) printf "    <Property value=\"S%d\" />\n", i > mbin
+    printf "  </Property>\n</Data>\n" > mbin
+
+    def = dir "/wide.def"
+    printf "!outputPakFile out/wide.pak\n!inputPakFile WIDE.pak\n!mbinFile WIDE.MBIN\n" > def
+    for (b = 0; b < blocks; b++) {
+        printf "cd /\n" > def
+        printf "N%d=%d\n", int(rand() * children), b > def
+        printf "=V%d\n", int(rand() * children) > def
+        printf "N%d=%d\n", int(rand() * children), b > def
+        printf "cd /Sub\n=S%d\n", int(rand() * children / 10) > def
+    }
+}'
+
+printf "%d children, %d blocks, best of %d runs\n" "$CHILDREN" "$BLOCKS" "$RUNS"
+
+n=0
+for nmsmc in "$@"; do
+    n=$((n + 1))
+    # The allocation counter only reports processes named nmsmc
+    mkdir -p "$work/bin$n"
+    cp "$nmsmc" "$work/bin$n/nmsmc" || exit 1
+
+    best=
+    allocations=
+    for r in $(seq "$RUNS"); do
+        rm -rf "$work/run/out" "$work/run/wide.defc" "$work/cache" "$work/count"
+        start=$(date +%s.%N)
+        ( cd "$work/run" \
+          && PATH="$tools/fake:$PATH" XDG_CACHE_HOME="$work/cache" MALLOC_COUNT_FILE="$work/count" \
+             LD_PRELOAD="$counter" "$work/bin$n/nmsmc" wide.def > "$work/log" 2>&1 ) \
+            || { echo "$nmsmc failed:" >&2; cat "$work/log" >&2; exit 1; }
+        end=$(date +%s.%N)
+        best=$(echo "$start $end $best" | awk '{ t = $2 - $1; if ($3 != "" && $3 < t) t = $3; printf "%.2f", t }')
+        [ -f "$work/count" ] && allocations=$(cat "$work/count")
+    done
+
+    printf "%-40s %6ss  %s\n" "$nmsmc" "$best" "${allocations:+$allocations allocations}"
+done
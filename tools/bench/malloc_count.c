@@ -0,0 +1,99 @@
+/**
+ * @file malloc_count.c
+ * @brief Count the memory allocations of nmsmc, for the benchmarks under tools/bench.
+ *
+ * Built as a shared library and loaded with LD_PRELOAD. When the nmsmc process exits, the number of
+ * malloc, calloc and realloc calls it made is appended to the file named by MALLOC_COUNT_FILE. Other
+ * processes that inherit LD_PRELOAD, such as psar and MBINCompiler, are not reported.
+ *
+ * This file is part of the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 Juan José Ponteprino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author Juan José Ponteprino
+ * @date October 2023
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned long allocations = 0;
+
+static void *(*real_malloc)(size_t) = NULL;
+static void *(*real_calloc)(size_t, size_t) = NULL;
+static void *(*real_realloc)(void *, size_t) = NULL;
+
+// dlsym() may call calloc() before real_calloc is known; those calls are served from here
+static char bootstrap[4096];
+static size_t bootstrapUsed = 0;
+
+void *malloc(size_t size) {
+    if (!real_malloc) real_malloc = dlsym(RTLD_NEXT, "malloc");
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return real_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    if (!real_calloc) {
+        static int resolving = 0;
+        if (resolving) {
+            size_t bytes = (count * size + 15) & ~(size_t)15;
+            if (bytes > sizeof(bootstrap) - bootstrapUsed) return NULL;
+            void *ptr = bootstrap + bootstrapUsed;
+            bootstrapUsed += bytes;
+            return ptr;
+        }
+        resolving = 1;
+        real_calloc = dlsym(RTLD_NEXT, "calloc");
+        resolving = 0;
+    }
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return real_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (!real_realloc) real_realloc = dlsym(RTLD_NEXT, "realloc");
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return real_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    static void (*real_free)(void *) = NULL;
+    if ((char *)ptr >= bootstrap && (char *)ptr < bootstrap + sizeof(bootstrap)) return;
+    if (!real_free) real_free = dlsym(RTLD_NEXT, "free");
+    real_free(ptr);
+}
+
+__attribute__((destructor)) static void report(void) {
+    const char *filename = getenv("MALLOC_COUNT_FILE");
+    if (!filename || strcmp(program_invocation_short_name, "nmsmc")) return;
+
+    FILE *file = fopen(filename, "a");
+    if (!file) return;
+    fprintf(file, "%lu\n", allocations);
+    fclose(file);
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Check that the EXML writer of nmsmc writes the same bytes as libxml2.
+#
+# usage: tools/exml/compare.sh [<file.EXML>...]
+#
+# Builds exml_compare.c against the sources in src, once for each way exml.c can scan the markup
+# (AVX2 when the compiler and the processor have it, SSE2 on x86, and plain loops), and runs it on
+# the files given, or on the edge cases in tools/exml/cases. Prints one line per file and exits with
+# an error if any of them is saved differently.
+
+tools=$(cd "$(dirname "$0")/.." && pwd)
+src=$tools/../src
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+
+[ $# -gt 0 ] || set -- "$tools"/exml/cases/*.EXML
+
+cflags=$(pkg-config --cflags libxml-2.0 2>/dev/null || xml2-config --cflags)
+libs=$(pkg-config --libs libxml-2.0 2>/dev/null || xml2-config --libs)
+
+variants="scalar:-U__SSE2__"
+case "$(uname -m)" in
+    x86_64|i?86|amd64) variants="$variants sse2:" ;;
+esac
+grep -qw avx2 /proc/cpuinfo 2>/dev/null && variants="$variants avx2:-mavx2"
+
+status=0
+for variant in $variants; do
+    name=${variant%%:*}
+    flags=${variant#*:}
+    if ! ${CC:-cc} -O2 $flags $cflags -I"$src" -o "$work/exml_compare_$name" "$tools/exml/exml_compare.c" \
+            "$src/exml.c" "$src/arena.c" "$src/hashtable.c" $libs; then
+        echo "$name: build failed" >&2
+        status=1
+        continue
+    fi
+    echo "== $name"
+    "$work/exml_compare_$name" "$work" "$@" || status=1
+done
+exit $status
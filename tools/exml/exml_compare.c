@@ -0,0 +1,169 @@
+/**
+ * @file exml_compare.c
+ * @brief Compare the EXML writer of nmsmc with libxml2, for tools/exml/compare.sh.
+ *
+ * Each file given is loaded with libxml2 and saved with xmlSaveFormatFile, as nmsmc did before it
+ * had its own document model. The file is then saved in three other ways, which must write the
+ * same bytes:
+ * - loaded with exml_load and saved with exml_save;
+ * - saved from a snapshot of that document, with exml_save_snapshot and exml_load_snapshot;
+ * - saved from the libxml2 document with exml_save_dom.
+ * Files that exml_load or exml_save_dom don't support are reported as left to libxml2, which is
+ * what nmsmc does with them.
+ *
+ * This file is part of the No Man's Sky Mod Creator (nmsmc) project.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 Juan José Ponteprino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author Juan José Ponteprino
+ * @date October 2023
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <libxml/parser.h>
+
+#include "exml.h"
+
+// Options nmsmc loads EXML files with
+#define XML_LOAD_OPTIONS    (XML_PARSE_COMPACT | XML_PARSE_HUGE)
+
+/**
+ * Read a whole file.
+ *
+ * @param filename - The path of the file.
+ * @param size - Where to store the size of the file.
+ * @return The contents of the file, or NULL on error.
+ */
+static char *read_file(const char *filename, size_t *size) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) return NULL;
+
+    char *data = NULL;
+    if (!fseek(file, 0, SEEK_END)) {
+        long length = ftell(file);
+        if (length >= 0 && !fseek(file, 0, SEEK_SET) && (data = malloc((size_t)length + 1))) {
+            *size = fread(data, 1, (size_t)length, file);
+            if (*size != (size_t)length) {
+                free(data);
+                data = NULL;
+            }
+        }
+    }
+    fclose(file);
+    return data;
+}
+
+/**
+ * Compare a file with the reference output.
+ *
+ * @param filename - The file to compare.
+ * @param reference - The reference output.
+ * @param size - The size of the reference output.
+ * @return "same", or "DIFFERENT" if the file doesn't have the same contents.
+ */
+static const char *compare_file(const char *filename, const char *reference, size_t size) {
+    size_t length;
+    char *data = read_file(filename, &length);
+    int same = data && length == size && !memcmp(data, reference, size);
+    free(data);
+    return same ? "same" : "DIFFERENT";
+}
+
+/**
+ * Check whether a result of compare_file is a failure; files left to libxml2 are not.
+ */
+static int is_failure(const char *result) {
+    return strcmp(result, "same") && strcmp(result, "left to libxml2");
+}
+
+/**
+ * Compare the ways of saving a file.
+ *
+ * @param filename - The EXML file.
+ * @param workDir - A directory for the files written.
+ * @return 0 if they all write the same bytes, 1 otherwise.
+ */
+static int compare(const char *filename, const char *workDir) {
+    char reference[4096], output[4096], snapshot[4096];
+    snprintf(reference, sizeof(reference), "%s/reference.EXML", workDir);
+    snprintf(output, sizeof(output), "%s/output.EXML", workDir);
+    snprintf(snapshot, sizeof(snapshot), "%s/output.snapshot", workDir);
+
+    xmlDocPtr xmlDoc = xmlReadFile(filename, NULL, XML_LOAD_OPTIONS);
+    if (!xmlDoc || xmlSaveFormatFile(reference, xmlDoc, 0) < 0) {
+        printf("%s: libxml2 can't load or save it\n", filename);
+        xmlFreeDoc(xmlDoc);
+        return 1;
+    }
+
+    size_t size = 0;
+    char *expected = read_file(reference, &size);
+    if (!expected) {
+        printf("%s: can't read %s\n", filename, reference);
+        xmlFreeDoc(xmlDoc);
+        return 1;
+    }
+
+    const char *loaded = "left to libxml2", *snapshotted = "left to libxml2", *dom = "left to libxml2";
+
+    ExmlDocument *doc = exml_load(filename);
+    if (doc) {
+        remove(output);
+        loaded = exml_save(doc, output) ? "can't be saved" : compare_file(output, expected, size);
+
+        struct stat st;
+        ExmlDocument *copy = NULL;
+        remove(output);
+        if (!stat(filename, &st) && !exml_save_snapshot(doc, snapshot)) copy = exml_load_snapshot(snapshot, (uint64_t)st.st_size);
+        snapshotted = !copy || exml_save(copy, output) ? "can't be saved" : compare_file(output, expected, size);
+        exml_free(copy);
+        exml_free(doc);
+    }
+
+    remove(output);
+    if (!exml_save_dom(xmlDoc, output)) dom = compare_file(output, expected, size);
+
+    printf("%s: exml_save %s, snapshot %s, exml_save_dom %s\n", filename, loaded, snapshotted, dom);
+
+    free(expected);
+    xmlFreeDoc(xmlDoc);
+    return is_failure(loaded) || is_failure(snapshotted) || is_failure(dom);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <work_dir> <file.EXML>...\n", argv[0]);
+        return 2;
+    }
+
+    xmlInitParser();
+
+    int failed = 0;
+    for (int i = 2; i < argc; i++) failed |= compare(argv[i], argv[1]);
+
+    xmlCleanupParser();
+    return failed;
+}